@@ -1,3 +1,19 @@
+/* Multiply speed of every backend over a list of shapes.  See harness.h
+ * for the shared options.
+ *
+ * Each sample prepares the matrices and times one call after a burn-in
+ * call, cycling through the shapes; shapes with 1024 or more rows get 4
+ * samples.  --latency instead prepares each shape once and times every one
+ * of its samples, 2000 by default, back to back, then adds the p50, p90,
+ * p99, p99.9 and max times, which the trimmed mean hides.  A percentile is
+ * only reported when some sample lies above it, so p99.9 needs at least 1000
+ * samples.  The backend rows time the kernel alone, on one thread outside an
+ * OpenMP build, so --latency adds "8-bit dispatched" and "16-bit dispatched"
+ * rows timing Int8::Multiply and Int16::Multiply, whose tails include the
+ * CPU dispatch and ParallelFor.  --cold flushes the caches before each timed call by reading a
+ * buffer twice the size of the last level cache, as a layer that hasn't run
+ * in a while would see; it costs a pass over that buffer per sample.
+ */
 #include "../intgemm/aligned.h"
 #include "intgemm/intgemm_config.h"
 #include "../intgemm/avx512_gemm.h"
@@ -7,6 +23,8 @@
 #include "../intgemm/intgemm.h"
 #include "../intgemm/stats.h"
 #include "../intgemm/callbacks.h"
+#include "../intgemm/topology.h"
+#include "harness.h"
 
 #include <algorithm>
 #include <cassert>
@@ -17,14 +35,20 @@
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <random>
 
 namespace intgemm {
 namespace {
 
+const char *const kUsage =
+  "  --latency         report percentiles of the samples, default 2000 samples,\n"
+  "                    and also time Int8::Multiply and Int16::Multiply\n"
+  "  --cold            flush the caches before each timed call\n";
+
 struct RandomMatrices {
-  RandomMatrices(Index A_rows_in, Index width_in, Index B_cols_in) :
-    A_rows(A_rows_in), width(width_in), B_cols(B_cols_in),
+  explicit RandomMatrices(const bench::Shape &shape) :
+    A_rows(shape.A_rows), width(shape.width), B_cols(shape.B_cols),
     A(A_rows * width), B(width * B_cols) {
     std::mt19937 gen;
     std::uniform_real_distribution<float> dist(-1.f, 1.f);
@@ -42,7 +66,38 @@ struct RandomMatrices {
   AlignedVector<float> A, B;
 };
 
-template <class Backend> double Run(const RandomMatrices &m) {
+// Evicts everything else from the caches by reading a buffer.
+class CacheFlush {
+  public:
+    explicit CacheFlush(std::size_t bytes) : buffer_(bytes / sizeof(uint64_t), 1) {}
+
+    void Run() {
+      uint64_t sum = 0;
+      // One load per cache line brings in the whole line.
+      for (std::size_t i = 0; i < buffer_.size(); i += 64 / sizeof(uint64_t)) sum += buffer_[i];
+      sink_ = sum;
+    }
+
+  private:
+    std::vector<uint64_t> buffer_;
+    volatile uint64_t sink_;
+};
+
+// Nearest rank percentile p of sorted.
+double Percentile(const std::vector<double> &sorted, double p) {
+  // Less a little for rounding so 99.9% of 1000 is rank 999, not 1000.
+  std::size_t rank = static_cast<std::size_t>(std::ceil(p / 100.0 * sorted.size() - 1e-6));
+  return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1];
+}
+
+// Times of each sample and, when counting, the counters over all samples.
+struct Samples {
+  std::vector<double> seconds;
+  bench::CounterTotals counters;
+};
+
+// Prepares once, burns in, then times calls calls.
+template <class Backend> void Run(const RandomMatrices &m, std::size_t calls, bench::PerfCounters *counters, CacheFlush *flush, Samples &samples) {
   using Integer = typename Backend::Integer;
   float quant_mult = 127.0f / 2.0f;
   float unquant_mult = 1.0f / (quant_mult * quant_mult);
@@ -53,162 +108,132 @@ template <class Backend> double Run(const RandomMatrices &m) {
   AlignedVector<float> output(m.A_rows * m.B_cols);
   // Burn in
   Backend::Multiply(A_prepared.begin(), B_prepared.begin(), m.A_rows, m.width, m.B_cols, callbacks::UnquantizeAndWrite(unquant_mult, output.begin()));
-  auto start = std::chrono::steady_clock::now();
-  Backend::Multiply(A_prepared.begin(), B_prepared.begin(), m.A_rows, m.width, m.B_cols, callbacks::UnquantizeAndWrite(unquant_mult, output.begin()));
-  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
-}
-
-template <class Backend> void RunAll(RandomMatrices *matrices, RandomMatrices *matrices_end, std::vector<std::vector<double>> &stats) {
-  if (Backend::kUses > kCPU) return;
-  std::size_t size = matrices_end - matrices;
-  if (stats.size() < size)
-    stats.resize(size);
-  for (std::size_t i = 0; i < size; ++i) {
-    stats[i].push_back(Run<Backend>(matrices[i]));
+  for (std::size_t call = 0; call < calls; ++call) {
+    if (flush) flush->Run();
+    if (counters) counters->Start();
+    auto start = std::chrono::steady_clock::now();
+    Backend::Multiply(A_prepared.begin(), B_prepared.begin(), m.A_rows, m.width, m.B_cols, callbacks::UnquantizeAndWrite(unquant_mult, output.begin()));
+    samples.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (counters) counters->Stop(samples.counters);
   }
 }
 
-struct BackendStats {
-  std::vector<std::vector<double>> ssse3_8bit;
-  std::vector<std::vector<double>> avx2_8bit;
-  std::vector<std::vector<double>> avx512_8bit;
-  std::vector<std::vector<double>> avx512vnni_8bit;
-  std::vector<std::vector<double>> sse2_16bit;
-  std::vector<std::vector<double>> avx2_16bit;
-  std::vector<std::vector<double>> avx512_16bit;
+// The public entry points under their own names, so RunAll can time them
+// like a backend.
+struct Dispatched8 : Int8 {
+  constexpr static const char *const kName = "8-bit dispatched";
+};
+struct Dispatched16 : Int16 {
+  constexpr static const char *const kName = "16-bit dispatched";
 };
 
-const float kOutlierThreshold = 0.75;
-void Summarize(std::vector<double> &stats) {
-  // Throw out outliers.
-  std::vector<double>::iterator keep = stats.begin() + static_cast<std::size_t>(static_cast<float>(stats.size()) * kOutlierThreshold);
-  std::nth_element(stats.begin(), keep, stats.end());
-  double avg = 0.0;
-  for (std::vector<double>::const_iterator i = stats.begin(); i != keep; ++i) {
-    avg += *i;
-  }
-  avg /= (keep - stats.begin());
-  double stddev = 0.0;
-  for (std::vector<double>::const_iterator i = stats.begin(); i != keep; ++i) {
-    double off = (double)*i - avg;
-    stddev += off * off;
-  }
-  stddev = sqrt(stddev / (keep - stats.begin() - 1));
-  std::cout << std::setw(10) << *std::min_element(stats.begin(), stats.end()) << '\t' << std::setw(8) << avg << '\t' << std::setw(8) << stddev;
+// Adds percentile p of sorted if at least one sample lies above it.
+void AddPercentile(const std::vector<double> &sorted, double p, const char *name, bench::Result &result) {
+  // Less a little for rounding: 100 - 99.9 is not exactly 0.1.
+  if (static_cast<double>(sorted.size()) * (100.0 - p) < 100.0 - 1e-6) return;
+  result.extra.push_back(std::make_pair(name, Percentile(sorted, p)));
 }
 
-template <class Backend> void Print(std::vector<std::vector<double>> &stats, std::size_t index) {
-  if (stats.empty()) return;
-  std::cout << std::setw(16) << Backend::kName << '\t';
-  Summarize(stats[index]);
-  std::cout << '\n';
-}
+// Realistically, we don't expect different architectures or different precisions to run in the
+// same run of an application. Benchmark per architecture and per precision level.
+struct RunAll {
+  const std::vector<RandomMatrices> &matrices;
+  const std::size_t samples;
+  bench::PerfCounters *const counters;
+  CacheFlush *const flush;
+  const bool latency;
+  // Indexed by shape, in backend order.
+  std::vector<std::vector<bench::Result>> &results;
+
+  template <class Backend> void Run() {
+    std::cerr << Backend::kName << ", " << samples << " samples..." << std::endl;
+    std::vector<Samples> stats(matrices.size());
+    if (latency) {
+      for (std::size_t i = 0; i < matrices.size(); ++i) {
+        intgemm::Run<Backend>(matrices[i], samples, counters, flush, stats[i]);
+      }
+    } else {
+      for (std::size_t sample = 0; sample < samples; ++sample) {
+        for (std::size_t i = 0; i < matrices.size(); ++i) {
+          // Only do full sampling for <1024 rows.
+          if (sample >= 4 && matrices[i].A_rows >= 1024) continue;
+          intgemm::Run<Backend>(matrices[i], 1, counters, flush, stats[i]);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < matrices.size(); ++i) {
+      bench::Result result;
+      result.name = "Multiply";
+      result.backend = Backend::kName;
+      if (flush) result.tag = "cold";
+      result.shape.A_rows = matrices[i].A_rows;
+      result.shape.width = matrices[i].width;
+      result.shape.B_cols = matrices[i].B_cols;
+      result.time = bench::Summarize(stats[i].seconds);
+      result.operations = bench::MultiplyOperations(result.shape);
+      result.bytes = bench::MultiplyBytes<typename Backend::Integer>(result.shape);
+      result.counters = stats[i].counters;
+      if (latency) {
+        std::vector<double> &sorted = stats[i].seconds;
+        std::sort(sorted.begin(), sorted.end());
+        AddPercentile(sorted, 50.0, "p50", result);
+        AddPercentile(sorted, 90.0, "p90", result);
+        AddPercentile(sorted, 99.0, "p99", result);
+        AddPercentile(sorted, 99.9, "p99.9", result);
+        result.extra.push_back(std::make_pair("max", sorted.back()));
+      }
+      results[i].push_back(result);
+    }
+  }
+};
 
 } // namespace intgemm
 } // namespace
 
-// Program takes no input
-int main(int, char ** argv) {
-  std::cerr << "Remember to run this on a specific core:\ntaskset --cpu-list 0 " << argv[0] << std::endl;
-
+int main(int argc, char ** argv) {
   using namespace intgemm;
-  RandomMatrices matrices[] = {
-    {1, 64, 8},
-    {8, 256, 256},
-    {8, 2048, 256},
-    {8, 256, 2048},
-    {320, 256, 256},
-    {472, 256, 256},
-    {248, 256, 256},
-    {200, 256, 256},
-    // Additional stuff
-    {256, 256, 256},
-    {512, 512, 512},
-    {1024, 1024, 1024},
-/*    {4096, 4096, 4096},
-    {4096, 4096, 2048},
-    {4096, 4096, 1024},
-    {4096, 4096, 512},
-    {4096, 4096, 256},*/
-    {4096, 4096, 128}
-  };
-  RandomMatrices *matrices_end = (RandomMatrices*)matrices + sizeof(matrices) / sizeof(RandomMatrices);
-  // Only do full sampling for <1024 rows.
-  RandomMatrices *full_sample;
-  for (full_sample = matrices_end - 1; full_sample >= matrices && full_sample->A_rows >= 1024; --full_sample) {}
-  ++full_sample;
-
-  BackendStats stats;
-  const int kSamples = 100;
-  // Realistically, we don't expect different architectures or different precisions to run in the
-  // same run of an application. Benchmark per architecture and per precision level.
-  std::cerr << "SSSE3 8bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<SSSE3::Kernels8>(matrices, end, stats.ssse3_8bit);
-  }
-
-  std::cerr << "SSE2 16bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<SSE2::Kernels16>(matrices, end, stats.sse2_16bit);
-  }
-
-#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
-  std::cerr << "AVX2 8bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<AVX2::Kernels8>(matrices, end, stats.avx2_8bit);
-  }
-
-  std::cerr << "AVX2 16bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<AVX2::Kernels16>(matrices, end, stats.avx2_16bit);
+  bool latency = false, cold = false;
+  for (int i = 1; i < argc; ++i) latency |= !std::strcmp(argv[i], "--latency");
+  bench::Options options(latency ? 2000 : 100);
+  for (int i = 1; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    if (!std::strcmp(argv[i], "--cold")) {
+      cold = true;
+    } else if (std::strcmp(argv[i], "--latency")) {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage);
+    }
   }
-#endif
-#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
-  std::cerr << "AVX512 8bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<AVX512BW::Kernels8>(matrices, end, stats.avx512_8bit);
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+
+  const std::vector<bench::Shape> shapes = options.Shapes(bench::DefaultShapes());
+  std::vector<RandomMatrices> matrices;
+  matrices.reserve(shapes.size());
+  for (const bench::Shape &shape : shapes) matrices.emplace_back(shape);
+
+  std::unique_ptr<CacheFlush> flush;
+  if (cold) {
+    // Twice the last level cache, or 256 MiB if no cache size is known.
+    const std::size_t llc = GetTopology().l3_bytes ? GetTopology().l3_bytes : GetTopology().l2_bytes;
+    flush.reset(new CacheFlush(llc ? 2 * llc : (256 << 20)));
   }
 
-  std::cerr << "AVX512 16bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<AVX512BW::Kernels16>(matrices, end, stats.avx512_16bit);
-  }
-#endif
-#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512VNNI
-  std::cerr << "AVX512VNNI 8bit, 100 samples..." << std::endl;
-  for (int samples = 0; samples < kSamples; ++samples) {
-    RandomMatrices *end = (samples < 4) ? matrices_end : full_sample;
-    RunAll<AVX512VNNI::Kernels8>(matrices, end, stats.avx512vnni_8bit);
+  std::vector<std::vector<bench::Result>> results(shapes.size());
+  RunAll run = {matrices, options.samples, counters, flush.get(), latency, results};
+  bench::ForEachBackend(run);
+  if (latency) {
+    if (kCPU >= CPUType::SSSE3) run.Run<Dispatched8>();
+    if (kCPU >= CPUType::SSE2) run.Run<Dispatched16>();
   }
-#endif
 
-  if (stats.sse2_16bit.empty()) {
+  if (results.empty() || results.front().empty()) {
     std::cerr << "No CPU support." << std::endl;
     return 1;
   }
-  for (std::size_t i = 0; i < sizeof(matrices) / sizeof(RandomMatrices); ++i) {
-    std::cout << "Multiply\t" << matrices[i].A_rows << '\t' << matrices[i].width << '\t' << matrices[i].B_cols << '\t' << "Samples=" << (kOutlierThreshold * stats.sse2_16bit[i].size()) << '\n';
-    Print<SSSE3::Kernels8>(stats.ssse3_8bit, i);
-    Print<AVX2::Kernels8>(stats.avx2_8bit, i);
-#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
-    Print<AVX512BW::Kernels8>(stats.avx512_8bit, i);
-#endif
-#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512VNNI
-    Print<AVX512VNNI::Kernels8>(stats.avx512vnni_8bit, i);
-#endif
-    Print<SSE2::Kernels16>(stats.sse2_16bit, i);
-    Print<AVX2::Kernels16>(stats.avx2_16bit, i);
-#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
-    Print<AVX512BW::Kernels16>(stats.avx512_16bit, i);
-#endif
+  bench::Report report(options.format, counters);
+  for (const std::vector<bench::Result> &shape : results) {
+    for (const bench::Result &result : shape) report.Add(result);
   }
+  report.Write(std::cout);
   return 0;
 }
-
-
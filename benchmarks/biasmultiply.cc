@@ -1,11 +1,27 @@
 #include "../intgemm/intgemm.h"
 #include "../intgemm/aligned.h"
+#include "../intgemm/parallel.h"
+#include "perf_counters.h"
 #include <chrono>
+#include <cstring>
 #include <random>
 #include <iostream>
 
 using namespace intgemm;
 
+// Set by --counters: hardware counters over the Multiply calls since the
+// last PrintCounters.
+bench::PerfCounters *counters = nullptr;
+bench::CounterTotals counter_totals;
+
+void PrintCounters() {
+  if (!counters) return;
+  std::cout << "  counters per call:";
+  counters->Print(std::cout, counter_totals);
+  std::cout << std::endl;
+  counter_totals = bench::CounterTotals();
+}
+
 template <class Routine>
 void testOld(Index /*rows*/, Index /*cols*/) {
 }
@@ -40,9 +56,11 @@ std::chrono::duration<double> testNew(Index A_rows, Index width, Index B_cols) {
 
   float unquant_mult_forprep = (-1)*(alpha)*(alpha)/(127.0f); //Minus one to invert add_ps later on
   Routine::PrepareBias(B_prep.begin(), width, B_cols, callbacks::UnquantizeAndAddBiasAndWrite(unquant_mult_forprep, bias.begin(), bias.begin()));
+  if (counters) counters->Start();
   auto start = std::chrono::system_clock::now();
   Routine::Multiply8Shift(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndAddBiasAndWrite(unquant_mult, bias.begin(), test_C.begin()));
   auto end = std::chrono::system_clock::now();
+  if (counters) counters->Stop(counter_totals);
 
   std::chrono::duration<double> elapsed_seconds = end-start;
   return elapsed_seconds;
@@ -77,9 +95,11 @@ std::chrono::duration<double> testOld(Index A_rows, Index width, Index B_cols) {
 
   AlignedVector<float> test_C(A_rows * B_cols);
 
+  if (counters) counters->Start();
   auto start = std::chrono::system_clock::now();
   Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndAddBiasAndWrite(unquant_mult, bias.begin(), test_C.begin()));
   auto end = std::chrono::system_clock::now();
+  if (counters) counters->Stop(counter_totals);
 
   std::chrono::duration<double> elapsed_seconds = end-start;
   return elapsed_seconds;
@@ -110,19 +130,37 @@ std::chrono::duration<double> testOld_nobias(Index A_rows, Index width, Index B_
 
   AlignedVector<float> test_C(A_rows * B_cols);
 
+  if (counters) counters->Start();
   auto start = std::chrono::system_clock::now();
   Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test_C.begin()));
   auto end = std::chrono::system_clock::now();
+  if (counters) counters->Stop(counter_totals);
 
   std::chrono::duration<double> elapsed_seconds = end-start;
   return elapsed_seconds;
 
 }
 
+// Usage: biasmultiply [repeat] [--counters]
 int main(int argc, char ** argv) {
 	int repeat = 1000;
-	if (argc > 1) {
-		repeat = atoi(argv[1]);
+	bool count = false;
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "--counters")) {
+			count = true;
+		} else {
+			repeat = atoi(argv[i]);
+		}
+	}
+	if (bench::PinToFastestCPU() < 0) std::cerr << "Could not pin to a core; timings may move between cores." << std::endl;
+	bench::PerfCounters perf;
+	if (count) {
+		if (!perf.Error().empty()) std::cerr << "Not counting " << perf.Error() << std::endl;
+		if (perf.Available()) {
+			counters = &perf;
+			// Counters only see the calling thread.
+			SetConcurrencyLimit(1);
+		}
 	}
 
 	std::chrono::duration<double> oldSSSE3_nobias = testOld_nobias<SSSE3::Kernels8>(1, 64, 8);
@@ -136,6 +174,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of SSSE3 without bias took: " << oldSSSE3_nobias.count() << " seconds." << std::endl;
+	PrintCounters();
 
 	std::chrono::duration<double> oldSSSE3 = testOld<SSSE3::Kernels8>(1, 64, 8);
 	for (int i = 0; i<repeat; i++) {
@@ -148,6 +187,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of SSSE3 took: " << oldSSSE3.count() << " seconds." << std::endl;
+	PrintCounters();
 
 	std::chrono::duration<double> newTimeSSSE3 = testOld<SSSE3::Kernels8>(1, 64, 8);
 	for (int i = 0; i<repeat; i++) {
@@ -160,6 +200,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of Shifted SSSE3 took: " << newTimeSSSE3.count() << " seconds." << std::endl;
+	PrintCounters();
 
 #ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
 	std::chrono::duration<double> oldAVX2_nobias = testOld_nobias<AVX2::Kernels8>(1, 64, 8);
@@ -173,6 +214,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of AVX2 without bias took: " << oldAVX2_nobias.count() << " seconds." << std::endl;
+	PrintCounters();
 
 	std::chrono::duration<double> oldAVX2 = testOld<AVX2::Kernels8>(1, 64, 8);
 	for (int i = 0; i<repeat; i++) {
@@ -185,6 +227,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of AVX2 took: " << oldAVX2.count() << " seconds." << std::endl;
+	PrintCounters();
 
 	std::chrono::duration<double> newTimeAVX2 = testOld<AVX2::Kernels8>(1, 64, 8);
 	for (int i = 0; i<repeat; i++) {
@@ -197,6 +240,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of Shifted AVX2 took: " << newTimeAVX2.count() << " seconds." << std::endl;
+	PrintCounters();
 #endif
 #ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
 	if (kCPU < CPUType::AVX512BW) return 0;
@@ -211,6 +255,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of AVX512 without bias took: " << oldAVX512_nobias.count() << " seconds." << std::endl;
+	PrintCounters();
 
 	std::chrono::duration<double> oldAVX512 = testOld<AVX512BW::Kernels8>(1, 64, 8);
 	for (int i = 0; i<repeat; i++) {
@@ -223,6 +268,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of AVX512 took: " << oldAVX512.count() << " seconds." << std::endl;
+	PrintCounters();
 
 	std::chrono::duration<double> newTimeAVX512 = testOld<AVX512BW::Kernels8>(1, 64, 8);
 	for (int i = 0; i<repeat; i++) {
@@ -235,6 +281,7 @@ int main(int argc, char ** argv) {
 	}
 
 	std::cout << repeat << " iterations of Shifted AVX512 took: " << newTimeAVX512.count() << " seconds." << std::endl;
+	PrintCounters();
 #endif
 #ifdef INTGEMM_COMPILER_SUPPORTS_AVX512VNNI
   if (kCPU < CPUType::AVX512VNNI) return 0;
@@ -249,6 +296,7 @@ int main(int argc, char ** argv) {
   }
 
   std::cout << repeat << " iterations of AVX512VNNI without bias took: " << oldAVX512VNNI_nobias.count() << " seconds." << std::endl;
+  PrintCounters();
 
   std::chrono::duration<double> oldAVX512VNNI = testOld<AVX512BW::Kernels8>(1, 64, 8);
   for (int i = 0; i<repeat; i++) {
@@ -261,6 +309,7 @@ int main(int argc, char ** argv) {
   }
 
   std::cout << repeat << " iterations of AVX512VNNI took: " << oldAVX512VNNI.count() << " seconds." << std::endl;
+  PrintCounters();
 
   std::chrono::duration<double> newTimeAVX512VNNI = testOld<AVX512BW::Kernels8>(1, 64, 8);
   for (int i = 0; i<repeat; i++) {
@@ -273,6 +322,7 @@ int main(int argc, char ** argv) {
   }
 
   std::cout << repeat << " iterations of Shifted AVX512VNNI took: " << newTimeAVX512VNNI.count() << " seconds." << std::endl;
+  PrintCounters();
 #endif
 
 }
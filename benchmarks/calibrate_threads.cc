@@ -0,0 +1,99 @@
+/* Measure the numbers behind intgemm/cost_model.h on this machine: how fast
+ * one core multiplies and quantizes with each instruction set, and how much
+ * each extra thread adds to a parallel region.  Prints the calls to make
+ * before using intgemm, or the values to put in cost_model.cc.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/cost_model.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/parallel.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/sse2_gemm.h"
+#include "../intgemm/ssse3_gemm.h"
+#include "../intgemm/avx2_gemm.h"
+#include "../intgemm/avx512_gemm.h"
+#include "../intgemm/avx512vnni_gemm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+// Minimum over tries of the time fn takes, in microseconds.
+template <class Function> float MinMicroseconds(std::size_t tries, Function fn) {
+  fn();
+  float best = 1e30f;
+  for (std::size_t t = 0; t < tries; ++t) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    best = std::min(best, std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+const Index kRows = 64, kWidth = 512, kCols = 512;
+
+// Multiply-accumulates per microsecond on one thread.
+template <class Backend> float MultiplyRate() {
+  typedef typename Backend::Integer Integer;
+  AlignedVector<float> A(kRows * kWidth), B(kWidth * kCols), C(kRows * kCols);
+  std::mt19937 gen;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  for (auto &it : A) it = dist(gen);
+  for (auto &it : B) it = dist(gen);
+  AlignedVector<Integer> A_prep(A.size()), B_prep(B.size());
+  Backend::PrepareA(A.begin(), A_prep.begin(), 64.0f, kRows, kWidth);
+  Backend::PrepareB(B.begin(), B_prep.begin(), 64.0f, kWidth, kCols);
+  const float took = MinMicroseconds(20, [&] {
+    Backend::Multiply(A_prep.begin(), B_prep.begin(), kRows, kWidth, kCols, callbacks::UnquantizeAndWrite(1.0f, C.begin()));
+  });
+  return static_cast<float>(kRows) * kWidth * kCols / took;
+}
+
+// Floats per microsecond on one thread.
+template <class Backend> float QuantizeRate() {
+  const Index size = 1 << 20;
+  AlignedVector<float> in(size);
+  AlignedVector<int8_t> out(size);
+  std::fill(in.begin(), in.end(), 1.0f);
+  const float took = MinMicroseconds(20, [&] { Backend::Quantize(in.begin(), out.begin(), 64.0f, size); });
+  return static_cast<float>(size) / took;
+}
+
+template <class Backend8, class Backend16> void Calibrate(CPUType isa, const char *name) {
+  if (kCPU < isa) return;
+  CostRates rates;
+  rates.multiply8 = MultiplyRate<Backend8>();
+  rates.multiply16 = MultiplyRate<Backend16>();
+  rates.quantize = QuantizeRate<Backend8>();
+  std::cout << "SetCostRates(CPUType::" << name << ", {" << rates.multiply8 << "f, " << rates.multiply16 << "f, " << rates.quantize << "f});\n";
+}
+
+} // namespace
+} // namespace intgemm
+
+int main() {
+  using namespace intgemm;
+  const float overhead = MeasureThreadOverhead(1000);
+  // Rates are per core so measure them alone.
+  SetConcurrencyLimit(1);
+  Calibrate<SSSE3::Kernels8, SSE2::Kernels16>(CPUType::SSSE3, "SSSE3");
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+  Calibrate<AVX2::Kernels8, AVX2::Kernels16>(CPUType::AVX2, "AVX2");
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+  Calibrate<AVX512BW::Kernels8, AVX512BW::Kernels16>(CPUType::AVX512BW, "AVX512BW");
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512VNNI
+  Calibrate<AVX512VNNI::Kernels8, AVX512BW::Kernels16>(CPUType::AVX512VNNI, "AVX512VNNI");
+#endif
+  if (overhead < 0.0f) {
+    std::cout << "// Only one thread available; thread overhead not measured.\n";
+  } else {
+    std::cout << "SetThreadOverhead(" << overhead << "f);\n";
+  }
+}
@@ -0,0 +1,108 @@
+/* What the callback run on each Multiply output costs.  Every shape runs on
+ * every backend with each shipped callback.  The baseline is Write<int>,
+ * which only stores the sums: Dummy would be the natural one, but with the
+ * sums discarded the compiler removes the multiply along with them.  The
+ * difference from the baseline is the epilogue, reported as its share of the
+ * total time and as nanoseconds per output.  Small widths leave few
+ * multiply-adds per output, so that is where the epilogue matters most.
+ *
+ * See harness.h for the shared options.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "harness.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+struct Epilogues {
+  const bench::Options &options;
+  bench::PerfCounters *const counters;
+  const std::vector<bench::Shape> &shapes;
+  bench::Report &report;
+
+  // Multiply with callback, tagged with name.
+  template <class Backend, class Callback> void Time(const char *name, const bench::Shape &shape, const typename Backend::Integer *A, const typename Backend::Integer *B, Callback callback, double &baseline) {
+    bench::Result result;
+    result.name = "Multiply";
+    result.backend = Backend::kName;
+    result.tag = name;
+    result.shape = shape;
+    result.operations = bench::MultiplyOperations(shape);
+    result.bytes = bench::MultiplyBytes<typename Backend::Integer>(shape);
+    std::vector<double> seconds;
+    bench::Measure(options.samples, counters, [&] {
+      Backend::Multiply(A, B, shape.A_rows, shape.width, shape.B_cols, callback);
+    }, seconds, result.counters);
+    result.time = bench::Summarize(seconds);
+    if (!baseline) baseline = result.time.mean;
+    const double epilogue = result.time.mean - baseline;
+    result.extra.push_back(std::make_pair("epilogue_share", epilogue / result.time.mean));
+    result.extra.push_back(std::make_pair("epilogue_ns_per_output", epilogue * 1e9 / (static_cast<double>(shape.A_rows) * shape.B_cols)));
+    report.Add(result);
+  }
+
+  template <class Backend> void Run() {
+    typedef typename Backend::Integer Integer;
+    std::cerr << Backend::kName << "..." << std::endl;
+    std::mt19937 gen(45678);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    for (const bench::Shape &shape : shapes) {
+      AlignedVector<float> A(shape.A_rows * shape.width), B(shape.width * shape.B_cols), bias(shape.B_cols), C(shape.A_rows * shape.B_cols);
+      for (float &f : A) f = dist(gen);
+      for (float &f : B) f = dist(gen);
+      for (float &f : bias) f = dist(gen);
+      AlignedVector<int> bias_int(shape.B_cols), C_int(shape.A_rows * shape.B_cols);
+      for (Index i = 0; i < shape.B_cols; ++i) bias_int[i] = static_cast<int>(bias[i] * 64.0f);
+      AlignedVector<Integer> A_prepared(A.size()), B_prepared(B.size());
+      Backend::PrepareA(A.begin(), A_prepared.begin(), 64.0f, shape.A_rows, shape.width);
+      Backend::PrepareB(B.begin(), B_prepared.begin(), 64.0f, shape.width, shape.B_cols);
+      const float unquant_mult = 1.0f / (64.0f * 64.0f);
+
+      // Time of Multiply with Write<int>, set by the first call.
+      double baseline = 0.0;
+      Time<Backend>("Write<int>", shape, A_prepared.begin(), B_prepared.begin(), callbacks::Write<int>(C_int.begin()), baseline);
+      Time<Backend>("AddBiasAndWrite", shape, A_prepared.begin(), B_prepared.begin(), callbacks::AddBiasAndWrite(bias_int.begin(), C_int.begin()), baseline);
+      Time<Backend>("UnquantizeAndWrite", shape, A_prepared.begin(), B_prepared.begin(), callbacks::UnquantizeAndWrite(unquant_mult, C.begin()), baseline);
+      Time<Backend>("UnquantizeAndWriteRelu", shape, A_prepared.begin(), B_prepared.begin(), callbacks::UnquantizeAndWriteRelu(unquant_mult, C.begin()), baseline);
+      Time<Backend>("UnquantizeAndAddBiasAndWrite", shape, A_prepared.begin(), B_prepared.begin(), callbacks::UnquantizeAndAddBiasAndWrite(unquant_mult, bias.begin(), C.begin()), baseline);
+      Time<Backend>("UnquantizeAndAddBiasAndWriteRelu", shape, A_prepared.begin(), B_prepared.begin(), callbacks::UnquantizeAndAddBiasAndWriteRelu(unquant_mult, bias.begin(), C.begin()), baseline);
+      Time<Backend>("Sequence(Unquantize,Write<float>)", shape, A_prepared.begin(), B_prepared.begin(), callbacks::Sequence(callbacks::Unquantize(unquant_mult), callbacks::Write<float>(C.begin())), baseline);
+    }
+  }
+};
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  bench::Options options(50);
+  for (int i = 1; i < argc; ++i) {
+    if (!bench::ParseOption(argc, argv, i, options)) bench::Usage(argv[0], std::string("Unknown option ") + argv[i]);
+  }
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+  // Small widths, where the epilogue is a large part of the work, up to a
+  // width where it should vanish.
+  const bench::Shape defaults[] = {
+    {1, 64, 4096},
+    {8, 64, 2048},
+    {64, 64, 512},
+    {8, 256, 2048},
+    {64, 256, 512},
+    {8, 1024, 1024},
+    {64, 2048, 512}
+  };
+  const std::vector<bench::Shape> shapes = options.Shapes(std::vector<bench::Shape>(defaults, defaults + sizeof(defaults) / sizeof(bench::Shape)));
+  bench::Report report(options.format, counters);
+  Epilogues epilogues = {options, counters, shapes, report};
+  bench::ForEachBackend(epilogues);
+  report.Write(std::cout);
+  return 0;
+}
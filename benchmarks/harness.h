@@ -0,0 +1,463 @@
+#pragma once
+/* Harness shared by the benchmark programs: which shapes to run, which
+ * backends this CPU has, trimming and summarising samples, and writing
+ * results as a table, JSON or CSV.
+ *
+ * Shapes come from the program's defaults, from a file with --shapes or
+ * from ranges with --rows, --width and --cols, which run every combination.
+ * A range is a comma separated list of numbers and spans: "8,64,256",
+ * "8:1024:*2" doubles from 8 up to 1024, "256:2048:+256" steps by 256.
+ * A shape file has one "A_rows width B_cols" per line; # starts a comment.
+ *
+ * Backends above kCPU are skipped, so INTGEMM_CPUID caps them as usual.
+ */
+
+#include "../intgemm/aligned.h"
+#include "intgemm/intgemm_config.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/sse2_gemm.h"
+#include "../intgemm/ssse3_gemm.h"
+#include "../intgemm/avx2_gemm.h"
+#include "../intgemm/avx512_gemm.h"
+#include "../intgemm/avx512vnni_gemm.h"
+#include "../intgemm/parallel.h"
+#include "perf_counters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace intgemm {
+namespace bench {
+
+struct Shape {
+  Index A_rows, width, B_cols;
+};
+
+// Appends the numbers in text, in the format above.  Returns false if malformed.
+inline bool ParseRange(const std::string &text, std::vector<Index> &out) {
+  std::stringstream parts(text);
+  std::string part;
+  while (std::getline(parts, part, ',')) {
+    unsigned long begin, end, step;
+    char op;
+    int used = 0;
+    if (std::sscanf(part.c_str(), "%lu:%lu:%c%lu%n", &begin, &end, &op, &step, &used) == 4 && used == static_cast<int>(part.size())) {
+      if ((op != '*' && op != '+') || (op == '*' ? step < 2 : step < 1) || !begin) return false;
+      for (unsigned long value = begin; value <= end; value = (op == '*') ? value * step : value + step) {
+        out.push_back(static_cast<Index>(value));
+      }
+    } else if (std::sscanf(part.c_str(), "%lu%n", &begin, &used) == 1 && used == static_cast<int>(part.size()) && begin) {
+      out.push_back(static_cast<Index>(begin));
+    } else {
+      return false;
+    }
+  }
+  return !out.empty();
+}
+
+// Appends the shapes in a shape file.  Returns false if malformed.
+inline bool ReadShapes(std::istream &in, std::vector<Shape> &out) {
+  std::string line;
+  while (std::getline(in, line)) {
+    line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+    std::istringstream fields(line);
+    unsigned long A_rows, width, B_cols;
+    if (!(fields >> A_rows)) continue;
+    if (!(fields >> width >> B_cols) || !A_rows || !width || !B_cols) return false;
+    std::string rest;
+    if (fields >> rest) return false;
+    Shape shape = {static_cast<Index>(A_rows), static_cast<Index>(width), static_cast<Index>(B_cols)};
+    out.push_back(shape);
+  }
+  return true;
+}
+
+enum class Format { Table, JSON, CSV };
+
+const char *const kOptionsUsage =
+  "  --shapes FILE     shapes to run, one \"A_rows width B_cols\" per line\n"
+  "  --rows RANGE      with --width and --cols, run every combination\n"
+  "  --width RANGE\n"
+  "  --cols RANGE\n"
+  "  --samples N       samples per shape and backend\n"
+  "  --format F        table (default), json or csv\n"
+  "  --counters        also report hardware performance counters\n";
+
+struct Options {
+  explicit Options(std::size_t default_samples) : samples(default_samples), format(Format::Table), counters(false), usage_status(1) {}
+
+  std::vector<Shape> shapes;
+  std::vector<Index> rows, width, cols;
+  std::size_t samples;
+  Format format;
+  bool counters;
+  // Exit status when ParseOption rejects an option, for programs whose exit
+  // status already means something else.
+  int usage_status;
+
+  // Shapes to run: from --shapes, then the combinations of the ranges, or
+  // the defaults if neither was given.
+  std::vector<Shape> Shapes(const std::vector<Shape> &defaults) const {
+    std::vector<Shape> ret(shapes);
+    if (!rows.empty() || !width.empty() || !cols.empty()) {
+      const std::vector<Index> one(1, 256);
+      for (Index r : rows.empty() ? one : rows) {
+        for (Index w : width.empty() ? one : width) {
+          for (Index c : cols.empty() ? one : cols) {
+            Shape shape = {r, w, c};
+            ret.push_back(shape);
+          }
+        }
+      }
+    }
+    return ret.empty() ? defaults : ret;
+  }
+};
+
+// Multiply shapes benchmark and regression run without --shapes or ranges.
+inline std::vector<Shape> DefaultShapes() {
+  static const Shape shapes[] = {
+    {1, 64, 8},
+    {8, 256, 256},
+    {8, 2048, 256},
+    {8, 256, 2048},
+    {320, 256, 256},
+    {472, 256, 256},
+    {248, 256, 256},
+    {200, 256, 256},
+    // Additional stuff
+    {256, 256, 256},
+    {512, 512, 512},
+    {1024, 1024, 1024},
+/*    {4096, 4096, 4096},
+    {4096, 4096, 2048},
+    {4096, 4096, 1024},
+    {4096, 4096, 512},
+    {4096, 4096, 256},*/
+    {4096, 4096, 128}
+  };
+  return std::vector<Shape>(shapes, shapes + sizeof(shapes) / sizeof(Shape));
+}
+
+// Exits with a message and status.
+inline void Usage(const char *program, const std::string &error, const char *own_usage = "", int status = 1) {
+  std::cerr << error << "\nUsage: " << program << " [options]\n" << own_usage << kOptionsUsage;
+  std::exit(status);
+}
+
+// If argv[i] is a harness option, consumes it and any argument, leaving i on
+// the last argument used, and returns true.
+inline bool ParseOption(int argc, char **argv, int &i, Options &options) {
+  const char *flag = argv[i];
+  if (!std::strcmp(flag, "--counters")) {
+    options.counters = true;
+    return true;
+  }
+  if (std::strcmp(flag, "--shapes") && std::strcmp(flag, "--rows") && std::strcmp(flag, "--width") && std::strcmp(flag, "--cols") && std::strcmp(flag, "--samples") && std::strcmp(flag, "--format")) return false;
+  if (++i == argc) Usage(argv[0], std::string(flag) + " needs an argument", "", options.usage_status);
+  const std::string value(argv[i]);
+  bool good = true;
+  if (!std::strcmp(flag, "--shapes")) {
+    std::ifstream in(value.c_str());
+    good = in && ReadShapes(in, options.shapes);
+  } else if (!std::strcmp(flag, "--rows")) {
+    good = ParseRange(value, options.rows);
+  } else if (!std::strcmp(flag, "--width")) {
+    good = ParseRange(value, options.width);
+  } else if (!std::strcmp(flag, "--cols")) {
+    good = ParseRange(value, options.cols);
+  } else if (!std::strcmp(flag, "--samples")) {
+    options.samples = std::strtoul(value.c_str(), nullptr, 10);
+    good = options.samples > 0;
+  } else if (value == "table") {
+    options.format = Format::Table;
+  } else if (value == "json") {
+    options.format = Format::JSON;
+  } else if (value == "csv") {
+    options.format = Format::CSV;
+  } else {
+    good = false;
+  }
+  if (!good) Usage(argv[0], "Bad " + std::string(flag) + " " + value, "", options.usage_status);
+  return true;
+}
+
+// Pins to the fastest core and opens the counters if asked for, explaining
+// on stderr what didn't work.  Returns the counters to use or nullptr.
+// Counters only see the calling thread, so while they are in use intgemm is
+// limited to that thread with SetConcurrencyLimit(1).
+inline PerfCounters *Setup(const char *program, const Options &options, PerfCounters &perf) {
+  const int cpu = PinToFastestCPU();
+  if (cpu < 0) {
+    std::cerr << "Could not pin to a core.  Remember to run this on a specific core:\ntaskset --cpu-list 0 " << program << std::endl;
+  } else {
+    std::cerr << "Pinned to CPU " << cpu << '.' << std::endl;
+  }
+  if (!options.counters) return nullptr;
+  if (!perf.Error().empty()) std::cerr << "Not counting " << perf.Error() << std::endl;
+  if (!perf.Available()) return nullptr;
+  SetConcurrencyLimit(1);
+  return &perf;
+}
+
+// Calls visitor.template Run<Backend>() for every Multiply backend this
+// CPU supports, 8-bit then 16-bit.
+template <class Backend, class Visitor> void VisitBackend(Visitor &visitor) {
+  if (Backend::kUses <= kCPU) visitor.template Run<Backend>();
+}
+template <class Visitor> void ForEachBackend(Visitor &visitor) {
+  VisitBackend<SSSE3::Kernels8>(visitor);
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+  VisitBackend<AVX2::Kernels8>(visitor);
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+  VisitBackend<AVX512BW::Kernels8>(visitor);
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512VNNI
+  VisitBackend<AVX512VNNI::Kernels8>(visitor);
+#endif
+  VisitBackend<SSE2::Kernels16>(visitor);
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+  VisitBackend<AVX2::Kernels16>(visitor);
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+  VisitBackend<AVX512BW::Kernels16>(visitor);
+#endif
+}
+
+inline const char *CPUTypeName(CPUType cpu) {
+  switch (cpu) {
+    case CPUType::UNSUPPORTED: return "UNSUPPORTED";
+    case CPUType::SSE2: return "SSE2";
+    case CPUType::SSSE3: return "SSSE3";
+    case CPUType::AVX2: return "AVX2";
+    case CPUType::AVX512BW: return "AVX512BW";
+    case CPUType::AVX512VNNI: return "AVX512VNNI";
+  }
+  return "UNKNOWN";
+}
+
+// Model name from /proc/cpuinfo, "unknown" elsewhere.
+inline std::string CPUModel() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name")) continue;
+    std::string::size_type colon = line.find(':');
+    if (colon == std::string::npos) break;
+    std::string::size_type start = line.find_first_not_of(' ', colon + 1);
+    return start == std::string::npos ? "unknown" : line.substr(start);
+  }
+  return "unknown";
+}
+
+struct Summary {
+  double min, mean, stddev;
+  // Samples left after trimming.
+  std::size_t kept;
+};
+
+// Only the fastest kOutlierThreshold of samples count towards mean and stddev.
+const float kOutlierThreshold = 0.75;
+inline Summary Summarize(std::vector<double> &stats) {
+  Summary summary;
+  summary.min = summary.mean = summary.stddev = 0.0;
+  summary.kept = 0;
+  if (stats.empty()) return summary;
+  // Throw out outliers.
+  std::vector<double>::iterator keep = stats.begin() + std::max<std::size_t>(1, static_cast<std::size_t>(static_cast<float>(stats.size()) * kOutlierThreshold));
+  std::nth_element(stats.begin(), keep - 1, stats.end());
+  summary.kept = keep - stats.begin();
+  for (std::vector<double>::const_iterator i = stats.begin(); i != keep; ++i) {
+    summary.mean += *i;
+  }
+  summary.mean /= summary.kept;
+  for (std::vector<double>::const_iterator i = stats.begin(); i != keep; ++i) {
+    double off = *i - summary.mean;
+    summary.stddev += off * off;
+  }
+  if (summary.kept > 1) summary.stddev = std::sqrt(summary.stddev / (summary.kept - 1));
+  summary.min = *std::min_element(stats.begin(), stats.end());
+  return summary;
+}
+
+// Times samples calls of fn after one warm-up call, appending to seconds
+// and adding to totals if counters is set.
+template <class Function> void Measure(std::size_t samples, PerfCounters *counters, Function fn, std::vector<double> &seconds, CounterTotals &totals) {
+  fn();
+  for (std::size_t i = 0; i < samples; ++i) {
+    if (counters) counters->Start();
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (counters) counters->Stop(totals);
+  }
+}
+
+// Multiply-adds count as two operations; bytes are the prepared A and B
+// read plus the float output written.
+inline double MultiplyOperations(const Shape &shape) {
+  return 2.0 * shape.A_rows * shape.width * shape.B_cols;
+}
+template <class Integer> inline double MultiplyBytes(const Shape &shape) {
+  return static_cast<double>(sizeof(Integer)) * (shape.A_rows + shape.B_cols) * shape.width + sizeof(float) * static_cast<double>(shape.A_rows) * shape.B_cols;
+}
+
+// Multiply with Backend the way Int8::Multiply and Int16::Multiply do, over
+// ParallelFor with the cost model's thread count under the concurrency
+// limit.  Backend::Multiply alone is one thread outside an OpenMP region.
+template <class Backend, class Callback> inline void Multiply(const typename Backend::Integer *A, const typename Backend::Integer *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+  ParallelWrap<Callback, Backend>(A, B, A_rows, width, B_cols, callback);
+}
+
+struct Result {
+  // What was measured, e.g. "Multiply".
+  std::string name;
+  std::string backend;
+  // Optional label, e.g. the cache level a working set fits in.
+  std::string tag;
+  Shape shape;
+  Summary time;
+  // Per call.
+  double operations, bytes;
+  CounterTotals counters;
+  // More named values, e.g. speedups, written after the standard ones.
+  std::vector<std::pair<std::string, double>> extra;
+
+  // From the trimmed mean.
+  double GOPS() const { return time.mean > 0.0 ? operations / time.mean * 1e-9 : 0.0; }
+  double GBps() const { return time.mean > 0.0 ? bytes / time.mean * 1e-9 : 0.0; }
+};
+
+// Collects results and writes them in one of the formats.
+class Report {
+  public:
+    Report(Format format, const PerfCounters *counters) : format_(format), counters_(counters) {}
+
+    void Add(const Result &result) { results_.push_back(result); }
+
+    const std::vector<Result> &Results() const { return results_; }
+
+    void Write(std::ostream &out) const {
+      switch (format_) {
+        case Format::Table: WriteTable(out); break;
+        case Format::JSON: WriteJSON(out); break;
+        case Format::CSV: WriteCSV(out); break;
+      }
+    }
+
+  private:
+    // Table lines are grouped under a header whenever the name or shape changes.
+    void WriteTable(std::ostream &out) const {
+      const Result *previous = nullptr;
+      for (const Result &r : results_) {
+        if (!previous || previous->name != r.name || std::memcmp(&previous->shape, &r.shape, sizeof(Shape))) {
+          out << r.name << '\t' << r.shape.A_rows << '\t' << r.shape.width << '\t' << r.shape.B_cols << '\t' << "Samples=" << r.time.kept << '\n';
+        }
+        previous = &r;
+        out << std::setw(16) << r.backend << '\t';
+        if (!r.tag.empty()) out << r.tag << '\t';
+        out << std::setw(10) << r.time.min << '\t' << std::setw(8) << r.time.mean << '\t' << std::setw(8) << r.time.stddev
+          << '\t' << std::setw(8) << r.GOPS() << " GOPS\t" << std::setw(8) << r.GBps() << " GB/s";
+        for (const std::pair<std::string, double> &e : r.extra) out << '\t' << e.first << '=' << e.second;
+        if (counters_) counters_->Print(out, r.counters);
+        out << '\n';
+      }
+    }
+
+    static void WriteString(std::ostream &out, const std::string &str) {
+      out << '"';
+      for (char c : str) {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+      }
+      out << '"';
+    }
+
+    // Counter value per measured region, 0 if none were.
+    static double PerRegion(const CounterTotals &totals, std::size_t i) {
+      return (totals.regions && i < totals.values.size()) ? static_cast<double>(totals.values[i]) / totals.regions : 0.0;
+    }
+
+    void WriteJSON(std::ostream &out) const {
+      out << "{\"cpu\":";
+      WriteString(out, CPUModel());
+      out << ",\"isa\":\"" << CPUTypeName(kCPU) << "\",\"results\":[";
+      for (std::size_t i = 0; i < results_.size(); ++i) {
+        const Result &r = results_[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":";
+        WriteString(out, r.name);
+        out << ",\"backend\":";
+        WriteString(out, r.backend);
+        if (!r.tag.empty()) {
+          out << ",\"tag\":";
+          WriteString(out, r.tag);
+        }
+        out << ",\"A_rows\":" << r.shape.A_rows << ",\"width\":" << r.shape.width << ",\"B_cols\":" << r.shape.B_cols
+          << ",\"samples\":" << r.time.kept << ",\"min_seconds\":" << r.time.min << ",\"mean_seconds\":" << r.time.mean << ",\"stddev_seconds\":" << r.time.stddev
+          << ",\"gops\":" << r.GOPS() << ",\"gbps\":" << r.GBps();
+        for (const std::pair<std::string, double> &e : r.extra) {
+          out << ',';
+          WriteString(out, e.first);
+          out << ':' << e.second;
+        }
+        if (counters_) {
+          out << ",\"counters\":{";
+          for (std::size_t c = 0; c < counters_->Size(); ++c) {
+            out << (c ? ",\"" : "\"") << counters_->Name(c) << "\":" << PerRegion(r.counters, c);
+          }
+          out << '}';
+        }
+        out << '}';
+      }
+      out << "\n]}\n";
+    }
+
+    void WriteCSV(std::ostream &out) const {
+      // Every extra name any result has gets a column.
+      std::vector<std::string> extra;
+      for (const Result &r : results_) {
+        for (const std::pair<std::string, double> &e : r.extra) {
+          if (std::find(extra.begin(), extra.end(), e.first) == extra.end()) extra.push_back(e.first);
+        }
+      }
+      out << "name,backend,tag,A_rows,width,B_cols,samples,min_seconds,mean_seconds,stddev_seconds,gops,gbps";
+      for (const std::string &name : extra) out << ',' << name;
+      if (counters_) {
+        for (std::size_t c = 0; c < counters_->Size(); ++c) out << ',' << counters_->Name(c);
+      }
+      out << '\n';
+      for (const Result &r : results_) {
+        out << r.name << ',' << r.backend << ',' << r.tag << ',' << r.shape.A_rows << ',' << r.shape.width << ',' << r.shape.B_cols << ',' << r.time.kept << ','
+          << r.time.min << ',' << r.time.mean << ',' << r.time.stddev << ',' << r.GOPS() << ',' << r.GBps();
+        for (const std::string &name : extra) {
+          out << ',';
+          for (const std::pair<std::string, double> &e : r.extra) {
+            if (e.first == name) out << e.second;
+          }
+        }
+        if (counters_) {
+          for (std::size_t c = 0; c < counters_->Size(); ++c) out << ',' << PerRegion(r.counters, c);
+        }
+        out << '\n';
+      }
+    }
+
+    const Format format_;
+    const PerfCounters *counters_;
+    std::vector<Result> results_;
+};
+
+} // namespace bench
+} // namespace intgemm
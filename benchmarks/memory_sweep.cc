@@ -0,0 +1,286 @@
+/* How Multiply keeps up with the size of prepared B, from L1 resident to four
+ * times the last level cache, for GEMV and small batches.  Decoding is bound
+ * by B bandwidth, so each size is set against a STREAM-like read (vector
+ * loads of the widest width the CPU has) and copy (memcpy) of the same number
+ * of bytes measured in the same run.
+ *
+ * Results are tagged with the smallest cache level the working set fits in,
+ * and the table ends with where each backend crosses from one level to the
+ * next.  Cache sizes are per core, so Multiply runs on one thread unless
+ * --threads raises the concurrency limit, in which case it runs over
+ * ParallelFor like Int8::Multiply, taking as many threads up to the limit as
+ * the cost model says the size is worth.  The read and copy always use one
+ * thread.  See harness.h for the shared options; --rows and --width set the
+ * batch sizes and the B width.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intrinsics.h"
+#include "../intgemm/parallel.h"
+#include "../intgemm/topology.h"
+#include "harness.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kUsage =
+  "  --max-bytes N     largest B in bytes, default 4 times the last level cache\n"
+  "  --threads N       most threads to multiply with, default 1\n";
+
+// XOR of every vector in [begin, begin + bytes), so loads are all the time
+// goes on.  Four accumulators keep the loads from waiting on each other.
+// bytes is a multiple of 4 vectors.
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+INTGEMM_AVX512BW uint64_t ReadAVX512BW(const void *begin, std::size_t bytes) {
+  const __m512i *it = reinterpret_cast<const __m512i*>(begin), *end = it + bytes / sizeof(__m512i);
+  __m512i a = _mm512_setzero_si512(), b = a, c = a, d = a;
+  for (; it != end; it += 4) {
+    a = _mm512_xor_si512(a, _mm512_load_si512(it));
+    b = _mm512_xor_si512(b, _mm512_load_si512(it + 1));
+    c = _mm512_xor_si512(c, _mm512_load_si512(it + 2));
+    d = _mm512_xor_si512(d, _mm512_load_si512(it + 3));
+  }
+  return _mm_cvtsi128_si64(_mm512_castsi512_si128(_mm512_xor_si512(_mm512_xor_si512(a, b), _mm512_xor_si512(c, d))));
+}
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+INTGEMM_AVX2 uint64_t ReadAVX2(const void *begin, std::size_t bytes) {
+  const __m256i *it = reinterpret_cast<const __m256i*>(begin), *end = it + bytes / sizeof(__m256i);
+  __m256i a = _mm256_setzero_si256(), b = a, c = a, d = a;
+  for (; it != end; it += 4) {
+    a = _mm256_xor_si256(a, _mm256_load_si256(it));
+    b = _mm256_xor_si256(b, _mm256_load_si256(it + 1));
+    c = _mm256_xor_si256(c, _mm256_load_si256(it + 2));
+    d = _mm256_xor_si256(d, _mm256_load_si256(it + 3));
+  }
+  return _mm_cvtsi128_si64(_mm256_castsi256_si128(_mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(c, d))));
+}
+#endif
+INTGEMM_SSE2 uint64_t ReadSSE2(const void *begin, std::size_t bytes) {
+  const __m128i *it = reinterpret_cast<const __m128i*>(begin), *end = it + bytes / sizeof(__m128i);
+  __m128i a = _mm_setzero_si128(), b = a, c = a, d = a;
+  for (; it != end; it += 4) {
+    a = _mm_xor_si128(a, _mm_load_si128(it));
+    b = _mm_xor_si128(b, _mm_load_si128(it + 1));
+    c = _mm_xor_si128(c, _mm_load_si128(it + 2));
+    d = _mm_xor_si128(d, _mm_load_si128(it + 3));
+  }
+  return _mm_cvtsi128_si64(_mm_xor_si128(_mm_xor_si128(a, b), _mm_xor_si128(c, d)));
+}
+
+struct ReadKernel {
+  const char *name;
+  uint64_t (*function)(const void *begin, std::size_t bytes);
+};
+
+ReadKernel ChooseRead() {
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+  if (kCPU >= CPUType::AVX512BW) return ReadKernel{"AVX512BW loads", &ReadAVX512BW};
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+  if (kCPU >= CPUType::AVX2) return ReadKernel{"AVX2 loads", &ReadAVX2};
+#endif
+  return ReadKernel{"SSE2 loads", &ReadSSE2};
+}
+
+// Smallest cache level bytes fit in.
+const char *Level(const Topology &topology, double bytes) {
+  if (bytes <= topology.l1d_bytes) return "L1";
+  if (bytes <= topology.l2_bytes) return "L2";
+  if (bytes <= topology.l3_bytes) return "L3";
+  return "DRAM";
+}
+
+std::string Bytes(std::size_t bytes) {
+  const char *const units[] = {"B", "KiB", "MiB", "GiB"};
+  unsigned unit = 0;
+  while (unit < 3 && bytes >= 1024 && bytes % 1024 == 0) {
+    bytes /= 1024;
+    ++unit;
+  }
+  return std::to_string(bytes) + ' ' + units[unit];
+}
+
+struct Sweep {
+  // Fixed for the run.
+  const bench::Options &options;
+  bench::PerfCounters *const counters;
+  const Topology &topology;
+  const std::vector<Index> &rows;
+  const Index width;
+  const AlignedVector<float> &A;
+  AlignedVector<int8_t> &B;
+  bench::Report &report;
+
+  // Bytes of B to multiply with this time.
+  std::size_t bytes;
+
+  template <class Backend> void Run() {
+    typedef typename Backend::Integer Integer;
+    const float quant_mult = 64.0f;
+    // Prepared B is stored in blocks of 8 columns, each 8 * width values in
+    // a row.  Repeat one block to fill B instead of preparing all of it.
+    const Index B_cols = std::max<Index>(8, static_cast<Index>(bytes / (sizeof(Integer) * width)) / 8 * 8);
+    {
+      std::mt19937 gen(1234);
+      std::uniform_real_distribution<float> dist(-1.f, 1.f);
+      AlignedVector<float> block(width * 8);
+      for (float &f : block) f = dist(gen);
+      AlignedVector<Integer> prepared(width * 8);
+      Backend::PrepareB(block.begin(), prepared.begin(), quant_mult, width, 8);
+      Integer *to = reinterpret_cast<Integer*>(B.begin());
+      for (Index c = 0; c < B_cols; c += 8, to += prepared.size()) {
+        std::copy(prepared.begin(), prepared.end(), to);
+      }
+    }
+    const Integer *B_prepared = reinterpret_cast<const Integer*>(B.begin());
+    for (Index A_rows : rows) {
+      AlignedVector<Integer> A_prepared(A_rows * width);
+      Backend::PrepareA(A.begin(), A_prepared.begin(), quant_mult, A_rows, width);
+      AlignedVector<float> C(A_rows * B_cols);
+      bench::Result result;
+      result.name = "Multiply";
+      result.backend = Backend::kName;
+      result.shape.A_rows = A_rows;
+      result.shape.width = width;
+      result.shape.B_cols = B_cols;
+      result.operations = bench::MultiplyOperations(result.shape);
+      result.bytes = bench::MultiplyBytes<Integer>(result.shape);
+      result.tag = Level(topology, result.bytes);
+      std::vector<double> seconds;
+      bench::Measure(options.samples, counters, [&] {
+        bench::Multiply<Backend>(A_prepared.begin(), B_prepared, A_rows, width, B_cols, callbacks::UnquantizeAndWrite(1.0f / (quant_mult * quant_mult), C.begin()));
+      }, seconds, result.counters);
+      result.time = bench::Summarize(seconds);
+      report.Add(result);
+    }
+  }
+};
+
+// Reads and copies of bytes bytes, the roofline for Multiply at that size.
+void Baseline(const bench::Options &options, bench::PerfCounters *counters, const Topology &topology, const AlignedVector<float> &floats, AlignedVector<int8_t> &to, std::size_t bytes, bench::Report &report) {
+  static const ReadKernel kRead = ChooseRead();
+  // Whole groups of 4 vectors of 64 bytes.
+  bytes = bytes / 256 * 256;
+  const Index count = static_cast<Index>(bytes / sizeof(float));
+  bench::Result read;
+  read.name = "Read";
+  read.backend = kRead.name;
+  read.shape.A_rows = 1;
+  read.shape.width = count;
+  read.shape.B_cols = 1;
+  read.operations = count;
+  read.bytes = static_cast<double>(bytes);
+  read.tag = Level(topology, read.bytes);
+  std::vector<double> seconds;
+  volatile uint64_t sink = 0;
+  bench::Measure(options.samples, counters, [&] {
+    sink = sink ^ kRead.function(floats.begin(), bytes);
+  }, seconds, read.counters);
+  read.time = bench::Summarize(seconds);
+  report.Add(read);
+
+  bench::Result copy(read);
+  copy.name = "Copy";
+  copy.backend = "memcpy";
+  copy.bytes = 2.0 * read.bytes;
+  copy.tag = Level(topology, copy.bytes);
+  copy.counters = bench::CounterTotals();
+  seconds.clear();
+  bench::Measure(options.samples, counters, [&] {
+    std::memcpy(to.begin(), floats.begin(), count * sizeof(float));
+  }, seconds, copy.counters);
+  copy.time = bench::Summarize(seconds);
+  report.Add(copy);
+}
+
+// Lines saying where each backend and batch size changes cache level, with
+// the bandwidth before and after and as a fraction of the read baseline.
+void PrintTransitions(const std::vector<bench::Result> &results) {
+  std::cout << "\nCache level transitions (GB/s, fraction of read baseline)\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const bench::Result &from = results[i];
+    if (from.name != "Multiply") continue;
+    const bench::Result *from_read = nullptr, *to_read = nullptr, *to = nullptr;
+    // The read baseline at from's size precedes it, and the next result for
+    // the same backend and batch is at the next size.
+    for (std::size_t j = i; j-- > 0;) {
+      if (results[j].name == "Read") { from_read = &results[j]; break; }
+    }
+    for (std::size_t j = i + 1; j < results.size() && !to; ++j) {
+      if (results[j].name == "Read") to_read = &results[j];
+      if (to_read && results[j].name == from.name && results[j].backend == from.backend && results[j].shape.A_rows == from.shape.A_rows) to = &results[j];
+    }
+    if (!to || !from_read || to->tag == from.tag) continue;
+    std::cout << std::setw(16) << from.backend << "\trows=" << from.shape.A_rows << '\t' << from.tag << " -> " << to->tag
+      << "\tB_cols " << from.shape.B_cols << " -> " << to->shape.B_cols
+      << '\t' << from.GBps() << " (" << from.GBps() / from_read->GBps() << ") -> "
+      << to->GBps() << " (" << to->GBps() / to_read->GBps() << ")\n";
+  }
+}
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  bench::Options options(20);
+  std::size_t max_bytes = 0;
+  unsigned threads = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    if (!std::strcmp(argv[i], "--max-bytes") && i + 1 < argc) {
+      max_bytes = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage);
+    }
+  }
+  if (!options.shapes.empty() || !options.cols.empty() || options.width.size() > 1 || !threads) bench::Usage(argv[0], "Give --rows, one --width and a nonzero --threads.", kUsage);
+  const std::vector<Index> rows = options.rows.empty() ? std::vector<Index>{1, 4, 16} : options.rows;
+  const Index width = options.width.empty() ? 512 : options.width.front();
+  if (width % 64) bench::Usage(argv[0], "--width must be a multiple of 64.", kUsage);
+
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+  // Setup already limited intgemm to one thread for the counters.
+  if (!counters) SetConcurrencyLimit(threads);
+
+  // Fill in unknown cache sizes with typical ones.
+  Topology topology = GetTopology();
+  if (!topology.l1d_bytes) topology.l1d_bytes = 32 << 10;
+  if (!topology.l2_bytes) topology.l2_bytes = 1 << 20;
+  if (!topology.l3_bytes) topology.l3_bytes = 32 << 20;
+  if (!max_bytes) max_bytes = 4 * topology.l3_bytes;
+  std::cerr << "L1d " << Bytes(topology.l1d_bytes) << ", L2 " << Bytes(topology.l2_bytes) << ", L3 " << Bytes(topology.l3_bytes)
+    << "; B up to " << Bytes(max_bytes) << '.' << std::endl;
+
+  AlignedVector<float> A(*std::max_element(rows.begin(), rows.end()) * width);
+  std::mt19937 gen(45678);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  for (float &f : A) f = dist(gen);
+  // Room for the largest B rounded up to whole blocks of 8 columns.
+  AlignedVector<int8_t> B(max_bytes + 8 * sizeof(int16_t) * width);
+  AlignedVector<float> floats(max_bytes / sizeof(float));
+  for (float &f : floats) f = dist(gen);
+
+  bench::Report report(options.format, counters);
+  Sweep sweep = {options, counters, topology, rows, width, A, B, report, 0};
+  for (std::size_t bytes = topology.l1d_bytes / 2; bytes <= max_bytes; bytes *= 2) {
+    std::cerr << "B of " << Bytes(bytes) << "..." << std::endl;
+    Baseline(options, counters, topology, floats, B, bytes, report);
+    sweep.bytes = bytes;
+    bench::ForEachBackend(sweep);
+  }
+  report.Write(std::cout);
+  if (options.format == bench::Format::Table) PrintTransitions(report.Results());
+  return 0;
+}
@@ -0,0 +1,143 @@
+/* What loading a model and applying a shortlist cost: the B side routines
+ * that run once per weight matrix rather than once per batch.  Per backend
+ * and shape it times
+ *
+ *   PrepareB                     float B to the prepared layout
+ *   PrepareBTransposed           the same from a transposed float B
+ *   PrepareBQuantizedTransposed  already quantized, transposed B
+ *   SelectColumnsB               a --shortlist of columns from prepared B
+ *   PrepareBias                  the Int8Shift bias correction (8-bit only)
+ *
+ * and reports GB/s of memory read plus written.  Shapes are weight matrices,
+ * width by B_cols, up to a 256k vocabulary output layer; A_rows is ignored.
+ * See harness.h for the shared options.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "harness.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kUsage =
+  "  --shortlist N     columns SelectColumnsB picks, default 1024 or all of B\n";
+
+struct Load {
+  const bench::Options &options;
+  bench::PerfCounters *const counters;
+  const std::vector<bench::Shape> &shapes;
+  const Index shortlist;
+  bench::Report &report;
+
+  template <class Backend, class Function> void Time(const char *name, const bench::Shape &shape, double elements, double bytes, Function fn) {
+    bench::Result result;
+    result.name = name;
+    result.backend = Backend::kName;
+    result.shape = shape;
+    result.operations = elements;
+    result.bytes = bytes;
+    std::vector<double> seconds;
+    bench::Measure(options.samples, counters, fn, seconds, result.counters);
+    result.time = bench::Summarize(seconds);
+    report.Add(result);
+  }
+
+  // Only the 8-bit backends have PrepareBias.
+  template <class Backend> void TimeBias(const bench::Shape &, const int8_t *, std::false_type) {}
+  template <class Backend> void TimeBias(const bench::Shape &shape, const int8_t *B_prepared, std::true_type) {
+    AlignedVector<float> bias(shape.B_cols), bias_out(shape.B_cols);
+    std::fill(bias.begin(), bias.end(), 0.5f);
+    const double bytes = static_cast<double>(shape.width) * shape.B_cols + 2.0 * sizeof(float) * shape.B_cols;
+    Time<Backend>("PrepareBias", shape, static_cast<double>(shape.width) * shape.B_cols, bytes, [&] {
+      Backend::PrepareBias(B_prepared, shape.width, shape.B_cols, callbacks::UnquantizeAndAddBiasAndWrite(-1.0f / 64.0f, bias.begin(), bias_out.begin()));
+    });
+  }
+
+  template <class Backend> void Run() {
+    typedef typename Backend::Integer Integer;
+    std::cerr << Backend::kName << "..." << std::endl;
+    std::mt19937 gen(45678);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    for (const bench::Shape &shape : shapes) {
+      const Index width = shape.width, B_cols = shape.B_cols;
+      const double elements = static_cast<double>(width) * B_cols;
+      // One float buffer serves as B and as its transpose; the values don't
+      // matter to the time.
+      AlignedVector<float> B(width * B_cols);
+      for (float &f : B) f = dist(gen);
+      AlignedVector<Integer> B_quantized(B.size()), B_prepared(B.size());
+
+      Time<Backend>("PrepareB", shape, elements, elements * (sizeof(float) + sizeof(Integer)), [&] {
+        Backend::PrepareB(B.begin(), B_prepared.begin(), 64.0f, width, B_cols);
+      });
+      Time<Backend>("PrepareBTransposed", shape, elements, elements * (sizeof(float) + sizeof(Integer)), [&] {
+        Backend::PrepareBTransposed(B.begin(), B_prepared.begin(), 64.0f, width, B_cols);
+      });
+      Backend::Quantize(B.begin(), B_quantized.begin(), 64.0f, static_cast<Index>(B.size()));
+      Time<Backend>("PrepareBQuantizedTransposed", shape, elements, elements * 2.0 * sizeof(Integer), [&] {
+        Backend::PrepareBQuantizedTransposed(B_quantized.begin(), B_prepared.begin(), width, B_cols);
+      });
+
+      // Distinct random columns in order, as a shortlist of a vocabulary.
+      std::vector<Index> columns(B_cols);
+      for (Index i = 0; i < B_cols; ++i) columns[i] = i;
+      std::shuffle(columns.begin(), columns.end(), gen);
+      columns.resize(std::min(shortlist, B_cols) / 8 * 8);
+      std::sort(columns.begin(), columns.end());
+      if (!columns.empty()) {
+        Backend::PrepareB(B.begin(), B_prepared.begin(), 64.0f, width, B_cols);
+        AlignedVector<Integer> selected(width * columns.size());
+        const double selected_elements = static_cast<double>(width) * columns.size();
+        Time<Backend>("SelectColumnsB", shape, selected_elements, selected_elements * 2.0 * sizeof(Integer), [&] {
+          Backend::SelectColumnsB(B_prepared.begin(), selected.begin(), width, columns.data(), columns.data() + columns.size());
+        });
+      }
+
+      TimeBias<Backend>(shape, reinterpret_cast<const int8_t*>(B_prepared.begin()), std::is_same<Integer, int8_t>());
+    }
+  }
+};
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  bench::Options options(10);
+  Index shortlist = 1024;
+  for (int i = 1; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    if (!std::strcmp(argv[i], "--shortlist") && i + 1 < argc) {
+      shortlist = static_cast<Index>(std::atol(argv[++i]));
+    } else {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage);
+    }
+  }
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+  // Attention and feed-forward weights of base and big transformers, then
+  // output layers with 32k and 256k vocabularies.
+  const bench::Shape defaults[] = {
+    {1, 512, 512},
+    {1, 512, 2048},
+    {1, 2048, 512},
+    {1, 1024, 4096},
+    {1, 4096, 1024},
+    {1, 512, 32000},
+    {1, 512, 262144}
+  };
+  const std::vector<bench::Shape> shapes = options.Shapes(std::vector<bench::Shape>(defaults, defaults + sizeof(defaults) / sizeof(bench::Shape)));
+  bench::Report report(options.format, counters);
+  Load load = {options, counters, shapes, shortlist, report};
+  bench::ForEachBackend(load);
+  report.Write(std::cout);
+  return 0;
+}
@@ -0,0 +1,213 @@
+#pragma once
+/* Hardware performance counters around a measured region, for telling
+ * whether a kernel is compute, cache or DRAM bound.  Shared by the
+ * benchmark programs.
+ *
+ * On Linux this uses perf_event_open on the calling thread: cycles,
+ * instructions, L1D read misses, last level cache misses, dTLB read misses
+ * and, on PMUs whose encodings we know (Skylake through Sapphire Rapids),
+ * uops dispatched to ports 0 and 5.  512-bit instructions fuse ports 0 and 1
+ * and only issue on ports 0 and 5, so those two over cycles show how busy the
+ * 512-bit pipes are.  Counters the kernel refuses, e.g. because of
+ * perf_event_paranoid or inside a VM, are left out.  Elsewhere nothing is
+ * available and the benchmarks fall back to reporting time only.
+ *
+ * Worker threads are not counted, so benchmarks that read counters should
+ * run intgemm on one thread.
+ */
+
+#include "../intgemm/topology.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <asm/unistd.h>
+#include <linux/perf_event.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace intgemm {
+namespace bench {
+
+// Totals over the regions measured so far.
+struct CounterTotals {
+  CounterTotals() : regions(0) {}
+  std::vector<uint64_t> values;
+  uint64_t regions;
+};
+
+class PerfCounters {
+  public:
+    PerfCounters() {
+#if defined(__linux__)
+      Add("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      Add("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      Add("L1D-miss", PERF_TYPE_HW_CACHE, Cache(PERF_COUNT_HW_CACHE_L1D));
+      Add("LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+      Add("dTLB-miss", PERF_TYPE_HW_CACHE, Cache(PERF_COUNT_HW_CACHE_DTLB));
+      // Raw encodings are event | umask << 8.
+      const std::string pmu = PMUName();
+      if (pmu == "skylake" || pmu == "cascadelake") {
+        Add("port0", PERF_TYPE_RAW, 0x01a1);
+        Add("port5", PERF_TYPE_RAW, 0x20a1);
+      } else if (pmu == "icelake" || pmu == "icelake_server" || pmu == "sapphire_rapids") {
+        Add("port0", PERF_TYPE_RAW, 0x01b2);
+        Add("port5", PERF_TYPE_RAW, 0x20b2);
+      }
+#else
+      error_ = "performance counters are only supported on Linux";
+#endif
+    }
+
+    ~PerfCounters() {
+#if defined(__linux__)
+      for (const Counter &c : counters_) close(c.fd);
+#endif
+    }
+
+    bool Available() const { return !counters_.empty(); }
+
+    // Why a counter could not be opened, empty if all were.
+    const std::string &Error() const { return error_; }
+
+    std::size_t Size() const { return counters_.size(); }
+    const char *Name(std::size_t i) const { return counters_[i].name; }
+
+    // Index of the counter called name, or Size() if it is not available.
+    std::size_t Find(const char *name) const {
+      std::size_t i = 0;
+      while (i < counters_.size() && std::strcmp(counters_[i].name, name)) ++i;
+      return i;
+    }
+
+    // Count only between Start and Stop.  Start reads every counter then
+    // enables them all with one prctl; Stop disables them with one prctl
+    // then reads every counter again.
+    void Start() {
+#if defined(__linux__)
+      if (!Available()) return;
+      for (Counter &c : counters_) c.started = Read(c.fd, c.start);
+      prctl(PR_TASK_PERF_EVENTS_ENABLE);
+#endif
+    }
+
+    // Add what was counted since Start to totals.
+    void Stop(CounterTotals &totals) {
+#if defined(__linux__)
+      if (!Available()) return;
+      prctl(PR_TASK_PERF_EVENTS_DISABLE);
+      totals.values.resize(counters_.size());
+      for (std::size_t i = 0; i < counters_.size(); ++i) {
+        const Counter &c = counters_[i];
+        uint64_t end[3];
+        if (!c.started || !Read(c.fd, end)) continue;
+        // When there are more counters than the PMU has, the kernel
+        // multiplexes them; scale up by how long this counter ran during the
+        // region, as the times since it was opened would dilute that.
+        const uint64_t value = end[0] - c.start[0], enabled = end[1] - c.start[1], running = end[2] - c.start[2];
+        if (!running) continue;
+        totals.values[i] += static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+      }
+      ++totals.regions;
+#else
+      (void)totals;
+#endif
+    }
+
+    // Writes per region averages: cycles, IPC, misses per thousand
+    // instructions and port uops per cycle where available.
+    void Print(std::ostream &out, const CounterTotals &totals) const {
+      if (!totals.regions || totals.values.size() != counters_.size()) return;
+      const double regions = static_cast<double>(totals.regions);
+      const std::size_t cycles = Find("cycles"), instructions = Find("instructions");
+      const double cycle_count = cycles < Size() ? totals.values[cycles] : 0.0;
+      const double instruction_count = instructions < Size() ? totals.values[instructions] : 0.0;
+      for (std::size_t i = 0; i < counters_.size(); ++i) {
+        out << '\t' << counters_[i].name << '=';
+        if (i == cycles) {
+          out << totals.values[i] / regions;
+        } else if (i == instructions) {
+          out << totals.values[i] / regions;
+          if (cycle_count) out << "\tIPC=" << instruction_count / cycle_count;
+        } else if (!std::strncmp(counters_[i].name, "port", 4)) {
+          out << (cycle_count ? totals.values[i] / cycle_count : 0.0) << "/cycle";
+        } else {
+          out << (instruction_count ? 1000.0 * totals.values[i] / instruction_count : 0.0) << "/kinstr";
+        }
+      }
+    }
+
+  private:
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    struct Counter {
+      const char *name;
+      int fd;
+      // Value, time enabled and time running at Start, if read.
+      uint64_t start[3];
+      bool started;
+    };
+
+#if defined(__linux__)
+    static uint64_t Cache(uint64_t cache) {
+      return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    static std::string PMUName() {
+      std::ifstream f("/sys/bus/event_source/devices/cpu/caps/pmu_name");
+      std::string name;
+      f >> name;
+      return name;
+    }
+
+    // Value, time enabled and time running of the counter.
+    static bool Read(int fd, uint64_t (&out)[3]) {
+      return read(fd, out, sizeof(out)) == static_cast<ssize_t>(sizeof(out));
+    }
+
+    void Add(const char *name, uint32_t type, uint64_t config) {
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+      if (fd < 0) {
+        if (error_.empty()) error_ = std::string(name) + ": " + std::strerror(errno);
+        return;
+      }
+      Counter c;
+      c.name = name;
+      c.fd = fd;
+      c.started = false;
+      counters_.push_back(c);
+    }
+#endif
+
+    std::vector<Counter> counters_;
+    std::string error_;
+};
+
+// Pin the calling thread to the fastest CPU this process may use, so
+// samples are not spread over cores of different speeds.  Returns the CPU or
+// -1 if pinning is unsupported or denied.
+inline int PinToFastestCPU() {
+  const Topology &topology = GetTopology();
+  if (topology.cpus.empty() || !PinCurrentThread(topology.cpus.front().id)) return -1;
+  return topology.cpus.front().id;
+}
+
+} // namespace bench
+} // namespace intgemm
@@ -0,0 +1,266 @@
+/* Guards against Multiply getting slower.
+ *
+ *   regression record FILE [options]   measure and store a baseline
+ *   regression compare FILE [options]  measure and compare to the baseline
+ *
+ * Both time every backend on every shape (the benchmark defaults unless
+ * harness.h options say otherwise) and keep all the samples.  The baseline
+ * file holds one line per CPU model, backend and shape, so one file can
+ * serve several machines; record replaces only the lines it measured.
+ *
+ * compare runs a one-sided Mann-Whitney U test per line: is the new run
+ * slower than the baseline?  A line regressed if the test says so with
+ * p < --alpha (default 0.001) and the median slowed by more than
+ * --threshold (default 0.05, i.e. 5%).  Both must hold: with many samples
+ * the test flags slowdowns too small to matter, and the threshold alone
+ * trips on noise.  Exits 1 if any line regressed, 2 on errors.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/parallel.h"
+#include "harness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kUsage =
+  "  regression record|compare FILE [options]\n"
+  "  --alpha P         significance level of the slowdown test, default 0.001\n"
+  "  --threshold F     smallest relative slowdown of the median to report, default 0.05\n";
+
+// Consumes the argument after argv[i].  Returns false if there is none or it
+// is not entirely a number.
+bool ParseNumber(int argc, char **argv, int &i, double &out) {
+  if (++i == argc) return false;
+  char *end;
+  out = std::strtod(argv[i], &end);
+  return end != argv[i] && !*end && std::isfinite(out);
+}
+
+struct Line {
+  std::string cpu, backend;
+  bench::Shape shape;
+  std::vector<double> seconds;
+
+  bool SameKey(const Line &other) const {
+    return cpu == other.cpu && backend == other.backend && shape.A_rows == other.shape.A_rows && shape.width == other.shape.width && shape.B_cols == other.shape.B_cols;
+  }
+};
+
+// Baseline format: cpu, backend, shape and samples separated by tabs, the
+// shape as A_rows width B_cols and the samples as seconds separated by spaces.
+// Returns false if malformed.
+bool ReadBaseline(std::istream &in, std::vector<Line> &lines) {
+  std::string text;
+  while (std::getline(in, text)) {
+    if (text.empty()) continue;
+    std::istringstream fields(text);
+    Line line;
+    std::string shape, samples;
+    if (!std::getline(fields, line.cpu, '\t') || !std::getline(fields, line.backend, '\t') || !std::getline(fields, shape, '\t') || !std::getline(fields, samples)) return false;
+    std::istringstream shape_stream(shape), sample_stream(samples);
+    if (!(shape_stream >> line.shape.A_rows >> line.shape.width >> line.shape.B_cols)) return false;
+    double value;
+    while (sample_stream >> value) line.seconds.push_back(value);
+    if (line.seconds.empty()) return false;
+    lines.push_back(line);
+  }
+  return true;
+}
+
+bool WriteBaseline(const char *file, const std::vector<Line> &lines) {
+  std::ofstream out(file);
+  for (const Line &line : lines) {
+    out << line.cpu << '\t' << line.backend << '\t' << line.shape.A_rows << ' ' << line.shape.width << ' ' << line.shape.B_cols << '\t';
+    char buf[32];
+    for (std::size_t i = 0; i < line.seconds.size(); ++i) {
+      std::snprintf(buf, sizeof(buf), "%s%.9g", i ? " " : "", line.seconds[i]);
+      out << buf;
+    }
+    out << '\n';
+  }
+  return static_cast<bool>(out);
+}
+
+double Median(std::vector<double> values) {
+  std::vector<double>::iterator middle = values.begin() + values.size() / 2;
+  std::nth_element(values.begin(), middle, values.end());
+  return *middle;
+}
+
+// One-sided Mann-Whitney U test that after tends to be larger than before:
+// the p-value from the normal approximation with tie and continuity
+// corrections, good from about 10 samples each.
+double MannWhitneyLarger(const std::vector<double> &before, const std::vector<double> &after) {
+  std::vector<std::pair<double, bool>> all;
+  for (double v : before) all.push_back(std::make_pair(v, false));
+  for (double v : after) all.push_back(std::make_pair(v, true));
+  std::sort(all.begin(), all.end());
+  const double n1 = static_cast<double>(before.size()), n2 = static_cast<double>(after.size()), n = n1 + n2;
+  // Rank sum of after, with ties given their average rank.
+  double rank_sum = 0.0, ties = 0.0;
+  for (std::size_t i = 0; i < all.size();) {
+    std::size_t j = i;
+    while (j < all.size() && all[j].first == all[i].first) ++j;
+    const double rank = (i + 1 + j) / 2.0, t = static_cast<double>(j - i);
+    for (std::size_t k = i; k < j; ++k) {
+      if (all[k].second) rank_sum += rank;
+    }
+    ties += t * t * t - t;
+    i = j;
+  }
+  const double u = rank_sum - n2 * (n2 + 1) / 2.0;
+  const double sigma = std::sqrt(n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1))));
+  if (sigma == 0.0) return 1.0;
+  const double z = (u - n1 * n2 / 2.0 - 0.5) / sigma;
+  return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+// Times every shape on each backend it is called for, one backend at a time
+// and shapes interleaved so drift over the run hits them alike.
+struct Sampler {
+  const std::vector<bench::Shape> &shapes;
+  const std::size_t samples;
+  const std::string cpu;
+  std::vector<Line> &lines;
+
+  template <class Backend> void Run() {
+    typedef typename Backend::Integer Integer;
+    std::cerr << Backend::kName << ", " << samples << " samples..." << std::endl;
+    struct Prepared {
+      AlignedVector<Integer> A, B;
+      AlignedVector<float> C;
+    };
+    std::vector<Prepared> prepared;
+    std::mt19937 gen(45678);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    for (const bench::Shape &shape : shapes) {
+      AlignedVector<float> A(shape.A_rows * shape.width), B(shape.width * shape.B_cols);
+      for (float &f : A) f = dist(gen);
+      for (float &f : B) f = dist(gen);
+      Prepared p = {AlignedVector<Integer>(A.size()), AlignedVector<Integer>(B.size()), AlignedVector<float>(shape.A_rows * shape.B_cols)};
+      Backend::PrepareA(A.begin(), p.A.begin(), 64.0f, shape.A_rows, shape.width);
+      Backend::PrepareB(B.begin(), p.B.begin(), 64.0f, shape.width, shape.B_cols);
+      prepared.push_back(std::move(p));
+    }
+    const std::size_t first = lines.size();
+    for (const bench::Shape &shape : shapes) {
+      Line line;
+      line.cpu = cpu;
+      line.backend = Backend::kName;
+      line.shape = shape;
+      lines.push_back(line);
+    }
+    for (std::size_t sample = 0; sample <= samples; ++sample) {
+      for (std::size_t i = 0; i < shapes.size(); ++i) {
+        const bench::Shape &s = shapes[i];
+        Prepared &p = prepared[i];
+        auto start = std::chrono::steady_clock::now();
+        Backend::Multiply(p.A.begin(), p.B.begin(), s.A_rows, s.width, s.B_cols, callbacks::UnquantizeAndWrite(1.0f / (64.0f * 64.0f), p.C.begin()));
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // The first round is burn in.
+        if (sample) lines[first + i].seconds.push_back(seconds);
+      }
+    }
+  }
+};
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  if (argc < 3 || (std::strcmp(argv[1], "record") && std::strcmp(argv[1], "compare"))) {
+    std::cerr << "Usage: " << argv[0] << " record|compare FILE [options]\n" << kUsage << bench::kOptionsUsage;
+    return 2;
+  }
+  const bool record = !std::strcmp(argv[1], "record");
+  const char *file = argv[2];
+  bench::Options options(30);
+  // 1 means regressed, so mistakes on the command line are errors.
+  options.usage_status = 2;
+  double alpha = 0.001, threshold = 0.05;
+  for (int i = 3; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    if (!std::strcmp(argv[i], "--alpha")) {
+      if (!ParseNumber(argc, argv, i, alpha) || alpha <= 0.0 || alpha >= 1.0) bench::Usage(argv[0], "--alpha needs a number between 0 and 1", kUsage, 2);
+    } else if (!std::strcmp(argv[i], "--threshold")) {
+      if (!ParseNumber(argc, argv, i, threshold) || threshold < 0.0) bench::Usage(argv[0], "--threshold needs a non-negative number", kUsage, 2);
+    } else {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage, 2);
+    }
+  }
+  if (options.format != bench::Format::Table || options.counters) bench::Usage(argv[0], "--format and --counters do not apply.", kUsage, 2);
+
+  // record may start a new file.
+  std::vector<Line> baseline;
+  std::ifstream in(file);
+  if ((in || !record) && !(in && ReadBaseline(in, baseline))) {
+    std::cerr << "Could not read baseline " << file << std::endl;
+    return 2;
+  }
+  in.close();
+
+  bench::PerfCounters perf;
+  bench::Setup(argv[0], options, perf);
+  const std::vector<bench::Shape> shapes = options.Shapes(bench::DefaultShapes());
+  std::vector<Line> measured;
+  Sampler sampler = {shapes, options.samples, bench::CPUModel(), measured};
+  bench::ForEachBackend(sampler);
+  if (measured.empty()) {
+    std::cerr << "No CPU support." << std::endl;
+    return 2;
+  }
+
+  if (record) {
+    // Keep the lines of other machines, backends and shapes.
+    std::vector<Line> kept;
+    for (const Line &old : baseline) {
+      bool replaced = false;
+      for (const Line &line : measured) replaced |= line.SameKey(old);
+      if (!replaced) kept.push_back(old);
+    }
+    kept.insert(kept.end(), measured.begin(), measured.end());
+    if (!WriteBaseline(file, kept)) {
+      std::cerr << "Could not write baseline " << file << std::endl;
+      return 2;
+    }
+    std::cerr << "Recorded " << measured.size() << " lines for " << measured.front().cpu << " in " << file << '.' << std::endl;
+    return 0;
+  }
+
+  std::size_t regressed = 0, missing = 0;
+  for (const Line &line : measured) {
+    const Line *old = nullptr;
+    for (const Line &b : baseline) {
+      if (b.SameKey(line)) old = &b;
+    }
+    if (!old) {
+      ++missing;
+      continue;
+    }
+    const double before = Median(old->seconds), after = Median(line.seconds);
+    const double change = after / before - 1.0;
+    const double p = MannWhitneyLarger(old->seconds, line.seconds);
+    if (p >= alpha || change <= threshold) continue;
+    ++regressed;
+    std::cout << "SLOWER\t" << line.backend << '\t' << line.shape.A_rows << 'x' << line.shape.width << 'x' << line.shape.B_cols
+      << "\tmedian " << before << " -> " << after << " s (+" << 100.0 * change << "%)\tp=" << p << '\n';
+  }
+  if (missing) std::cerr << missing << " of " << measured.size() << " lines have no baseline for this CPU; record one first." << std::endl;
+  std::cout << regressed << " of " << (measured.size() - missing) << " compared lines regressed." << std::endl;
+  return regressed ? 1 : 0;
+}
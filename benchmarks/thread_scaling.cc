@@ -0,0 +1,150 @@
+/* How Multiply, Quantize and MaxAbsolute scale with threads.  Each operation
+ * runs at every thread count from 1 to MaxThreads() (or --threads RANGE) by
+ * way of SetConcurrencyLimit, which caps OpenMP and thread pool builds alike.
+ * Serial builds have one thread and only show the single thread numbers.
+ *
+ * Reported per operation, shape and thread count: time, speedup over one
+ * thread and parallel efficiency (speedup over threads).  In builds with
+ * -DUSE_PROFILE=ON it also reports how far apart the threads' busy times
+ * were, as the slowest thread's over the fastest's; bad partitioning shows up
+ * there before it shows up in the speedup.
+ *
+ * Quantize and MaxAbsolute run over as many floats as the shape's B, as
+ * when preparing B.  See harness.h for the shared options.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/parallel.h"
+#include "../intgemm/profile.h"
+#include "harness.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kUsage =
+  "  --threads RANGE   thread counts to run, default 1 to the most available\n";
+
+// Slowest over fastest thread busy time of the last measurement, 0 if no
+// call ran on more than one thread or the build doesn't profile.
+double Spread(Operation operation) {
+#ifdef INTGEMM_PROFILE
+  uint64_t slowest = 0, fastest = 0;
+  for (const ProfileRecord &record : GetProfile()) {
+    if (record.operation != operation) continue;
+    slowest += record.slowest_nanoseconds;
+    fastest += record.fastest_nanoseconds;
+  }
+  return fastest ? static_cast<double>(slowest) / fastest : 0.0;
+#else
+  (void)operation;
+  return 0.0;
+#endif
+}
+
+struct Scaling {
+  const bench::Options &options;
+  bench::PerfCounters *const counters;
+  const std::vector<Index> &threads;
+  bench::Report &report;
+
+  // Runs fn at every thread count and adds a result for each.  Speedup is
+  // over one thread, assuming the first count scaled perfectly if it isn't 1.
+  template <class Function> void Run(Operation operation, const bench::Shape &shape, double operations, double bytes, Function fn) {
+    double base = 0.0;
+    for (Index t : threads) {
+      SetConcurrencyLimit(t);
+      INTGEMM_PROFILE_ONLY(ResetProfile();)
+      bench::Result result;
+      result.name = OperationName(operation);
+      result.backend = bench::CPUTypeName(Int8::kUses);
+      result.shape = shape;
+      result.operations = operations;
+      result.bytes = bytes;
+      std::vector<double> seconds;
+      bench::Measure(options.samples, counters, fn, seconds, result.counters);
+      result.time = bench::Summarize(seconds);
+      if (t == threads.front()) base = result.time.mean * t;
+      const double speedup = base / result.time.mean;
+      result.extra.push_back(std::make_pair("threads", static_cast<double>(t)));
+      result.extra.push_back(std::make_pair("speedup", speedup));
+      result.extra.push_back(std::make_pair("efficiency", speedup / t));
+      const double spread = Spread(operation);
+      if (spread) result.extra.push_back(std::make_pair("spread", spread));
+      report.Add(result);
+    }
+    SetConcurrencyLimit(0);
+  }
+};
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  bench::Options options(20);
+  std::vector<Index> threads;
+  for (int i = 1; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+      if (!bench::ParseRange(argv[++i], threads)) bench::Usage(argv[0], std::string("Bad --threads ") + argv[i], kUsage);
+    } else {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage);
+    }
+  }
+  if (threads.empty()) {
+    for (Index t = 1; t <= MaxThreads(); ++t) threads.push_back(t);
+  } else if (*std::max_element(threads.begin(), threads.end()) > MaxThreads()) {
+    std::cerr << "Only " << MaxThreads() << " threads are available; larger counts run on that many." << std::endl;
+  }
+  if (kCPU < CPUType::SSSE3) {
+    std::cerr << "No CPU support." << std::endl;
+    return 1;
+  }
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+  if (counters) std::cerr << "Counters only see the calling thread, so above one thread they count its share." << std::endl;
+
+  // Decoding, a small batch and a large batch.
+  const bench::Shape defaults[] = {
+    {1, 1024, 4096},
+    {16, 512, 2048},
+    {256, 512, 512},
+    {1024, 1024, 1024}
+  };
+  const std::vector<bench::Shape> shapes = options.Shapes(std::vector<bench::Shape>(defaults, defaults + sizeof(defaults) / sizeof(bench::Shape)));
+
+  bench::Report report(options.format, counters);
+  Scaling scaling = {options, counters, threads, report};
+  std::mt19937 gen(45678);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  for (const bench::Shape &shape : shapes) {
+    std::cerr << "Shape " << shape.A_rows << 'x' << shape.width << 'x' << shape.B_cols << "..." << std::endl;
+    AlignedVector<float> A(shape.A_rows * shape.width), B(shape.width * shape.B_cols), C(shape.A_rows * shape.B_cols);
+    for (float &f : A) f = dist(gen);
+    for (float &f : B) f = dist(gen);
+    AlignedVector<int8_t> A_prepared(A.size()), B_prepared(B.size());
+    Int8::PrepareA(A.begin(), A_prepared.begin(), 64.0f, shape.A_rows, shape.width);
+    Int8::PrepareB(B.begin(), B_prepared.begin(), 64.0f, shape.width, shape.B_cols);
+
+    scaling.Run(Operation::Multiply, shape, bench::MultiplyOperations(shape), bench::MultiplyBytes<int8_t>(shape), [&] {
+      Int8::Multiply(A_prepared.begin(), B_prepared.begin(), shape.A_rows, shape.width, shape.B_cols, callbacks::UnquantizeAndWrite(1.0f / (64.0f * 64.0f), C.begin()));
+    });
+    const double elements = static_cast<double>(B.size());
+    scaling.Run(Operation::Quantize, shape, elements, elements * (sizeof(float) + sizeof(int8_t)), [&] {
+      Int8::Quantize(B.begin(), B_prepared.begin(), 64.0f, static_cast<Index>(B.size()));
+    });
+    scaling.Run(Operation::MaxAbsolute, shape, elements, elements * sizeof(float), [&] {
+      MaxAbsolute(B.begin(), B.end());
+    });
+  }
+  report.Write(std::cout);
+  return 0;
+}
@@ -0,0 +1,435 @@
+/* What one transformer layer costs when built from intgemm, quantization
+ * and glue included, on every backend.  The layer is post-norm:
+ *
+ *   qkv        quantize x, project to Q, K and V
+ *   attention  per sequence and head: quantize Q, prepare K transposed,
+ *              scores = Q K^T / sqrt(d_head), softmax, quantize the
+ *              probabilities, prepare V, context = P V
+ *   output     quantize the context, project, add x and layer norm
+ *   ffn        quantize, project to --ffn with relu, quantize, project back,
+ *              add and layer norm
+ *
+ * Every quantized input gets MaxAbsolute and PrepareA (PrepareB for
+ * activations used as B) with its own scale, as a model would.  Encoding
+ * runs --batch sequences of --seq tokens through self attention.  With
+ * --decode it times one decoding step instead: one new token per sequence
+ * writes its projected key and value into the last of --seq cache slots and
+ * attends to all of them, i.e. to --seq - 1 earlier tokens and itself.  The
+ * slot is reused by every step so the key count stays a multiple of 64.
+ *
+ * Each stage reports its time with the shares spent quantizing and
+ * preparing, multiplying and in glue (splitting heads, softmax, residuals,
+ * layer norm), then the layer's total time and tokens/s.  GOPS counts the
+ * multiplies and GB/s the prepared B they read.  The shape column is
+ * tokens, d_model and ffn.  See harness.h for --samples, --format and
+ * --counters; the shape options don't apply.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intgemm.h"
+#include "harness.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kUsage =
+  "  --d-model N       model width, default 512\n"
+  "  --heads N         attention heads, default 8; d_model / heads must be a multiple of 64\n"
+  "  --ffn N           feed-forward width, default 2048\n"
+  "  --batch N         sequences, default 8\n"
+  "  --seq N           tokens per sequence, a multiple of 64, default 64\n"
+  "  --decode          time one decoding step; --seq counts the new token\n";
+
+struct Config {
+  Index d_model, heads, ffn, batch, seq;
+  bool decode;
+
+  Index HeadWidth() const { return d_model / heads; }
+  // Query tokens per sequence.
+  Index Queries() const { return decode ? 1 : seq; }
+  // Rows through the projections.
+  Index Tokens() const { return batch * Queries(); }
+};
+
+enum Stage { kQKV, kAttention, kOutput, kFFN, kStages };
+const char *const kStageNames[kStages] = {"qkv", "attention", "output", "ffn"};
+
+enum Part { kQuantize, kMultiply, kGlue, kParts };
+
+// Times the parts of one layer run.
+struct Clock {
+  // Seconds per stage and part, summed over runs.
+  double parts[kStages][kParts];
+  // Seconds per stage of each run.
+  std::vector<double> stages[kStages];
+  bench::PerfCounters *counters;
+  bench::CounterTotals totals[kStages];
+  Stage stage;
+  std::chrono::steady_clock::time_point stage_start;
+
+  explicit Clock(bench::PerfCounters *counters_in) : counters(counters_in) {
+    std::memset(parts, 0, sizeof(parts));
+  }
+
+  void Begin(Stage s) {
+    stage = s;
+    if (counters) counters->Start();
+    stage_start = std::chrono::steady_clock::now();
+  }
+
+  void End() {
+    stages[stage].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - stage_start).count());
+    if (counters) counters->Stop(totals[stage]);
+  }
+
+  template <class Function> void Time(Part part, Function fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    parts[stage][part] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+// Scale for MaxAbsolute and the quantizer, as in the tests: 8-bit maps the
+// largest value to 127 and 16-bit to 1024.
+template <class Integer> float QuantMult(float max_abs) {
+  return (sizeof(Integer) == 1 ? 127.0f : 1024.0f) / std::max(max_abs, 1e-6f);
+}
+
+void LayerNorm(const float *in, const float *residual, float *out, Index rows, Index cols) {
+  for (Index r = 0; r < rows; ++r) {
+    const float *a = in + r * cols, *b = residual + r * cols;
+    float *o = out + r * cols;
+    float mean = 0.0f;
+    for (Index c = 0; c < cols; ++c) {
+      o[c] = a[c] + b[c];
+      mean += o[c];
+    }
+    mean /= cols;
+    float variance = 0.0f;
+    for (Index c = 0; c < cols; ++c) variance += (o[c] - mean) * (o[c] - mean);
+    const float scale = 1.0f / std::sqrt(variance / cols + 1e-6f);
+    for (Index c = 0; c < cols; ++c) o[c] = (o[c] - mean) * scale;
+  }
+}
+
+// In place over each row.
+void Softmax(float *scores, Index rows, Index cols) {
+  for (Index r = 0; r < rows; ++r) {
+    float *row = scores + r * cols;
+    const float highest = *std::max_element(row, row + cols);
+    float sum = 0.0f;
+    for (Index c = 0; c < cols; ++c) sum += (row[c] = std::exp(row[c] - highest));
+    for (Index c = 0; c < cols; ++c) row[c] /= sum;
+  }
+}
+
+template <class Backend> class Layer {
+  public:
+    typedef typename Backend::Integer Integer;
+
+    Layer(const Config &config, std::mt19937 &gen)
+      : config_(config),
+        x_(config.Tokens() * config.d_model), x_quant_(x_.size()),
+        q_(x_.size()), k_(x_.size()), v_(x_.size()),
+        cache_k_(config.decode ? config.batch * config.seq * config.d_model : 0), cache_v_(cache_k_.size()),
+        head_q_(config.Queries() * config.HeadWidth()), head_k_(config.seq * config.HeadWidth()), head_v_(head_k_.size()),
+        head_q_quant_(head_q_.size()), head_k_prepared_(head_k_.size()), head_v_prepared_(head_v_.size()),
+        scores_(config.Queries() * config.seq), scores_quant_(scores_.size()), head_context_(head_q_.size()),
+        context_(x_.size()), context_quant_(x_.size()), projected_(x_.size()), attended_(x_.size()), attended_quant_(x_.size()),
+        hidden_(config.Tokens() * config.ffn), hidden_quant_(hidden_.size()), y_(x_.size()) {
+      std::uniform_real_distribution<float> dist(-1.f, 1.f);
+      for (float &f : x_) f = dist(gen);
+      for (float &f : cache_k_) f = dist(gen);
+      for (float &f : cache_v_) f = dist(gen);
+      const Index d = config.d_model;
+      for (Weight *w : {&query_, &key_, &value_, &output_}) w->Init(d, d, gen);
+      up_.Init(d, config.ffn, gen);
+      down_.Init(config.ffn, d, gen);
+    }
+
+    // Multiply operations per stage.
+    double Operations(Stage stage) const {
+      const double tokens = config_.Tokens(), d = config_.d_model;
+      switch (stage) {
+        case kQKV: return 2.0 * tokens * d * 3.0 * d;
+        case kAttention: return 2.0 * 2.0 * config_.batch * config_.heads * config_.Queries() * config_.seq * config_.HeadWidth();
+        case kOutput: return 2.0 * tokens * d * d;
+        case kFFN: return 2.0 * 2.0 * tokens * d * config_.ffn;
+        default: return 0.0;
+      }
+    }
+
+    // Prepared B bytes read per stage: weights, or keys and values.
+    double Bytes(Stage stage) const {
+      const double d = config_.d_model, size = sizeof(Integer);
+      switch (stage) {
+        case kQKV: return 3.0 * d * d * size;
+        case kAttention: return 2.0 * config_.batch * config_.seq * d * size;
+        case kOutput: return d * d * size;
+        case kFFN: return 2.0 * d * config_.ffn * size;
+        default: return 0.0;
+      }
+    }
+
+    void Run(Clock &clock) {
+      const Index tokens = config_.Tokens(), d = config_.d_model;
+
+      clock.Begin(kQKV);
+      const float x_mult = Quantize(clock, x_, x_quant_, tokens, d);
+      Project(clock, x_quant_, x_mult, tokens, query_, q_, false);
+      Project(clock, x_quant_, x_mult, tokens, key_, k_, false);
+      Project(clock, x_quant_, x_mult, tokens, value_, v_, false);
+      clock.End();
+
+      clock.Begin(kAttention);
+      if (config_.decode) {
+        // Append the new token's key and value to each sequence's cache.
+        clock.Time(kGlue, [&] {
+          for (Index b = 0; b < config_.batch; ++b) {
+            const Index slot = b * config_.seq + config_.seq - 1;
+            std::memcpy(cache_k_.begin() + slot * d, k_.begin() + b * d, d * sizeof(float));
+            std::memcpy(cache_v_.begin() + slot * d, v_.begin() + b * d, d * sizeof(float));
+          }
+        });
+      }
+      for (Index b = 0; b < config_.batch; ++b) {
+        for (Index h = 0; h < config_.heads; ++h) Attend(clock, b, h);
+      }
+      clock.End();
+
+      clock.Begin(kOutput);
+      const float context_mult = Quantize(clock, context_, context_quant_, tokens, d);
+      Project(clock, context_quant_, context_mult, tokens, output_, projected_, false);
+      clock.Time(kGlue, [&] { LayerNorm(projected_.begin(), x_.begin(), attended_.begin(), tokens, d); });
+      clock.End();
+
+      clock.Begin(kFFN);
+      const float attended_mult = Quantize(clock, attended_, attended_quant_, tokens, d);
+      Project(clock, attended_quant_, attended_mult, tokens, up_, hidden_, true);
+      const float hidden_mult = Quantize(clock, hidden_, hidden_quant_, tokens, config_.ffn);
+      Project(clock, hidden_quant_, hidden_mult, tokens, down_, projected_, false);
+      clock.Time(kGlue, [&] { LayerNorm(projected_.begin(), attended_.begin(), y_.begin(), tokens, d); });
+      clock.End();
+    }
+
+  private:
+    struct Weight {
+      AlignedVector<Integer> prepared;
+      AlignedVector<float> bias;
+      float quant_mult;
+      Index rows, cols;
+
+      void Init(Index rows_in, Index cols_in, std::mt19937 &gen) {
+        rows = rows_in;
+        cols = cols_in;
+        std::uniform_real_distribution<float> dist(-1.f, 1.f);
+        AlignedVector<float> values(rows * cols);
+        for (float &f : values) f = dist(gen);
+        bias = AlignedVector<float>(cols);
+        for (float &f : bias) f = dist(gen);
+        quant_mult = QuantMult<Integer>(MaxAbsolute(values.begin(), values.end()));
+        prepared = AlignedVector<Integer>(values.size());
+        Backend::PrepareB(values.begin(), prepared.begin(), quant_mult, rows, cols);
+      }
+    };
+
+    // MaxAbsolute and PrepareA of rows by cols in, returning the scale.
+    float Quantize(Clock &clock, const AlignedVector<float> &in, AlignedVector<Integer> &out, Index rows, Index cols) {
+      float mult;
+      clock.Time(kQuantize, [&] {
+        mult = QuantMult<Integer>(MaxAbsolute(in.begin(), in.end()));
+        Backend::PrepareA(in.begin(), out.begin(), mult, rows, cols);
+      });
+      return mult;
+    }
+
+    void Project(Clock &clock, const AlignedVector<Integer> &A, float A_mult, Index rows, const Weight &weight, AlignedVector<float> &C, bool relu) {
+      const float unquant = 1.0f / (A_mult * weight.quant_mult);
+      clock.Time(kMultiply, [&] {
+        if (relu) {
+          bench::Multiply<Backend>(A.begin(), weight.prepared.begin(), rows, weight.rows, weight.cols, callbacks::UnquantizeAndAddBiasAndWriteRelu(unquant, weight.bias.begin(), C.begin()));
+        } else {
+          bench::Multiply<Backend>(A.begin(), weight.prepared.begin(), rows, weight.rows, weight.cols, callbacks::UnquantizeAndAddBiasAndWrite(unquant, weight.bias.begin(), C.begin()));
+        }
+      });
+    }
+
+    // Copies columns [column, column + width) of rows [row, row + rows) of
+    // a row-major matrix with stride columns to a packed rows by width.
+    static void Slice(const float *in, Index stride, Index row, Index rows, Index column, Index width, float *out) {
+      for (Index r = 0; r < rows; ++r) std::memcpy(out + r * width, in + (row + r) * stride + column, width * sizeof(float));
+    }
+
+    // Self attention of sequence b, head h.
+    void Attend(Clock &clock, Index b, Index h) {
+      const Index queries = config_.Queries(), keys = config_.seq, width = config_.HeadWidth(), d = config_.d_model;
+      const Index column = h * width;
+      clock.Time(kGlue, [&] {
+        Slice(q_.begin(), d, b * queries, queries, column, width, head_q_.begin());
+        if (config_.decode) {
+          Slice(cache_k_.begin(), d, b * keys, keys, column, width, head_k_.begin());
+          Slice(cache_v_.begin(), d, b * keys, keys, column, width, head_v_.begin());
+        } else {
+          Slice(k_.begin(), d, b * keys, keys, column, width, head_k_.begin());
+          Slice(v_.begin(), d, b * keys, keys, column, width, head_v_.begin());
+        }
+      });
+
+      float q_mult, k_mult, v_mult, p_mult;
+      clock.Time(kQuantize, [&] {
+        q_mult = QuantMult<Integer>(MaxAbsolute(head_q_.begin(), head_q_.end()));
+        Backend::PrepareA(head_q_.begin(), head_q_quant_.begin(), q_mult, queries, width);
+        // Keys are rows of K, so K^T arrives transposed.
+        k_mult = QuantMult<Integer>(MaxAbsolute(head_k_.begin(), head_k_.end()));
+        Backend::PrepareBTransposed(head_k_.begin(), head_k_prepared_.begin(), k_mult, width, keys);
+      });
+      clock.Time(kMultiply, [&] {
+        const float unquant = 1.0f / (q_mult * k_mult * std::sqrt(static_cast<float>(width)));
+        bench::Multiply<Backend>(head_q_quant_.begin(), head_k_prepared_.begin(), queries, width, keys, callbacks::UnquantizeAndWrite(unquant, scores_.begin()));
+      });
+      clock.Time(kGlue, [&] { Softmax(scores_.begin(), queries, keys); });
+
+      clock.Time(kQuantize, [&] {
+        p_mult = QuantMult<Integer>(MaxAbsolute(scores_.begin(), scores_.end()));
+        Backend::PrepareA(scores_.begin(), scores_quant_.begin(), p_mult, queries, keys);
+        v_mult = QuantMult<Integer>(MaxAbsolute(head_v_.begin(), head_v_.end()));
+        Backend::PrepareB(head_v_.begin(), head_v_prepared_.begin(), v_mult, keys, width);
+      });
+      clock.Time(kMultiply, [&] {
+        bench::Multiply<Backend>(scores_quant_.begin(), head_v_prepared_.begin(), queries, keys, width, callbacks::UnquantizeAndWrite(1.0f / (p_mult * v_mult), head_context_.begin()));
+      });
+      clock.Time(kGlue, [&] {
+        for (Index r = 0; r < queries; ++r) std::memcpy(context_.begin() + (b * queries + r) * d + column, head_context_.begin() + r * width, width * sizeof(float));
+      });
+    }
+
+    const Config config_;
+    Weight query_, key_, value_, output_, up_, down_;
+    AlignedVector<float> x_;
+    AlignedVector<Integer> x_quant_;
+    AlignedVector<float> q_, k_, v_, cache_k_, cache_v_;
+    AlignedVector<float> head_q_, head_k_, head_v_;
+    AlignedVector<Integer> head_q_quant_, head_k_prepared_, head_v_prepared_;
+    AlignedVector<float> scores_;
+    AlignedVector<Integer> scores_quant_;
+    AlignedVector<float> head_context_, context_;
+    AlignedVector<Integer> context_quant_;
+    AlignedVector<float> projected_, attended_;
+    AlignedVector<Integer> attended_quant_;
+    AlignedVector<float> hidden_;
+    AlignedVector<Integer> hidden_quant_;
+    AlignedVector<float> y_;
+};
+
+struct Layers {
+  const Config &config;
+  const bench::Options &options;
+  bench::PerfCounters *const counters;
+  bench::Report &report;
+
+  template <class Backend> void Run() {
+    std::cerr << Backend::kName << "..." << std::endl;
+    std::mt19937 gen(45678);
+    Layer<Backend> layer(config, gen);
+    // Warm up outside the clock.
+    Clock warm(nullptr);
+    layer.Run(warm);
+    Clock clock(counters);
+    for (std::size_t i = 0; i < options.samples; ++i) layer.Run(clock);
+
+    bench::Shape shape = {config.Tokens(), config.d_model, config.ffn};
+    std::vector<double> total(options.samples, 0.0);
+    double all = 0.0;
+    for (int s = 0; s < kStages; ++s) {
+      for (std::size_t i = 0; i < options.samples; ++i) total[i] += clock.stages[s][i];
+      for (int p = 0; p < kParts; ++p) all += clock.parts[s][p];
+    }
+    bench::Result layer_result;
+    layer_result.name = "Layer";
+    layer_result.backend = Backend::kName;
+    layer_result.tag = "total";
+    layer_result.shape = shape;
+    layer_result.operations = 0.0;
+    layer_result.bytes = 0.0;
+    for (int s = 0; s < kStages; ++s) {
+      const Stage stage = static_cast<Stage>(s);
+      bench::Result result;
+      result.name = "Layer";
+      result.backend = Backend::kName;
+      result.tag = kStageNames[s];
+      result.shape = shape;
+      result.time = bench::Summarize(clock.stages[s]);
+      result.operations = layer.Operations(stage);
+      result.bytes = layer.Bytes(stage);
+      result.counters = clock.totals[s];
+      const double seconds = clock.parts[s][kQuantize] + clock.parts[s][kMultiply] + clock.parts[s][kGlue];
+      result.extra.push_back(std::make_pair("layer_share", all > 0.0 ? seconds / all : 0.0));
+      result.extra.push_back(std::make_pair("quantize_share", seconds > 0.0 ? clock.parts[s][kQuantize] / seconds : 0.0));
+      result.extra.push_back(std::make_pair("multiply_share", seconds > 0.0 ? clock.parts[s][kMultiply] / seconds : 0.0));
+      result.extra.push_back(std::make_pair("glue_share", seconds > 0.0 ? clock.parts[s][kGlue] / seconds : 0.0));
+      report.Add(result);
+      layer_result.operations += result.operations;
+      layer_result.bytes += result.bytes;
+      layer_result.counters.regions += result.counters.regions;
+      layer_result.counters.values.resize(std::max(layer_result.counters.values.size(), result.counters.values.size()));
+      for (std::size_t c = 0; c < result.counters.values.size(); ++c) layer_result.counters.values[c] += result.counters.values[c];
+    }
+    layer_result.time = bench::Summarize(total);
+    layer_result.extra.push_back(std::make_pair("tokens_per_second", config.Tokens() / layer_result.time.mean));
+    report.Add(layer_result);
+  }
+};
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  bench::Options options(20);
+  Config config = {512, 8, 2048, 8, 64, false};
+  for (int i = 1; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    Index *value = nullptr;
+    if (!std::strcmp(argv[i], "--d-model")) {
+      value = &config.d_model;
+    } else if (!std::strcmp(argv[i], "--heads")) {
+      value = &config.heads;
+    } else if (!std::strcmp(argv[i], "--ffn")) {
+      value = &config.ffn;
+    } else if (!std::strcmp(argv[i], "--batch")) {
+      value = &config.batch;
+    } else if (!std::strcmp(argv[i], "--seq")) {
+      value = &config.seq;
+    } else if (!std::strcmp(argv[i], "--decode")) {
+      config.decode = true;
+      continue;
+    } else {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage);
+    }
+    if (i + 1 == argc || !(*value = static_cast<Index>(std::atol(argv[++i])))) bench::Usage(argv[0], std::string(argv[i]) + " needs a positive number", kUsage);
+  }
+  if (!options.Shapes(std::vector<bench::Shape>()).empty()) bench::Usage(argv[0], "Shape options do not apply.", kUsage);
+  // The widest backends need multiples of 64 in every inner dimension.
+  if (config.d_model % config.heads || config.HeadWidth() % 64 || config.seq % 64 || config.ffn % 64) {
+    bench::Usage(argv[0], "d_model / heads, --ffn and --seq must be multiples of 64.", kUsage);
+  }
+  if (!options.samples) bench::Usage(argv[0], "--samples must be positive.", kUsage);
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+  std::cerr << (config.decode ? "Decoding step" : "Encoding") << ": d_model " << config.d_model << ", " << config.heads << " heads, ffn " << config.ffn
+    << ", " << config.batch << " sequences of " << config.seq << " tokens." << std::endl;
+  bench::Report report(options.format, counters);
+  Layers layers = {config, options, counters, report};
+  bench::ForEachBackend(layers);
+  report.Write(std::cout);
+  return 0;
+}
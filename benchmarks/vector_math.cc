@@ -0,0 +1,309 @@
+/* Throughput and accuracy of the element-wise kernels in kernels.h, to judge
+ * which are cheap enough to fuse into a Multiply epilogue.
+ *
+ * Each kernel runs over a buffer of --elements (default 4096, which stays in
+ * L1) on every instruction set this CPU has, and the float ones also as a
+ * scalar loop over the standard library ("std"), e.g. std::exp and std::tanh.
+ * The GOPS column counts elements, GB/s the bytes read plus written.
+ * exp_approx_taylor, sigmoid and tanh have no SSE2 version.
+ *
+ * Float kernels also report their max_rel_error and mean_rel_error against
+ * double precision over a fine grid of their input range:
+ *
+ *   exp_approx_taylor  [-20, 20], where it is defined
+ *   sigmoid, tanh      [-10, 10]
+ *   floor              [-100, 100]
+ *   relu               [-1, 1]
+ *
+ * tanh's relative error peaks near 0, where e^x - e^-x cancels.
+ * The integer kernels are exact.  Results carry the element count as the
+ * width; --shapes and the other shape options don't apply.
+ */
+#include "../intgemm/aligned.h"
+#include "../intgemm/kernels.h"
+#include "harness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kUsage =
+  "  --elements RANGE  elements per call, multiples of 64, default 4096\n";
+
+enum class FloatOp { Exp, Sigmoid, Tanh, Floor, Relu };
+
+struct FloatKernel {
+  FloatOp op;
+  const char *name;
+  float lo, hi;
+  bool needs_avx2;
+};
+
+const FloatKernel kFloatKernels[] = {
+  {FloatOp::Exp, "exp_approx_taylor", -20.f, 20.f, true},
+  {FloatOp::Sigmoid, "sigmoid", -10.f, 10.f, true},
+  {FloatOp::Tanh, "tanh", -10.f, 10.f, true},
+  {FloatOp::Floor, "floor", -100.f, 100.f, false},
+  {FloatOp::Relu, "relu<float>", -1.f, 1.f, false}
+};
+
+enum class IntOp { Relu8, Relu32, Rescale, Upcast8to16, Upcast16to32, Upcast8to32, Downcast32to8, Downcast32to16, Downcast16to8 };
+
+struct IntKernel {
+  IntOp op;
+  const char *name;
+  // Bytes per element read and written.
+  std::size_t in_size, out_size;
+};
+
+const IntKernel kIntKernels[] = {
+  {IntOp::Relu8, "relu<int8_t>", 1, 1},
+  {IntOp::Relu32, "relu<int>", 4, 4},
+  {IntOp::Rescale, "rescale", 4, 4},
+  {IntOp::Upcast8to16, "upcast8to16", 1, 2},
+  {IntOp::Upcast16to32, "upcast16to32", 2, 4},
+  {IntOp::Upcast8to32, "upcast8to32", 1, 4},
+  {IntOp::Downcast32to8, "downcast32to8", 4, 1},
+  {IntOp::Downcast32to16, "downcast32to16", 4, 2},
+  {IntOp::Downcast16to8, "downcast16to8", 2, 1}
+};
+
+// Double precision value of the float kernel.
+double Reference(FloatOp op, double x) {
+  switch (op) {
+    case FloatOp::Exp: return std::exp(x);
+    case FloatOp::Sigmoid: return 1.0 / (1.0 + std::exp(-x));
+    case FloatOp::Tanh: return std::tanh(x);
+    case FloatOp::Floor: return std::floor(x);
+    case FloatOp::Relu: return std::max(0.0, x);
+  }
+  return 0.0;
+}
+
+// The standard library baseline.
+void ApplyStd(FloatOp op, const float *in, float *out, Index n) {
+  switch (op) {
+    case FloatOp::Exp: for (Index i = 0; i < n; ++i) out[i] = std::exp(in[i]); break;
+    case FloatOp::Sigmoid: for (Index i = 0; i < n; ++i) out[i] = 1.0f / (1.0f + std::exp(-in[i])); break;
+    case FloatOp::Tanh: for (Index i = 0; i < n; ++i) out[i] = std::tanh(in[i]); break;
+    case FloatOp::Floor: for (Index i = 0; i < n; ++i) out[i] = std::floor(in[i]); break;
+    case FloatOp::Relu: for (Index i = 0; i < n; ++i) out[i] = std::max(0.0f, in[i]); break;
+  }
+}
+
+// n is a multiple of the vector length.
+template <CPUType CPU> void ApplyFloat(FloatOp op, const float *in, float *out, Index n) {
+  typedef vector_t<CPU, float> vf;
+  const vf *i = reinterpret_cast<const vf*>(in), *const end = i + n / (sizeof(vf) / sizeof(float));
+  vf *o = reinterpret_cast<vf*>(out);
+  switch (op) {
+    case FloatOp::Exp: for (; i != end; ++i, ++o) *o = kernels::exp_approx_taylor(*i); break;
+    case FloatOp::Sigmoid: for (; i != end; ++i, ++o) *o = kernels::sigmoid(*i); break;
+    case FloatOp::Tanh: for (; i != end; ++i, ++o) *o = kernels::tanh(*i); break;
+    case FloatOp::Floor: for (; i != end; ++i, ++o) *o = kernels::floor(*i); break;
+    case FloatOp::Relu: for (; i != end; ++i, ++o) *o = kernels::relu<float>(*i); break;
+  }
+}
+
+// in holds in_bytes, a multiple of 4 vectors, of the kernel's input type.
+template <CPUType CPU> void ApplyInt(IntOp op, const void *in, void *out, std::size_t in_bytes) {
+  typedef vector_t<CPU, int> vi;
+  const vi *i = reinterpret_cast<const vi*>(in), *const end = i + in_bytes / sizeof(vi);
+  vi *o = reinterpret_cast<vi*>(out);
+  const vector_t<CPU, float> scale = set1_ps<vector_t<CPU, float>>(0.5f);
+  switch (op) {
+    case IntOp::Relu8: for (; i != end; ++i, ++o) *o = kernels::relu<int8_t>(*i); break;
+    case IntOp::Relu32: for (; i != end; ++i, ++o) *o = kernels::relu<int>(*i); break;
+    case IntOp::Rescale: for (; i != end; ++i, ++o) *o = kernels::rescale(*i, scale); break;
+    case IntOp::Upcast8to16:
+    case IntOp::Upcast16to32:
+      for (; i != end; ++i, o += 2) {
+        dvector_t<CPU, int> r;
+        if (op == IntOp::Upcast8to16) {
+          dvector_t<CPU, int16_t> r16 = kernels::upcast8to16(*i);
+          r.first = r16.first;
+          r.second = r16.second;
+        } else {
+          r = kernels::upcast16to32(*i);
+        }
+        o[0] = r.first;
+        o[1] = r.second;
+      }
+      break;
+    case IntOp::Upcast8to32:
+      for (; i != end; ++i, o += 4) {
+        qvector_t<CPU, int> r = kernels::upcast8to32(*i);
+        o[0] = r.first;
+        o[1] = r.second;
+        o[2] = r.third;
+        o[3] = r.fourth;
+      }
+      break;
+    case IntOp::Downcast32to8: for (; i != end; i += 4, ++o) *o = kernels::downcast32to8(i[0], i[1], i[2], i[3]); break;
+    case IntOp::Downcast32to16: for (; i != end; i += 2, ++o) *o = kernels::downcast32to16(i[0], i[1]); break;
+    case IntOp::Downcast16to8: for (; i != end; i += 2, ++o) *o = kernels::downcast16to8(i[0], i[1]); break;
+  }
+}
+
+template INTGEMM_SSE2 void ApplyFloat<CPUType::SSE2>(FloatOp, const float *, float *, Index);
+template INTGEMM_SSE2 void ApplyInt<CPUType::SSE2>(IntOp, const void *, void *, std::size_t);
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+template INTGEMM_AVX2 void ApplyFloat<CPUType::AVX2>(FloatOp, const float *, float *, Index);
+template INTGEMM_AVX2 void ApplyInt<CPUType::AVX2>(IntOp, const void *, void *, std::size_t);
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+template INTGEMM_AVX512BW void ApplyFloat<CPUType::AVX512BW>(FloatOp, const float *, float *, Index);
+template INTGEMM_AVX512BW void ApplyInt<CPUType::AVX512BW>(IntOp, const void *, void *, std::size_t);
+#endif
+
+typedef void (*FloatFunction)(FloatOp, const float *, float *, Index);
+typedef void (*IntFunction)(IntOp, const void *, void *, std::size_t);
+
+struct ISA {
+  CPUType cpu;
+  FloatFunction apply_float;
+  IntFunction apply_int;
+};
+
+// The instruction sets this CPU has.
+std::vector<ISA> Available() {
+  const ISA all[] = {
+    {CPUType::SSE2, ApplyFloat<CPUType::SSE2>, ApplyInt<CPUType::SSE2>},
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+    {CPUType::AVX2, ApplyFloat<CPUType::AVX2>, ApplyInt<CPUType::AVX2>},
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+    {CPUType::AVX512BW, ApplyFloat<CPUType::AVX512BW>, ApplyInt<CPUType::AVX512BW>},
+#endif
+  };
+  std::vector<ISA> ret;
+  for (const ISA &isa : all) {
+    if (isa.cpu <= kCPU) ret.push_back(isa);
+  }
+  return ret;
+}
+
+// Points in the accuracy grid.
+const Index kGrid = 1 << 20;
+
+// Evenly spaced over [lo, hi], both ends included.
+void Fill(float lo, float hi, AlignedVector<float> &out) {
+  for (std::size_t i = 0; i < out.size(); ++i) out[i] = lo + (hi - lo) * static_cast<float>(i) / static_cast<float>(out.size() - 1);
+}
+
+struct Bench {
+  const bench::Options &options;
+  bench::PerfCounters *const counters;
+  bench::Report &report;
+
+  // Calls per sample so each sample covers about a million elements.
+  static Index Repeat(Index elements) {
+    return std::max<Index>(1, (1 << 20) / elements);
+  }
+
+  void Float(const FloatKernel &kernel, const char *backend, FloatFunction apply, Index elements) {
+    AlignedVector<float> in(elements), out(elements);
+    Fill(kernel.lo, kernel.hi, in);
+    // Shuffled so branches in the scalar functions don't see a pattern.
+    std::shuffle(in.begin(), in.end(), std::mt19937(1234));
+    const Index repeat = Repeat(elements);
+    bench::Result result;
+    result.name = kernel.name;
+    result.backend = backend;
+    result.shape.A_rows = 1;
+    result.shape.width = elements;
+    result.shape.B_cols = 1;
+    result.operations = static_cast<double>(elements) * repeat;
+    result.bytes = result.operations * 2.0 * sizeof(float);
+    std::vector<double> seconds;
+    bench::Measure(options.samples, counters, [&] {
+      for (Index r = 0; r < repeat; ++r) apply(kernel.op, in.begin(), out.begin(), elements);
+    }, seconds, result.counters);
+    result.time = bench::Summarize(seconds);
+
+    AlignedVector<float> grid(kGrid), approx(kGrid);
+    Fill(kernel.lo, kernel.hi, grid);
+    apply(kernel.op, grid.begin(), approx.begin(), kGrid);
+    double max_error = 0.0, sum_error = 0.0;
+    for (Index i = 0; i < kGrid; ++i) {
+      const double expected = Reference(kernel.op, grid[i]);
+      const double error = std::fabs(approx[i] - expected) / std::max(std::fabs(expected), 1e-30);
+      max_error = std::max(max_error, error);
+      sum_error += error;
+    }
+    result.extra.push_back(std::make_pair("max_rel_error", max_error));
+    result.extra.push_back(std::make_pair("mean_rel_error", sum_error / kGrid));
+    report.Add(result);
+  }
+
+  void Int(const IntKernel &kernel, const ISA &isa, Index elements) {
+    AlignedVector<int8_t> in(elements * kernel.in_size), out(elements * kernel.out_size);
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<int> dist(-128, 127);
+    for (int8_t &i : in) i = static_cast<int8_t>(dist(gen));
+    const Index repeat = Repeat(elements);
+    bench::Result result;
+    result.name = kernel.name;
+    result.backend = bench::CPUTypeName(isa.cpu);
+    result.shape.A_rows = 1;
+    result.shape.width = elements;
+    result.shape.B_cols = 1;
+    result.operations = static_cast<double>(elements) * repeat;
+    result.bytes = result.operations * (kernel.in_size + kernel.out_size);
+    std::vector<double> seconds;
+    bench::Measure(options.samples, counters, [&] {
+      for (Index r = 0; r < repeat; ++r) isa.apply_int(kernel.op, in.begin(), out.begin(), in.size());
+    }, seconds, result.counters);
+    result.time = bench::Summarize(seconds);
+    report.Add(result);
+  }
+};
+
+} // namespace
+} // namespace intgemm
+
+int main(int argc, char **argv) {
+  using namespace intgemm;
+  bench::Options options(20);
+  std::vector<Index> elements;
+  for (int i = 1; i < argc; ++i) {
+    if (bench::ParseOption(argc, argv, i, options)) continue;
+    if (!std::strcmp(argv[i], "--elements") && i + 1 < argc) {
+      if (!bench::ParseRange(argv[++i], elements)) bench::Usage(argv[0], std::string("Bad --elements ") + argv[i], kUsage);
+    } else {
+      bench::Usage(argv[0], std::string("Unknown option ") + argv[i], kUsage);
+    }
+  }
+  if (!options.Shapes(std::vector<bench::Shape>()).empty()) bench::Usage(argv[0], "Shape options do not apply; use --elements.", kUsage);
+  if (elements.empty()) elements.push_back(4096);
+  for (Index n : elements) {
+    if (n % 64) bench::Usage(argv[0], "--elements must be multiples of 64.", kUsage);
+  }
+  bench::PerfCounters perf;
+  bench::PerfCounters *counters = bench::Setup(argv[0], options, perf);
+  bench::Report report(options.format, counters);
+  Bench b = {options, counters, report};
+  const std::vector<ISA> isas = Available();
+  for (Index n : elements) {
+    for (const FloatKernel &kernel : kFloatKernels) {
+      std::cerr << kernel.name << "..." << std::endl;
+      b.Float(kernel, "std", ApplyStd, n);
+      for (const ISA &isa : isas) {
+        if (!kernel.needs_avx2 || isa.cpu >= CPUType::AVX2) b.Float(kernel, bench::CPUTypeName(isa.cpu), isa.apply_float, n);
+      }
+    }
+    for (const IntKernel &kernel : kIntKernels) {
+      std::cerr << kernel.name << "..." << std::endl;
+      for (const ISA &isa : isas) b.Int(kernel, isa, n);
+    }
+  }
+  report.Write(std::cout);
+  return 0;
+}
@@ -49,6 +49,17 @@ class QuantizeTile16 {
     }
 };
 
+// Same register layout as QuantizeTile16::ForReshape for already quantized input.
+class ReshapeTile16 {
+  public:
+    INTGEMM_AVX2 static inline Register ForReshape(const int16_t *input, Index cols) {
+      // 8 rows in the first 128-bit register, 8 in the second register.
+      __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+      __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 8 * cols));
+      return _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+    }
+};
+
 struct Kernels16 {
   typedef int16_t Integer;
 
@@ -62,10 +73,13 @@ struct Kernels16 {
     assert(size % 16 == 0);
     assert(reinterpret_cast<uintptr_t>(input) % 32 == 0);
     FRegister q = set1_ps<FRegister>(quant_mult);
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip16);)
     const float *end = input + size;
     for (; input != end; input += 16, output += 16) {
       *reinterpret_cast<__m256i*>(output) = QuantizeTile16::Consecutive(q, input);
+      INTGEMM_TELEMETRY_ONLY(clipped.Add(input); clipped.Add(input + 8);)
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantize(clipped.Total());)
   }
 
   // Tile size for B; B must be a multiple of this block size.
@@ -76,6 +90,7 @@ struct Kernels16 {
     PrepareBFor16(input, output, AVX2::QuantizeTile16(quant_mult), rows, cols);
   }*/
   INTGEMM_PREPARE_B_16(INTGEMM_AVX2, AVX2::QuantizeTile16)
+  INTGEMM_PREPARE_B_QUANTIZED_16(INTGEMM_AVX2, AVX2::ReshapeTile16)
   INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(INTGEMM_AVX2, int16_t)
   INTGEMM_PREPARE_B_TRANSPOSED(INTGEMM_AVX2, AVX2::QuantizeTile16, int16_t)
 
@@ -175,6 +190,21 @@ class QuantizeTile8 {
     }
 };
 
+// Same register layout as QuantizeTile8::ForReshape for already quantized input.
+class ReshapeTile8 {
+  public:
+    INTGEMM_AVX2 static inline Register ForReshape(const int8_t *input, Index cols) {
+      // Put higher rows in the second half of the register, like the quantizer.
+      __m128i first = _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input)),
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + 2 * cols)));
+      __m128i second = _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + 16 * cols)),
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + 18 * cols)));
+      return _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+    }
+};
+
 struct Kernels8 {
   typedef int8_t Integer;
 
@@ -197,10 +227,13 @@ struct Kernels8 {
     assert(size % 32 == 0);
     assert(reinterpret_cast<uintptr_t>(input) % 32 == 0);
     FRegister q = set1_ps<FRegister>(quant_mult);
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip8);)
     const float *end = input + size;
     for (; input != end; input += 32, output += 32) {
       *reinterpret_cast<__m256i*>(output) = QuantizeTile8::ConsecutiveU(q, input);
+      INTGEMM_TELEMETRY_ONLY(for (int j = 0; j < 32; j += 8) clipped.Add(input + j);)
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantizeU(clipped.Total());)
   }
 
   // Tile size for B; B must be a multiple of this block size.
@@ -208,6 +241,7 @@ struct Kernels8 {
   static const Index kBTileCol = 8;
 
   INTGEMM_PREPARE_B_8(INTGEMM_AVX2, AVX2::QuantizeTile8)
+  INTGEMM_PREPARE_B_QUANTIZED_8(INTGEMM_AVX2, AVX2::ReshapeTile8)
   INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(INTGEMM_AVX2, int8_t)
   INTGEMM_PREPARE_B_TRANSPOSED(INTGEMM_AVX2, AVX2::QuantizeTile8, int8_t)
 
@@ -136,6 +136,39 @@ class QuantizeTile8 {
     }
 };
 
+// Same register layouts as the ForReshape functions above for already
+// quantized input.  Each 128-bit lane is loaded separately.
+class ReshapeTile16 {
+  public:
+    INTGEMM_AVX512BW static inline Register ForReshape(const int16_t *input, Index cols) {
+      // 128-bit lane i holds 8 columns from row 8 * i.
+      __m256i low = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input))),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 8 * cols)), 1);
+      __m256i high = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 16 * cols))),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 24 * cols)), 1);
+      return _mm512_inserti64x4(_mm512_castsi256_si512(low), high, 1);
+    }
+};
+
+class ReshapeTile8 {
+  public:
+    INTGEMM_AVX512BW static inline Register ForReshape(const int8_t *input, Index cols) {
+      // 128-bit lane i holds 8 columns from rows 16 * i and 16 * i + 2.
+      __m256i low = _mm256_inserti128_si256(_mm256_castsi128_si256(Lane(input, cols)), Lane(input + 16 * cols, cols), 1);
+      __m256i high = _mm256_inserti128_si256(_mm256_castsi128_si256(Lane(input + 32 * cols, cols)), Lane(input + 48 * cols, cols), 1);
+      return _mm512_inserti64x4(_mm512_castsi256_si512(low), high, 1);
+    }
+
+  private:
+    INTGEMM_AVX512BW static inline __m128i Lane(const int8_t *input, Index cols) {
+      return _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input)),
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + 2 * cols)));
+    }
+};
+
 struct Kernels16 {
   typedef int16_t Integer;
 
@@ -156,11 +189,14 @@ struct Kernels16 {
     assert(reinterpret_cast<uintptr_t>(input) % 64 == 0);
     // Fill with the quantization multiplier.
     const __m512 quant_mult_reg = _mm512_set1_ps(quant_mult);
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip16);)
     const float *end = input + size;
     for (; input != end; input += 16, output += 16) {
       // There doesn't seem to be an unmasked version.
       _mm512_mask_cvtsepi32_storeu_epi16(output, 0xffff, QuantizerGrab(input, quant_mult_reg));
+      INTGEMM_TELEMETRY_ONLY(clipped.Add(input);)
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantize(clipped.Total());)
   }
 
 
@@ -170,6 +206,7 @@ struct Kernels16 {
 
   /* Only INTGEMM_AVX512F is necessary but due to GCC 5.4 bug we have to set INTGEMM_AVX512BW */
   INTGEMM_PREPARE_B_16(INTGEMM_AVX512BW, QuantizeTile16)
+  INTGEMM_PREPARE_B_QUANTIZED_16(INTGEMM_AVX512BW, ReshapeTile16)
   INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(INTGEMM_AVX512BW, int16_t)
   INTGEMM_PREPARE_B_TRANSPOSED(INTGEMM_AVX512BW, QuantizeTile16, int16_t)
 
@@ -202,20 +239,23 @@ struct Kernels8 {
    * OMP. Also, passing register types across #pragma omp parallel for
    * generated an internal compiler error.
    * The problem does not occur in g++-8 (Ubuntu 8.3.0-6ubuntu1~18.04.1) 8.3.0.
-   * As a workaround, I split into #pragma omp parallel with boring types
-   * passed across the boundary then call this function with target attributes.
+   * Lambdas don't get target attributes either.  As a workaround, only boring
+   * types cross into the ParallelFor body, which calls this function with
+   * target attributes on its range.
    */
   INTGEMM_AVX512BW static void QuantizeThread(const float *input, int8_t *output, float quant_mult, std::size_t count) {
     const __m512i neg127 = _mm512_set1_epi32(-127);
     const __m512 quant_mult_reg = _mm512_set1_ps(quant_mult);
     const std::size_t kBatch = sizeof(__m512i) / sizeof(float);
-#pragma omp for
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip8);)
     for (std::size_t i = 0; i < count; i += kBatch) {
       __m512i asint = QuantizerGrab(input + i, quant_mult_reg);
+      INTGEMM_TELEMETRY_ONLY(clipped.Add(input + i);)
       asint = _mm512_max_epi32(asint, neg127);
       // There doesn't seem to be an unmasked version.
       _mm512_mask_cvtsepi32_storeu_epi8(output + i, 0xffff, asint);
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantize(clipped.Total());)
   }
 
  public:
@@ -229,12 +269,16 @@ struct Kernels8 {
     std::size_t fast_size = (size & ~(kBatch - 1));
     const float *fast_input_end = input + fast_size;
     int8_t *fast_output_end = output + fast_size;
-#pragma omp parallel
-    {
-      QuantizeThread(input, output, quant_mult, fast_size);
-    }
+    ParallelFor(0, fast_size, kBatch, QuantizeThreads(kUses, size), [=](std::size_t begin, std::size_t end) {
+      QuantizeThread(input + begin, output + begin, quant_mult, end - begin);
+    });
     std::size_t overhang = size & (kBatch - 1);
     if (!overhang) return; // We needed a branch anyway for the empty case.
+    INTGEMM_TELEMETRY_ONLY({
+      ClipCounter clipped(quant_mult, telemetry::kClip8);
+      clipped.AddRange(fast_input_end, overhang);
+      telemetry::AddQuantize(clipped.Total());
+    })
     const __m512i neg127 = _mm512_set1_epi32(-127);
     const __m512 quant_mult_reg = _mm512_set1_ps(quant_mult);
     __m512i asint = QuantizerGrab(fast_input_end, quant_mult_reg);
@@ -259,14 +303,17 @@ struct Kernels8 {
     const __m512i pos127 = _mm512_set1_epi32(127);
     const __m512i zero = _mm512_setzero_si512();
     const __m512 quant_mult_reg = _mm512_set1_ps(quant_mult);
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip8);)
     const float *end = input + size;
     for (; input < end; input += 16, output += 16) {
       __m512i asint = QuantizerGrab(input, quant_mult_reg);
+      INTGEMM_TELEMETRY_ONLY(clipped.Add(input);)
       asint = _mm512_min_epi32(asint, pos127);
       asint = _mm512_add_epi32(asint, pos127);
       asint = _mm512_max_epi32(asint, zero);
       _mm512_mask_cvtusepi32_storeu_epi8(output, 0xffff, asint);
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantizeU(clipped.Total());)
   }
 
   // Tile size for B; B must be a multiple of this block size.
@@ -275,6 +322,7 @@ struct Kernels8 {
 
   /* Only INTGEMM_AVX512F is necessary but due to GCC 5.4 bug we have to set INTGEMM_AVX512BW */
   INTGEMM_PREPARE_B_8(INTGEMM_AVX512BW, QuantizeTile8)
+  INTGEMM_PREPARE_B_QUANTIZED_8(INTGEMM_AVX512BW, ReshapeTile8)
   INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(INTGEMM_AVX512BW, int8_t)
   INTGEMM_PREPARE_B_TRANSPOSED(INTGEMM_AVX512BW, QuantizeTile8, int8_t)
 
@@ -286,10 +334,10 @@ struct Kernels8 {
   // Special AVX512 implementation due to having 32 registers (so I don't have to
   // allocate registers manually) and no sign instruction.
   template <typename Callback>
-  INTGEMM_AVX512BW static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+  INTGEMM_AVX512BW static void MultiplyTile(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) {
     // This is copy-paste from Multiply8_SSE2OrAVX2.
     assert(width % sizeof(Register) == 0);
-    assert(B_cols % 8 == 0);
+    assert(B_colbegin % 8 == 0 && B_colend % 8 == 0);
     assert(reinterpret_cast<uintptr_t>(A) % sizeof(Register) == 0);
     assert(reinterpret_cast<uintptr_t>(B) % sizeof(Register) == 0);
     // There's 8 results for INTGEMM_AVX2 to handle.
@@ -297,12 +345,12 @@ struct Kernels8 {
     const Index simd_width = width / sizeof(Register);
     // Added for AVX512.
     Register zeros = setzero_si<Register>();
+    INTGEMM_TELEMETRY_ONLY(uint64_t saturated = 0;)
     // Go over 8 columns of B at a time.
-#pragma omp for
-    for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) {
-      const Register *B0_col = reinterpret_cast<const Register*>(B) + B0_colidx * simd_width;
+    for (Index B0_colidx = B_colbegin; B0_colidx < B_colend; B0_colidx += 8) {
+      const Register *B0_col = reinterpret_cast<const Register*>(B) + (B0_colidx - B_colbegin) * simd_width;
       // Process one row of A at a time.  Doesn't seem to be faster to do multiple rows of A at once.
-      for (Index A_rowidx = 0; A_rowidx < A_rows; ++A_rowidx) {
+      for (Index A_rowidx = A_rowbegin; A_rowidx < A_rowend; ++A_rowidx) {
         // Iterate over shared (inner) dimension.
         const Register *A_live = reinterpret_cast<const Register *>(A + A_rowidx * width);
         const Register *A_end = A_live + simd_width;
@@ -377,6 +425,7 @@ struct Kernels8 {
           sum7 = _mm512_adds_epi16(sum7, b7);
           // Unique code ends: can we do an inline function?
         }
+        INTGEMM_TELEMETRY_ONLY(saturated += CountRails16(sum0) + CountRails16(sum1) + CountRails16(sum2) + CountRails16(sum3) + CountRails16(sum4) + CountRails16(sum5) + CountRails16(sum6) + CountRails16(sum7);)
         // Upcast to 32-bit and horizontally add.
         Register ones = set1_epi16<Register>(1);
         sum0 = madd_epi16(sum0, ones);
@@ -394,6 +443,16 @@ struct Kernels8 {
         callback_impl.Run(total, callbacks::OutputBufferInfo(A_rowidx, B0_colidx, A_rows, B_cols));
       }
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddMultiply16(saturated);)
+  }
+
+  template <typename Callback>
+  INTGEMM_AVX512BW static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+    assert(B_cols % 8 == 0);
+#pragma omp for
+    for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) {
+      MultiplyTile(A, B + B0_colidx * width, A_rows, width, B_cols, 0, A_rows, B0_colidx, B0_colidx + 8, callback);
+    }
   }
 
   INTGEMM_MULTIPLY8SHIFT(__m512i, INTGEMM_AVX512BW, CPUType::AVX2)
@@ -20,20 +20,19 @@ INTGEMM_AVX512VNNI static inline void VNNI8(__m512i &c, __m512i a, __m512i b) {
 
 struct Kernels8 : public AVX512BW::Kernels8 {
   template <typename Callback>
-  INTGEMM_AVX512VNNI static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+  INTGEMM_AVX512VNNI static void MultiplyTile(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) {
     assert(width % sizeof(Register) == 0);
-    assert(B_cols % 8 == 0);
+    assert(B_colbegin % 8 == 0 && B_colend % 8 == 0);
     assert(reinterpret_cast<uintptr_t>(A) % sizeof(Register) == 0);
     assert(reinterpret_cast<uintptr_t>(B) % sizeof(Register) == 0);
     auto callback_impl = callbacks::CallbackImpl<CPUType::AVX2, Callback>(callback);
     const Index simd_width = width / sizeof(Register);
     Register zeros = setzero_si<Register>();
     // Go over 8 columns of B at a time.
-#pragma omp for
-    for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) {
-      const Register *B0_col = reinterpret_cast<const Register*>(B) + B0_colidx * simd_width;
+    for (Index B0_colidx = B_colbegin; B0_colidx < B_colend; B0_colidx += 8) {
+      const Register *B0_col = reinterpret_cast<const Register*>(B) + (B0_colidx - B_colbegin) * simd_width;
       // Process one row of A at a time.  Doesn't seem to be faster to do multiple rows of A at once.
-      for (Index A_rowidx = 0; A_rowidx < A_rows; ++A_rowidx) {
+      for (Index A_rowidx = A_rowbegin; A_rowidx < A_rowend; ++A_rowidx) {
         // Iterate over shared (inner) dimension.
         const Register *A_live = reinterpret_cast<const Register *>(A + A_rowidx * width);
         const Register *A_end = A_live + simd_width;
@@ -81,20 +80,28 @@ struct Kernels8 : public AVX512BW::Kernels8 {
   }
 
   template <typename Callback>
-  INTGEMM_AVX512VNNI static void Multiply8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
-    assert(width % sizeof(Register) == 0);
+  INTGEMM_AVX512VNNI static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
     assert(B_cols % 8 == 0);
+#pragma omp for
+    for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) {
+      MultiplyTile(A, B + B0_colidx * width, A_rows, width, B_cols, 0, A_rows, B0_colidx, B0_colidx + 8, callback);
+    }
+  }
+
+  template <typename Callback>
+  INTGEMM_AVX512VNNI static void Multiply8ShiftTile(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) {
+    assert(width % sizeof(Register) == 0);
+    assert(B_colbegin % 8 == 0 && B_colend % 8 == 0);
     assert(reinterpret_cast<uintptr_t>(A) % sizeof(Register) == 0);
     assert(reinterpret_cast<uintptr_t>(B) % sizeof(Register) == 0);
     auto callback_impl = callbacks::CallbackImpl<CPUType::AVX2, Callback>(callback);
     const Index simd_width = width / sizeof(Register);
     Register zeros = setzero_si<Register>();
     // Go over 8 columns of B at a time.
-#pragma omp for
-    for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) {
-      const Register *B0_col = reinterpret_cast<const Register*>(B) + B0_colidx * simd_width;
+    for (Index B0_colidx = B_colbegin; B0_colidx < B_colend; B0_colidx += 8) {
+      const Register *B0_col = reinterpret_cast<const Register*>(B) + (B0_colidx - B_colbegin) * simd_width;
       // Process one row of A at a time.  Doesn't seem to be faster to do multiple rows of A at once.
-      for (Index A_rowidx = 0; A_rowidx < A_rows; ++A_rowidx) {
+      for (Index A_rowidx = A_rowbegin; A_rowidx < A_rowend; ++A_rowidx) {
         // Iterate over shared (inner) dimension.
         const Register *A_live = reinterpret_cast<const Register *>(A + A_rowidx * width);
         const Register *A_end = A_live + simd_width;
@@ -121,6 +128,15 @@ struct Kernels8 : public AVX512BW::Kernels8 {
     }
   }
 
+  template <typename Callback>
+  INTGEMM_AVX512VNNI static void Multiply8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+    assert(B_cols % 8 == 0);
+#pragma omp for
+    for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) {
+      Multiply8ShiftTile(A, B + B0_colidx * width, A_rows, width, B_cols, 0, A_rows, B0_colidx, B0_colidx + 8, callback);
+    }
+  }
+
   template <typename Callback>
   INTGEMM_AVX512VNNI static void PrepareBias(const int8_t *B, Index width, Index B_cols, Callback callback) {
     assert(width % sizeof(Register) == 0);
@@ -68,11 +68,11 @@ private:
 #define RUN_CALLBACKS_PIPELINE_IMPL(vtype) \
   template <unsigned FirstIndex> \
   INTGEMM_TARGET static inline void run_callbacks(vtype input, const OutputBufferInfo& info, CallbacksTupleType& tuple, sequence<FirstIndex>) { \
-    std::get<FirstIndex>(tuple)(input, info); \
+    std::get<FirstIndex>(tuple).Run(input, info); \
   } \
   template <unsigned FirstIndex, unsigned SecondIndex, unsigned... RestIndices> \
   INTGEMM_TARGET static inline void run_callbacks(vtype input, const OutputBufferInfo& info, CallbacksTupleType& tuple, sequence<FirstIndex, SecondIndex, RestIndices...>) { \
-    auto output = std::get<FirstIndex>(tuple)(input, info); \
+    auto output = std::get<FirstIndex>(tuple).Run(input, info); \
     run_callbacks(output, info, tuple, sequence<SecondIndex, RestIndices...>()); \
   }
 
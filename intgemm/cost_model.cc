@@ -0,0 +1,105 @@
+#include "cost_model.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+namespace intgemm {
+namespace {
+
+const std::size_t kISAs = static_cast<std::size_t>(CPUType::AVX512VNNI) + 1;
+
+// Indexed by CPUType.  Measured by benchmarks/calibrate_threads on an
+// AVX512VNNI machine.  SSE2 and unsupported use the SSE2 16-bit rate.
+CostRates gRates[kISAs] = {
+  /* UNSUPPORTED */ {14000.0f, 14000.0f, 4000.0f},
+  /* SSE2 */        {14000.0f, 14000.0f, 4000.0f},
+  /* SSSE3 */       {17000.0f, 14000.0f, 4000.0f},
+  /* AVX2 */        {46000.0f, 35000.0f, 4200.0f},
+  /* AVX512BW */    {67000.0f, 61000.0f, 4400.0f},
+  /* AVX512VNNI */  {88000.0f, 61000.0f, 4400.0f},
+};
+
+// Measured on first use unless SetThreadOverhead came first.
+float gOverhead = 0.0f;
+std::once_flag gOverheadOnce;
+
+// A measurement below this is noise or a nested call that ran serially.  It
+// still keeps tiny calls on one thread.
+const float kMinOverhead = 0.5f;
+
+template <class Function> float MinMicroseconds(std::size_t tries, Function fn) {
+  fn();
+  float best = std::numeric_limits<float>::max();
+  for (std::size_t t = 0; t < tries; ++t) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    best = std::min(best, std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+float Overhead() {
+  std::call_once(gOverheadOnce, [] {
+    gOverhead = std::max(kMinOverhead, MeasureThreadOverhead(100));
+  });
+  return gOverhead;
+}
+
+} // namespace
+
+void SetCostRates(CPUType isa, const CostRates &rates) {
+  gRates[static_cast<std::size_t>(isa)] = rates;
+}
+
+CostRates GetCostRates(CPUType isa) {
+  return gRates[static_cast<std::size_t>(isa)];
+}
+
+float MeasureThreadOverhead(std::size_t tries) {
+  const unsigned threads = MaxThreads();
+  if (threads < 2) return -1.0f;
+  std::atomic<std::size_t> sink(0);
+  const auto body = [&sink](std::size_t begin, std::size_t end) { sink.fetch_add(end - begin, std::memory_order_relaxed); };
+  // ParallelForRun skips the cost model, profiling and tracing.
+  const float parallel = MinMicroseconds(tries, [&] { ParallelForRun(0, threads, 1, threads, body); });
+  const float serial = MinMicroseconds(tries, [&] { ParallelForRun(0, threads, 1, 1, body); });
+  return std::max(0.0f, parallel - serial) / static_cast<float>(threads - 1);
+}
+
+void SetThreadOverhead(float microseconds) {
+  // Skip the measurement.
+  std::call_once(gOverheadOnce, [] {});
+  gOverhead = microseconds;
+}
+
+float GetThreadOverhead() {
+  return Overhead();
+}
+
+unsigned ThreadsForWork(float microseconds) {
+  const unsigned kMax = std::numeric_limits<unsigned short>::max();
+  const float overhead = Overhead();
+  if (overhead <= 0.0f) return kMax;
+  const float threads = std::sqrt(microseconds / overhead);
+  if (threads < 1.0f) return 1;
+  if (threads >= static_cast<float>(kMax)) return kMax;
+  return static_cast<unsigned>(threads);
+}
+
+unsigned MultiplyThreads(CPUType isa, std::size_t integer_bytes, Index A_rows, Index width, Index B_cols) {
+  const CostRates &rates = gRates[static_cast<std::size_t>(isa)];
+  const float rate = integer_bytes == 1 ? rates.multiply8 : rates.multiply16;
+  const float work = static_cast<float>(A_rows) * static_cast<float>(width) * static_cast<float>(B_cols);
+  return ThreadsForWork(work / rate);
+}
+
+unsigned QuantizeThreads(CPUType isa, std::size_t size) {
+  return ThreadsForWork(static_cast<float>(size) / gRates[static_cast<std::size_t>(isa)].quantize);
+}
+
+} // namespace intgemm
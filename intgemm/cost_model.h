@@ -0,0 +1,61 @@
+#pragma once
+/* How many threads a call is worth.
+ *
+ * Waking threads costs a few microseconds each, which is more than a small
+ * multiply takes on one core.  The model is
+ *   time(threads) = work / (rate * threads) + overhead * (threads - 1)
+ * where rate is how fast one core does the work with a given instruction set
+ * and overhead is what each extra thread adds to a parallel region.  This is
+ * minimised at threads = sqrt(work / (rate * overhead)), rounded down and at
+ * least 1.  ParallelFor further caps the answer by the number of pieces and
+ * the concurrency limit.
+ *
+ * The default rates were measured with benchmarks/calibrate_threads, which
+ * prints the SetCostRates and SetThreadOverhead calls for the machine it runs
+ * on.  The overhead depends more on the machine and its load, so unless
+ * SetThreadOverhead is called first, the first call that needs it measures it
+ * with MeasureThreadOverhead, taking at least 0.5 microseconds.  That costs
+ * a millisecond or so once.  An overhead of 0 turns the model off and always
+ * uses every thread.
+ *
+ * Do not change the model while other threads are inside intgemm.
+ */
+
+#include "types.h"
+
+#include <cstddef>
+
+namespace intgemm {
+
+// Throughput of one core with an instruction set.
+struct CostRates {
+  // Multiply-accumulates per microsecond for 8-bit and 16-bit Multiply.
+  float multiply8;
+  float multiply16;
+  // Floats per microsecond for Quantize.
+  float quantize;
+};
+
+void SetCostRates(CPUType isa, const CostRates &rates);
+CostRates GetCostRates(CPUType isa);
+
+// Microseconds each thread after the first adds to a parallel region.
+void SetThreadOverhead(float microseconds);
+float GetThreadOverhead();
+
+// Time tries parallel regions over every thread and over one thread and
+// return the difference per extra thread, or -1 with only one thread.  Call
+// it outside parallel regions.
+float MeasureThreadOverhead(std::size_t tries);
+
+// Threads worth using for work that takes microseconds on one core.
+unsigned ThreadsForWork(float microseconds);
+
+// Threads worth using for Multiply of A_rows x width by width x B_cols with
+// integer_bytes-sized integers.
+unsigned MultiplyThreads(CPUType isa, std::size_t integer_bytes, Index A_rows, Index width, Index B_cols);
+
+// Threads worth using to quantize size floats.
+unsigned QuantizeThreads(CPUType isa, std::size_t size);
+
+} // namespace intgemm
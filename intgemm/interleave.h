@@ -2,10 +2,13 @@
 
 #include "intgemm/intgemm_config.h"
 #include "intrinsics.h"
+#include "parallel.h"
+#include "telemetry.h"
 #include "types.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cstddef>
 
 namespace intgemm {
 
@@ -184,17 +187,21 @@ template <class Register> static inline void Transpose8InLane(
 // 256 272
 // 257 273
 // ... ...
+//
+// Each block of 8 columns is written to its own contiguous range of the
+// output, so blocks are independent and ParallelFor splits them over threads.
+// The split is the same as Multiply's over B0_colidx, so with first-touch NUMA
+// placement the pages of a prepared block land on the node of the thread that
+// will later multiply with them.
 #define INTGEMM_PREPARE_B_8(target, QuantClass) \
-target static inline void PrepareB(const float *input, int8_t *output_shadow, float quant_mult, Index rows, Index cols) { \
+target static inline void PrepareBRange(const float *input, int8_t *output_shadow, float quant_mult, Index rows, Index cols, Index col_begin, Index col_end) { \
   FRegister q = set1_ps<FRegister>(quant_mult); \
+  INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip8);) \
   /* Currently all multipliers have a stride of 8 columns.*/ \
   const Index kColStride = 8; \
-  assert(cols % kColStride == 0); \
-  assert(rows % sizeof(Register) == 0); \
-  assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
-  Register *output = reinterpret_cast<Register*>(output_shadow); \
-  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
-  for (Index c = 0; c < cols; c += kColStride) { \
+  for (Index c = col_begin; c < col_end; c += kColStride) { \
+    /* Each column block takes 8 * rows bytes. */ \
+    Register *output = reinterpret_cast<Register*>(output_shadow) + c * (rows / sizeof(Register)); \
     for (Index r = 0; r < rows; r += sizeof(Register), output += 8) { \
       /* Quantize and perform a transpose with height sizeof(Register) and width 8. \
          This isn't quite Transpose8InLane because it's half the number of columns, \
@@ -213,27 +220,106 @@ target static inline void PrepareB(const float *input, int8_t *output_shadow, fl
       Interleave8(output[4], output[5]); \
       Interleave8(output[6], output[7]); \
       Transpose16InLane(output[0], output[1], output[2], output[3], output[4], output[5], output[6], output[7]); \
+      /* The rows just quantized, while they are still in L1. */ \
+      INTGEMM_TELEMETRY_ONLY(for (Index k = 0; k < sizeof(Register); ++k) clipped.Add8(input + cols * (r + k) + c);) \
     } \
   } \
+  INTGEMM_TELEMETRY_ONLY(telemetry::AddPrepareB(clipped.Total());) \
+} \
+target static inline void PrepareB(const float *input, int8_t *output, float quant_mult, Index rows, Index cols) { \
+  assert(cols % 8 == 0); \
+  assert(rows % sizeof(Register) == 0); \
+  assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
+  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
+  ParallelFor(0, cols, 8, [=](std::size_t begin, std::size_t end) { \
+    PrepareBRange(input, output, quant_mult, rows, cols, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
 } \
 
 #define INTGEMM_PREPARE_B_16(target, QuantClass) \
-target static inline void PrepareB(const float *input, int16_t *output_shadow, float quant_mult, Index rows, Index cols) { \
+target static inline void PrepareBRange(const float *input, int16_t *output_shadow, float quant_mult, Index rows, Index cols, Index col_begin, Index col_end) { \
   FRegister q = set1_ps<FRegister>(quant_mult); \
+  INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip16);) \
+  for (Index c = col_begin; c < col_end; c += 8) { \
+    /* Each column block takes 8 * rows 16-bit values. */ \
+    Register *output = reinterpret_cast<Register*>(output_shadow) + c * (rows / (sizeof(Register) / sizeof(int16_t))); \
+    for (Index r = 0; r < rows; r += (sizeof(Register) / sizeof(int16_t)), output += 8) { \
+      /* gcc unrolls this loop and uses registers for output[k]*/ \
+      for (Index k = 0; k < 8; ++k) { \
+        output[k] = QuantClass::ForReshape(q, input + cols * (r + k) + c, cols); \
+      } \
+      Transpose16InLane(output[0], output[1], output[2], output[3], output[4], output[5], output[6], output[7]); \
+      INTGEMM_TELEMETRY_ONLY(for (Index k = 0; k < sizeof(Register) / sizeof(int16_t); ++k) clipped.Add8(input + cols * (r + k) + c);) \
+    } \
+  } \
+  INTGEMM_TELEMETRY_ONLY(telemetry::AddPrepareB(clipped.Total());) \
+} \
+target static inline void PrepareB(const float *input, int16_t *output, float quant_mult, Index rows, Index cols) { \
   assert(cols % 8 == 0); \
   assert(rows % (sizeof(Register) / sizeof(int16_t)) == 0); \
   assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
-  Register *output = reinterpret_cast<Register*>(output_shadow); \
   assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
-  for (Index c = 0; c < cols; c += 8) { \
+  ParallelFor(0, cols, 8, [=](std::size_t begin, std::size_t end) { \
+    PrepareBRange(input, output, quant_mult, rows, cols, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
+}
+
+/* PrepareB for a B that is already quantized (e.g. with Quantize) but still
+ * row major.  This is the same rearrangement as above without the float
+ * conversion: ReshapeClass::ForReshape loads the same rows as the quantizer's
+ * ForReshape and places them in the same bytes of the register, then the
+ * byte transpose is done in registers.
+ */
+#define INTGEMM_PREPARE_B_QUANTIZED_8(target, ReshapeClass) \
+target static inline void PrepareBQuantizedRange(const int8_t *input, int8_t *output_shadow, Index rows, Index cols, Index col_begin, Index col_end) { \
+  const Index kColStride = 8; \
+  for (Index c = col_begin; c < col_end; c += kColStride) { \
+    Register *output = reinterpret_cast<Register*>(output_shadow) + c * (rows / sizeof(Register)); \
+    for (Index r = 0; r < rows; r += sizeof(Register), output += 8) { \
+      output[0] = ReshapeClass::ForReshape(input + cols * (r    ) + c, cols); \
+      output[1] = ReshapeClass::ForReshape(input + cols * (r + 1) + c, cols); \
+      output[2] = ReshapeClass::ForReshape(input + cols * (r + 4) + c, cols); \
+      output[3] = ReshapeClass::ForReshape(input + cols * (r + 5) + c, cols); \
+      output[4] = ReshapeClass::ForReshape(input + cols * (r + 8) + c, cols); \
+      output[5] = ReshapeClass::ForReshape(input + cols * (r + 9) + c, cols); \
+      output[6] = ReshapeClass::ForReshape(input + cols * (r + 12) + c, cols); \
+      output[7] = ReshapeClass::ForReshape(input + cols * (r + 13) + c, cols); \
+      Interleave8(output[0], output[1]); \
+      Interleave8(output[2], output[3]); \
+      Interleave8(output[4], output[5]); \
+      Interleave8(output[6], output[7]); \
+      Transpose16InLane(output[0], output[1], output[2], output[3], output[4], output[5], output[6], output[7]); \
+    } \
+  } \
+} \
+target static inline void PrepareBQuantized(const int8_t *input, int8_t *output, Index rows, Index cols) { \
+  assert(cols % 8 == 0); \
+  assert(rows % sizeof(Register) == 0); \
+  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
+  ParallelFor(0, cols, 8, [=](std::size_t begin, std::size_t end) { \
+    PrepareBQuantizedRange(input, output, rows, cols, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
+} \
+
+#define INTGEMM_PREPARE_B_QUANTIZED_16(target, ReshapeClass) \
+target static inline void PrepareBQuantizedRange(const int16_t *input, int16_t *output_shadow, Index rows, Index cols, Index col_begin, Index col_end) { \
+  for (Index c = col_begin; c < col_end; c += 8) { \
+    Register *output = reinterpret_cast<Register*>(output_shadow) + c * (rows / (sizeof(Register) / sizeof(int16_t))); \
     for (Index r = 0; r < rows; r += (sizeof(Register) / sizeof(int16_t)), output += 8) { \
-      /* gcc unrolls this loop and uses registers for output[k]*/ \
       for (Index k = 0; k < 8; ++k) { \
-        output[k] = QuantClass::ForReshape(q, input + cols * (r + k) + c, cols); \
+        output[k] = ReshapeClass::ForReshape(input + cols * (r + k) + c, cols); \
       } \
       Transpose16InLane(output[0], output[1], output[2], output[3], output[4], output[5], output[6], output[7]); \
     } \
   } \
+} \
+target static inline void PrepareBQuantized(const int16_t *input, int16_t *output, Index rows, Index cols) { \
+  assert(cols % 8 == 0); \
+  assert(rows % (sizeof(Register) / sizeof(int16_t)) == 0); \
+  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
+  ParallelFor(0, cols, 8, [=](std::size_t begin, std::size_t end) { \
+    PrepareBQuantizedRange(input, output, rows, cols, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
 }
 
 /*
@@ -244,20 +330,24 @@ target static inline void PrepareB(const float *input, int16_t *output_shadow, f
  * cols and rows describe size of transposed B.
  */
 #define INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(target, Integer) \
-target static inline void PrepareBQuantizedTransposed(const Integer* input, Integer* output, Index cols, Index rows) { \
+target static inline void PrepareBQuantizedTransposedRange(const Integer* input, Integer* output, Index cols, Index row_begin, Index row_end) { \
   const Index RegisterElems = sizeof(Register) / sizeof(Integer); \
   const Index kColStride = 8; \
-  \
-  assert(cols % RegisterElems == 0); \
-  assert(rows % kColStride == 0); \
-  assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
-  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
-  \
-  Register* output_it = reinterpret_cast<Register*>(output); \
-  for (Index r = 0; r < rows; r += kColStride) \
+  for (Index r = row_begin; r < row_end; r += kColStride) { \
+    Register* output_it = reinterpret_cast<Register*>(output) + r * (cols / RegisterElems); \
     for (Index c = 0; c < cols; c += RegisterElems) \
       for (Index ri = 0; ri < 8; ++ri) \
         *output_it++ = *reinterpret_cast<const Register*>(input + (r + ri) * cols + c); \
+  } \
+} \
+target static inline void PrepareBQuantizedTransposed(const Integer* input, Integer* output, Index cols, Index rows) { \
+  assert(cols % (sizeof(Register) / sizeof(Integer)) == 0); \
+  assert(rows % 8 == 0); \
+  assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
+  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
+  ParallelFor(0, rows, 8, [=](std::size_t begin, std::size_t end) { \
+    PrepareBQuantizedTransposedRange(input, output, cols, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
 }
 
 /*
@@ -266,52 +356,65 @@ target static inline void PrepareBQuantizedTransposed(const Integer* input, Inte
  * Cols has to be a multiple of sizeof(Register) / sizeof(float).
  *
  * cols and rows describe size of transposed B.
+ *
+ * A register may wrap around to the next 8 rows when cols is small, so the
+ * work is split by output register group rather than by 8 rows.  Group i
+ * starts at element i * RegisterElemsInt of the matrix read 8 rows at a time.
  */
 #define INTGEMM_PREPARE_B_TRANSPOSED(target, Quantizer, Integer) \
-target static inline void PrepareBTransposed(const float* input, Integer* output, float quant_mult, Index cols, Index rows) { \
+target static inline void PrepareBTransposedRange(const float* input, Integer* output, float quant_mult, Index cols, Index group_begin, Index group_end) { \
   const Index RegisterElemsInt = sizeof(Register) / sizeof(Integer); \
   const Index kColStride = 8; \
-  \
-  assert(cols % (sizeof(Register) / sizeof(float)) == 0); \
-  assert(rows % kColStride == 0); \
-  assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
-  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
-  \
   FRegister q = set1_ps<FRegister>(quant_mult); \
-  Register* output_it = reinterpret_cast<Register*>(output); \
-  Index r = 0; \
-  Index c = 0; \
-  while (r < rows) { \
+  for (Index group = group_begin; group < group_end; ++group) { \
+    Register* output_it = reinterpret_cast<Register*>(output) + group * 8; \
+    const Index r = (group * RegisterElemsInt / cols) * kColStride; \
+    const Index c = (group * RegisterElemsInt) % cols; \
     for (Index ri = 0; ri < 8; ++ri) \
       *output_it++ = Quantizer::ConsecutiveWithWrapping(q, input + (r + ri) * cols + c, cols - c, cols, 8); \
-    c += RegisterElemsInt; \
-    while (c >= cols) { \
-      r += kColStride; \
-      c -= cols; \
-    } \
   } \
+} \
+target static inline void PrepareBTransposed(const float* input, Integer* output, float quant_mult, Index cols, Index rows) { \
+  assert(cols % (sizeof(Register) / sizeof(float)) == 0); \
+  assert(rows % 8 == 0); \
+  assert(reinterpret_cast<uintptr_t>(input) % sizeof(Register) == 0); \
+  assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
+  const Index RegisterElemsInt = sizeof(Register) / sizeof(Integer); \
+  const Index groups = ((rows / 8) * cols + RegisterElemsInt - 1) / RegisterElemsInt; \
+  ParallelFor(0, groups, 1, [=](std::size_t begin, std::size_t end) { \
+    PrepareBTransposedRange(input, output, quant_mult, cols, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
 }
 
 /* Select columns of B from PrepareB format to PrepareB format.
+ * Each group of 8 selected columns is independent so groups are split over
+ * threads.
  */
 #define INTGEMM_SELECT_COL_B(target, Register) \
-target static inline void SelectColumnsOfB(const Register *input, Register *output, Index rows_bytes /* number of bytes in a row */, const Index *cols_begin, const Index *cols_end) { \
-  assert(rows_bytes % sizeof(Register) == 0); \
-  assert((cols_end - cols_begin) % 8 == 0);  \
+target static inline void SelectColumnsOfBRange(const Register *input, Register *output, Index rows_bytes /* number of bytes in a row */, const Index *cols_begin, Index group_begin, Index group_end) { \
   /* Do columns for multiples of 8.*/ \
   Index register_rows = rows_bytes / sizeof(Register); \
-  const Register *starts[8]; \
-  for (; cols_begin != cols_end; cols_begin += 8) { \
+  for (Index group = group_begin; group < group_end; ++group) { \
+    const Index *cols = cols_begin + group * 8; \
+    Register *output_it = output + group * register_rows * 8; \
+    const Register *starts[8]; \
     for (Index k = 0; k < 8; ++k) { \
-      starts[k] = input + (cols_begin[k] & 7) + (cols_begin[k] & ~7) * register_rows; \
+      starts[k] = input + (cols[k] & 7) + (cols[k] & ~7) * register_rows; \
     } \
     for (Index r = 0; r < register_rows; ++r) { \
       for (Index k = 0; k < 8; ++k) { \
-        *(output++) = *starts[k]; \
+        *(output_it++) = *starts[k]; \
         starts[k] += 8; \
       } \
     } \
   } \
+} \
+target static inline void SelectColumnsOfB(const Register *input, Register *output, Index rows_bytes /* number of bytes in a row */, const Index *cols_begin, const Index *cols_end) { \
+  assert(rows_bytes % sizeof(Register) == 0); \
+  assert((cols_end - cols_begin) % 8 == 0);  \
+  ParallelFor(0, static_cast<std::size_t>(cols_end - cols_begin) / 8, 1, [=](std::size_t begin, std::size_t end) { \
+    SelectColumnsOfBRange(input, output, rows_bytes, cols_begin, static_cast<Index>(begin), static_cast<Index>(end)); \
+  }); \
 }
 
 } // namespace intgemm
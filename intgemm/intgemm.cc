@@ -141,36 +141,92 @@ MeanStd Unsupported_VectorMeanStd(const float * /*begin*/, const float * /*end*/
   return MeanStd();
 }
 
-void (*const Int16::Quantize)(const float *input, int16_t *output, float quant_mult, Index size) = ChooseCPU(AVX512BW::Kernels16::Quantize, AVX512BW::Kernels16::Quantize, AVX2::Kernels16::Quantize, SSE2::Kernels16::Quantize, SSE2::Kernels16::Quantize, Unsupported_16bit::Quantize);
+#if defined(INTGEMM_PROFILE) || defined(INTGEMM_TRACE)
+/* The public entry points below are pointers chosen once for this CPU.  To
+ * profile or trace them, each kernel is wrapped in a function that records
+ * the call.
+ */
+namespace {
+
+template <class Kernels> void TimedQuantize(const float *input, typename Kernels::Integer *output, float quant_mult, Index size) {
+  INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::Quantize, Kernels::kUses, size, size * (sizeof(float) + sizeof(typename Kernels::Integer)));)
+  INTGEMM_TRACE_ONLY(TraceSpan span(Operation::Quantize, 1, 0, size);)
+  Kernels::Quantize(input, output, quant_mult, size);
+}
+
+template <class Kernels> void TimedQuantizeU(const float *input, uint8_t *output, float quant_mult, Index size) {
+  INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::Quantize, Kernels::kUses, size, size * (sizeof(float) + sizeof(uint8_t)));)
+  INTGEMM_TRACE_ONLY(TraceSpan span(Operation::Quantize, 1, 0, size);)
+  Kernels::QuantizeU(input, output, quant_mult, size);
+}
+
+template <class Kernels> void TimedPrepareB(const float *input, typename Kernels::Integer *output, float quant_mult, Index rows, Index cols) {
+  INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::PrepareB, Kernels::kUses, static_cast<uint64_t>(rows) * cols, static_cast<uint64_t>(rows) * cols * (sizeof(float) + sizeof(typename Kernels::Integer)));)
+  INTGEMM_TRACE_ONLY(TraceSpan span(Operation::PrepareB, rows, 0, cols);)
+  Kernels::PrepareB(input, output, quant_mult, rows, cols);
+}
+
+template <class Kernels> void TimedSelectColumnsB(const typename Kernels::Integer *input, typename Kernels::Integer *output, Index rows, const Index *cols_begin, const Index *cols_end) {
+  INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::SelectColumnsB, Kernels::kUses, static_cast<uint64_t>(rows) * (cols_end - cols_begin), 2 * static_cast<uint64_t>(rows) * (cols_end - cols_begin) * sizeof(typename Kernels::Integer));)
+  INTGEMM_TRACE_ONLY(TraceSpan span(Operation::SelectColumnsB, rows, 0, cols_end - cols_begin);)
+  Kernels::SelectColumnsB(input, output, rows, cols_begin, cols_end);
+}
+
+template <CPUType kUses, float (*Run)(const float *, const float *)> float TimedMaxAbsolute(const float *begin, const float *end) {
+  INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::MaxAbsolute, kUses, end - begin, (end - begin) * sizeof(float));)
+  INTGEMM_TRACE_ONLY(TraceSpan span(Operation::MaxAbsolute, 1, 0, end - begin);)
+  return Run(begin, end);
+}
 
-void (*const Int16::PrepareB)(const float *input, int16_t *output, float quant_mult, Index rows, Index cols) = ChooseCPU(AVX512BW::Kernels16::PrepareB, AVX512BW::Kernels16::PrepareB, AVX2::Kernels16::PrepareB, SSE2::Kernels16::PrepareB, SSE2::Kernels16::PrepareB, Unsupported_16bit::PrepareB);
+} // namespace
+
+#define INTGEMM_TIMED(function, Kernels) Timed##function<Kernels>
+#define INTGEMM_TIMED_MAX_ABSOLUTE(cpu, function) TimedMaxAbsolute<cpu, function>
+#else
+#define INTGEMM_TIMED(function, Kernels) Kernels::function
+#define INTGEMM_TIMED_MAX_ABSOLUTE(cpu, function) function
+#endif
+
+void (*const Int16::Quantize)(const float *input, int16_t *output, float quant_mult, Index size) = ChooseCPU(INTGEMM_TIMED(Quantize, AVX512BW::Kernels16), INTGEMM_TIMED(Quantize, AVX512BW::Kernels16), INTGEMM_TIMED(Quantize, AVX2::Kernels16), INTGEMM_TIMED(Quantize, SSE2::Kernels16), INTGEMM_TIMED(Quantize, SSE2::Kernels16), Unsupported_16bit::Quantize);
+
+void (*const Int16::PrepareB)(const float *input, int16_t *output, float quant_mult, Index rows, Index cols) = ChooseCPU(INTGEMM_TIMED(PrepareB, AVX512BW::Kernels16), INTGEMM_TIMED(PrepareB, AVX512BW::Kernels16), INTGEMM_TIMED(PrepareB, AVX2::Kernels16), INTGEMM_TIMED(PrepareB, SSE2::Kernels16), INTGEMM_TIMED(PrepareB, SSE2::Kernels16), Unsupported_16bit::PrepareB);
+
+void (*const Int16::PrepareBQuantized)(const int16_t *input, int16_t *output, Index rows, Index cols) = ChooseCPU(AVX512BW::Kernels16::PrepareBQuantized, AVX512BW::Kernels16::PrepareBQuantized, AVX2::Kernels16::PrepareBQuantized, SSE2::Kernels16::PrepareBQuantized, SSE2::Kernels16::PrepareBQuantized, Unsupported_16bit::PrepareBQuantized);
 
 void (*const Int16::PrepareBQuantizedTransposed)(const int16_t *input, int16_t *output, Index inner, Index B_untransposed_cols) = ChooseCPU(AVX512BW::Kernels16::PrepareBQuantizedTransposed, AVX512BW::Kernels16::PrepareBQuantizedTransposed, AVX2::Kernels16::PrepareBQuantizedTransposed, SSE2::Kernels16::PrepareBQuantizedTransposed, SSE2::Kernels16::PrepareBQuantizedTransposed, Unsupported_16bit::PrepareBQuantizedTransposed);
 
 void (*const Int16::PrepareBTransposed)(const float *input, int16_t *output, float quant_mult, Index inner, Index B_untransposed_cols) = ChooseCPU(AVX512BW::Kernels16::PrepareBTransposed, AVX512BW::Kernels16::PrepareBTransposed, AVX2::Kernels16::PrepareBTransposed, SSE2::Kernels16::PrepareBTransposed, SSE2::Kernels16::PrepareBTransposed, Unsupported_16bit::PrepareBTransposed);
 
-void (*const Int16::SelectColumnsB)(const int16_t *input, int16_t *output, Index rows, const Index *cols_begin, const Index *cols_end) = ChooseCPU(AVX512BW::Kernels16::SelectColumnsB, AVX512BW::Kernels16::SelectColumnsB, AVX2::Kernels16::SelectColumnsB, SSE2::Kernels16::SelectColumnsB, SSE2::Kernels16::SelectColumnsB, Unsupported_16bit::SelectColumnsB);
+void (*const Int16::SelectColumnsB)(const int16_t *input, int16_t *output, Index rows, const Index *cols_begin, const Index *cols_end) = ChooseCPU(INTGEMM_TIMED(SelectColumnsB, AVX512BW::Kernels16), INTGEMM_TIMED(SelectColumnsB, AVX512BW::Kernels16), INTGEMM_TIMED(SelectColumnsB, AVX2::Kernels16), INTGEMM_TIMED(SelectColumnsB, SSE2::Kernels16), INTGEMM_TIMED(SelectColumnsB, SSE2::Kernels16), Unsupported_16bit::SelectColumnsB);
 
 const char *const Int16::kName = ChooseCPU(AVX512BW::Kernels16::kName, AVX512BW::Kernels16::kName, AVX2::Kernels16::kName, SSE2::Kernels16::kName, SSE2::Kernels16::kName, Unsupported_16bit::kName);
 
-void (*const Int8::Quantize)(const float *input, int8_t *output, float quant_mult, Index size) = ChooseCPU(AVX512VNNI::Kernels8::Quantize, AVX512BW::Kernels8::Quantize, AVX2::Kernels8::Quantize, SSSE3::Kernels8::Quantize, Unsupported_8bit::Quantize, Unsupported_8bit::Quantize);
+const CPUType Int16::kUses = ChooseCPU(AVX512BW::Kernels16::kUses, AVX512BW::Kernels16::kUses, AVX2::Kernels16::kUses, SSE2::Kernels16::kUses, SSE2::Kernels16::kUses, CPUType::UNSUPPORTED);
+
+void (*const Int8::Quantize)(const float *input, int8_t *output, float quant_mult, Index size) = ChooseCPU(INTGEMM_TIMED(Quantize, AVX512VNNI::Kernels8), INTGEMM_TIMED(Quantize, AVX512BW::Kernels8), INTGEMM_TIMED(Quantize, AVX2::Kernels8), INTGEMM_TIMED(Quantize, SSSE3::Kernels8), Unsupported_8bit::Quantize, Unsupported_8bit::Quantize);
+
+void (*const Int8::QuantizeU)(const float *input, uint8_t *output, float quant_mult, Index size) = ChooseCPU(INTGEMM_TIMED(QuantizeU, AVX512VNNI::Kernels8), INTGEMM_TIMED(QuantizeU, AVX512BW::Kernels8), INTGEMM_TIMED(QuantizeU, AVX2::Kernels8), INTGEMM_TIMED(QuantizeU, SSSE3::Kernels8), Unsupported_8bit::QuantizeU, Unsupported_8bit::QuantizeU);
 
-void (*const Int8::QuantizeU)(const float *input, uint8_t *output, float quant_mult, Index size) = ChooseCPU(AVX512VNNI::Kernels8::QuantizeU, AVX512BW::Kernels8::QuantizeU, AVX2::Kernels8::QuantizeU, SSSE3::Kernels8::QuantizeU, Unsupported_8bit::QuantizeU, Unsupported_8bit::QuantizeU);
+void (*const Int8::PrepareB)(const float *input, int8_t *output, float quant_mult, Index rows, Index cols) = ChooseCPU(INTGEMM_TIMED(PrepareB, AVX512VNNI::Kernels8), INTGEMM_TIMED(PrepareB, AVX512BW::Kernels8), INTGEMM_TIMED(PrepareB, AVX2::Kernels8), INTGEMM_TIMED(PrepareB, SSSE3::Kernels8), Unsupported_8bit::PrepareB, Unsupported_8bit::PrepareB);
 
-void (*const Int8::PrepareB)(const float *input, int8_t *output, float quant_mult, Index rows, Index cols) = ChooseCPU(AVX512VNNI::Kernels8::PrepareB, AVX512BW::Kernels8::PrepareB, AVX2::Kernels8::PrepareB, SSSE3::Kernels8::PrepareB, Unsupported_8bit::PrepareB, Unsupported_8bit::PrepareB);
+void (*const Int8::PrepareBQuantized)(const int8_t *input, int8_t *output, Index rows, Index cols) = ChooseCPU(AVX512BW::Kernels8::PrepareBQuantized, AVX512BW::Kernels8::PrepareBQuantized, AVX2::Kernels8::PrepareBQuantized, SSSE3::Kernels8::PrepareBQuantized, Unsupported_8bit::PrepareBQuantized, Unsupported_8bit::PrepareBQuantized);
 
 void (*const Int8::PrepareBQuantizedTransposed)(const int8_t *input, int8_t *output, Index inner, Index B_untransposed_cols) = ChooseCPU(AVX512BW::Kernels8::PrepareBQuantizedTransposed, AVX512BW::Kernels8::PrepareBQuantizedTransposed, AVX2::Kernels8::PrepareBQuantizedTransposed, SSSE3::Kernels8::PrepareBQuantizedTransposed, Unsupported_8bit::PrepareBQuantizedTransposed, Unsupported_8bit::PrepareBQuantizedTransposed);
 
 void (*const Int8::PrepareBTransposed)(const float *input, int8_t *output, float quant_mult, Index inner, Index B_untransposed_cols) = ChooseCPU(AVX512BW::Kernels8::PrepareBTransposed, AVX512BW::Kernels8::PrepareBTransposed, AVX2::Kernels8::PrepareBTransposed, SSSE3::Kernels8::PrepareBTransposed, Unsupported_8bit::PrepareBTransposed, Unsupported_8bit::PrepareBTransposed);
 
-void (*const Int8::SelectColumnsB)(const int8_t *input, int8_t *output, Index rows, const Index *cols_begin, const Index *cols_end) = ChooseCPU(AVX512VNNI::Kernels8::SelectColumnsB, AVX512BW::Kernels8::SelectColumnsB, AVX2::Kernels8::SelectColumnsB, SSSE3::Kernels8::SelectColumnsB, Unsupported_8bit::SelectColumnsB, Unsupported_8bit::SelectColumnsB);
+void (*const Int8::SelectColumnsB)(const int8_t *input, int8_t *output, Index rows, const Index *cols_begin, const Index *cols_end) = ChooseCPU(INTGEMM_TIMED(SelectColumnsB, AVX512VNNI::Kernels8), INTGEMM_TIMED(SelectColumnsB, AVX512BW::Kernels8), INTGEMM_TIMED(SelectColumnsB, AVX2::Kernels8), INTGEMM_TIMED(SelectColumnsB, SSSE3::Kernels8), Unsupported_8bit::SelectColumnsB, Unsupported_8bit::SelectColumnsB);
 
 const char *const Int8::kName = ChooseCPU(AVX512VNNI::Kernels8::kName, AVX512BW::Kernels8::kName, AVX2::Kernels8::kName, SSSE3::Kernels8::kName, Unsupported_8bit::kName, Unsupported_8bit::kName);
 
-void (*const Int8Shift::QuantizeU)(const float *input, uint8_t *output, float quant_mult, Index size) = ChooseCPU(AVX512VNNI::Kernels8::QuantizeU, AVX512BW::Kernels8::QuantizeU, AVX2::Kernels8::QuantizeU, SSSE3::Kernels8::QuantizeU, Unsupported_8bit::QuantizeU, Unsupported_8bit::QuantizeU);
+const CPUType Int8::kUses = ChooseCPU(AVX512VNNI::Kernels8::kUses, AVX512BW::Kernels8::kUses, AVX2::Kernels8::kUses, SSSE3::Kernels8::kUses, CPUType::UNSUPPORTED, CPUType::UNSUPPORTED);
+
+void (*const Int8Shift::QuantizeU)(const float *input, uint8_t *output, float quant_mult, Index size) = ChooseCPU(INTGEMM_TIMED(QuantizeU, AVX512VNNI::Kernels8), INTGEMM_TIMED(QuantizeU, AVX512BW::Kernels8), INTGEMM_TIMED(QuantizeU, AVX2::Kernels8), INTGEMM_TIMED(QuantizeU, SSSE3::Kernels8), Unsupported_8bit::QuantizeU, Unsupported_8bit::QuantizeU);
 
 const char *const Int8Shift::kName = ChooseCPU(AVX512VNNI::Kernels8::kName, AVX512BW::Kernels8::kName, AVX2::Kernels8::kName, SSSE3::Kernels8::kName, Unsupported_8bit::kName, Unsupported_8bit::kName);
 
+const CPUType Int8Shift::kUses = ChooseCPU(AVX512VNNI::Kernels8::kUses, AVX512BW::Kernels8::kUses, AVX2::Kernels8::kUses, SSSE3::Kernels8::kUses, CPUType::UNSUPPORTED, CPUType::UNSUPPORTED);
+
 #if !defined(INTGEMM_COMPILER_SUPPORTS_AVX2)
 namespace AVX2{
 using SSE2::MaxAbsolute;
@@ -184,7 +240,7 @@ using AVX2::VectorMeanStd;
 } // namespace AVX512BW
 #endif
 
-float (*const MaxAbsolute)(const float *begin, const float *end) = ChooseCPU(AVX512BW::MaxAbsolute, AVX512BW::MaxAbsolute, AVX2::MaxAbsolute, SSE2::MaxAbsolute, SSE2::MaxAbsolute, Unsupported_MaxAbsolute);
+float (*const MaxAbsolute)(const float *begin, const float *end) = ChooseCPU(INTGEMM_TIMED_MAX_ABSOLUTE(CPUType::AVX512BW, AVX512BW::MaxAbsolute), INTGEMM_TIMED_MAX_ABSOLUTE(CPUType::AVX512BW, AVX512BW::MaxAbsolute), INTGEMM_TIMED_MAX_ABSOLUTE(CPUType::AVX2, AVX2::MaxAbsolute), INTGEMM_TIMED_MAX_ABSOLUTE(CPUType::SSE2, SSE2::MaxAbsolute), INTGEMM_TIMED_MAX_ABSOLUTE(CPUType::SSE2, SSE2::MaxAbsolute), Unsupported_MaxAbsolute);
 
 MeanStd (*const VectorMeanStd)(const float *begin, const float *end, bool absolute) = ChooseCPU(AVX512BW::VectorMeanStd, AVX512BW::VectorMeanStd, AVX2::VectorMeanStd, SSE2::VectorMeanStd, SSE2::VectorMeanStd, Unsupported_VectorMeanStd);
 
@@ -42,6 +42,9 @@
 #include <cstdint>
 
 #include "types.h"
+#include "profile.h"
+#include "trace.h"
+#include "tasks.h"
 #include "sse2_gemm.h"
 #include "ssse3_gemm.h"
 #include "avx2_gemm.h"
@@ -61,6 +64,9 @@ struct Unsupported_16bit {
   static void PrepareB(const float *, int16_t *, float, Index, Index) {
     UnsupportedCPUError();
   }
+  static void PrepareBQuantized(const int16_t *, int16_t *, Index, Index) {
+    UnsupportedCPUError();
+  }
   static void PrepareBQuantizedTransposed(const int16_t *, int16_t *, Index, Index) {
     UnsupportedCPUError();
   }
@@ -74,6 +80,14 @@ struct Unsupported_16bit {
   static void Multiply(const int16_t *, const int16_t *, Index, Index, Index, Callback) {
     UnsupportedCPUError();
   }
+  template <typename Callback>
+  static void MultiplyTile(const int16_t *, const int16_t *, Index, Index, Index, Index, Index, Index, Index, Callback) {
+    UnsupportedCPUError();
+  }
+  template <typename Callback>
+  static void MultiplyPanel(const int16_t *, const int16_t *, Index, Index, Index, Index, Index, Callback) {
+    UnsupportedCPUError();
+  }
   constexpr static const char *const kName = "16-bit Unsupported";
 };
 
@@ -96,6 +110,9 @@ struct Unsupported_8bit {
   static void PrepareB(const float *, int8_t *, float, Index, Index) {
     UnsupportedCPUError();
   }
+  static void PrepareBQuantized(const int8_t *, int8_t *, Index, Index) {
+    UnsupportedCPUError();
+  }
   template<class Callback>
   static void PrepareBias(const int8_t *, Index, Index, Callback) {
     UnsupportedCPUError();
@@ -107,10 +124,26 @@ struct Unsupported_8bit {
   static void Multiply(const int8_t *, const int8_t *, Index, Index, Index, Callback) {
     UnsupportedCPUError();
   }
+  template <typename Callback>
+  static void MultiplyTile(const int8_t *, const int8_t *, Index, Index, Index, Index, Index, Index, Index, Callback) {
+    UnsupportedCPUError();
+  }
+  template <typename Callback>
+  static void MultiplyPanel(const int8_t *, const int8_t *, Index, Index, Index, Index, Index, Callback) {
+    UnsupportedCPUError();
+  }
   template<class Callback>
   static void Multiply8Shift(const uint8_t *, const int8_t *, Index, Index, Index, Callback) {
     UnsupportedCPUError();
   }
+  template<class Callback>
+  static void Multiply8ShiftTile(const uint8_t *, const int8_t *, Index, Index, Index, Index, Index, Index, Index, Callback) {
+    UnsupportedCPUError();
+  }
+  template<class Callback>
+  static void Multiply8ShiftPanel(const uint8_t *, const int8_t *, Index, Index, Index, Index, Index, Callback) {
+    UnsupportedCPUError();
+  }
 
   constexpr static const char *const kName = "8-bit Unsupported";
 };
@@ -174,6 +207,8 @@ struct Int8 {
   // A's columns must be a multiple of 8.
   // The number of rows is anything.
   static inline void PrepareA(const float *input, int8_t *output, float quant_mult, Index rows, Index cols) {
+    INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::PrepareA, kUses, static_cast<uint64_t>(rows) * cols, static_cast<uint64_t>(rows) * cols * (sizeof(float) + sizeof(int8_t)));)
+    INTGEMM_TRACE_ONLY(TraceSpan span(Operation::PrepareA, rows, 0, cols);)
     Quantize(input, output, quant_mult, rows * cols);
   }
 
@@ -188,6 +223,11 @@ struct Int8 {
   // It will match the Multiply function on the same CPU though.
   static void (*const PrepareB)(const float *input, int8_t *output, float quant_mult, Index rows, Index cols);
 
+  // Convert from a B that was already quantized (e.g. with Quantize) but is
+  // still row major to the CPU-dependent format used for Multiply.  This is
+  // PrepareB without the float conversion.
+  static void (*const PrepareBQuantized)(const int8_t *input, int8_t *output, Index rows, Index cols);
+
   // Convert from a B that was already transposed (routine not provided) and
   // quantized (e.g. with Quantize) to the CPU-dependent format used for
   // Multiply.  This is useful for storing a quantized model on disk then in a
@@ -205,20 +245,61 @@ struct Int8 {
   // Multiply C = A * B, presuming A and B have been prepared.
   template <typename Callback>
   static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+    INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::Multiply, kUses, profile::MultiplyOperations(A_rows, width, B_cols), profile::MultiplyBytes<int8_t>(A_rows, width, B_cols));)
+    INTGEMM_TRACE_ONLY(TraceSpan span(Operation::Multiply, A_rows, width, B_cols);)
     MultiplyImpl<Callback>::run(A, B, A_rows, width, B_cols, callback);
   }
 
+  // Multiply by columns [B_colbegin, B_colend) of B, both multiples of 8,
+  // given only those columns' prepared data in B_panel.  The callback sees
+  // columns at their position in all of B_cols.  See stream.h.
+  template <typename Callback>
+  static void MultiplyPanel(const int8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) {
+    MultiplyPanelImpl<Callback>::run(A, B_panel, A_rows, width, B_cols, B_colbegin, B_colend, callback);
+  }
+
+  // Describe Multiply as independent tile tasks for the caller to schedule.  See tasks.h.
+  template <typename Callback>
+  static MultiplyTasks<int8_t, int8_t, Callback> PlanMultiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback, TileShape shape = TileShape()) {
+    return MultiplyTasks<int8_t, int8_t, Callback>(MultiplyTileImpl<Callback>::run, A, B, A_rows, width, B_cols, callback, shape);
+  }
+
+  // Multiply with the tiles run by executor instead of intgemm's threads.
+  template <typename Callback>
+  static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback, Executor &executor, TileShape shape = TileShape()) {
+    PlanMultiply(A, B, A_rows, width, B_cols, callback, shape).Run(executor);
+  }
+
   static const char *const kName;
 
+  // Instruction set of the kernels chosen for this CPU.
+  static const CPUType kUses;
+
 private:
   template <typename Callback>
   struct MultiplyImpl {
     static void (*const run)(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback);
   };
+
+  template <typename Callback>
+  struct MultiplyTileImpl {
+    static void (*const run)(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback);
+  };
+
+  template <typename Callback>
+  struct MultiplyPanelImpl {
+    static void (*const run)(const int8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback);
+  };
 };
 
 template <typename Callback>
-void (*const Int8::MultiplyImpl<Callback>::run)(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) = ChooseCPU(OMPParallelWrap<Callback, AVX512VNNI::Kernels8>, OMPParallelWrap<Callback, AVX512BW::Kernels8>, OMPParallelWrap<Callback, AVX2::Kernels8>, OMPParallelWrap<Callback, SSSE3::Kernels8>, Unsupported_8bit::Multiply<Callback>, Unsupported_8bit::Multiply<Callback>);
+void (*const Int8::MultiplyImpl<Callback>::run)(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) = ChooseCPU(ParallelWrap<Callback, AVX512VNNI::Kernels8>, ParallelWrap<Callback, AVX512BW::Kernels8>, ParallelWrap<Callback, AVX2::Kernels8>, ParallelWrap<Callback, SSSE3::Kernels8>, Unsupported_8bit::Multiply<Callback>, Unsupported_8bit::Multiply<Callback>);
+
+template <typename Callback>
+void (*const Int8::MultiplyTileImpl<Callback>::run)(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) = ChooseCPU(TileWrap<Callback, AVX512VNNI::Kernels8>, TileWrap<Callback, AVX512BW::Kernels8>, TileWrap<Callback, AVX2::Kernels8>, TileWrap<Callback, SSSE3::Kernels8>, Unsupported_8bit::MultiplyTile<Callback>, Unsupported_8bit::MultiplyTile<Callback>);
+
+template <typename Callback>
+void (*const Int8::MultiplyPanelImpl<Callback>::run)(const int8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) = ChooseCPU(PanelWrap<Callback, AVX512VNNI::Kernels8>, PanelWrap<Callback, AVX512BW::Kernels8>, PanelWrap<Callback, AVX2::Kernels8>, PanelWrap<Callback, SSSE3::Kernels8>, Unsupported_8bit::MultiplyPanel<Callback>, Unsupported_8bit::MultiplyPanel<Callback>);
 
 /*
  * 8-bit matrix multiplication with shifting A by 127
@@ -231,6 +312,8 @@ struct Int8Shift {
 
   // Identical to the Int8 Version, except it adds 127 to each number, making sure that all numbers are positive.
   static inline void PrepareA(const float *input, int8_t *output, float quant_mult, Index rows, Index cols) {
+    INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::PrepareA, kUses, static_cast<uint64_t>(rows) * cols, static_cast<uint64_t>(rows) * cols * (sizeof(float) + sizeof(int8_t)));)
+    INTGEMM_TRACE_ONLY(TraceSpan span(Operation::PrepareA, rows, 0, cols);)
     QuantizeU(input, reinterpret_cast<uint8_t *>(output), quant_mult, rows * cols);
   }
 
@@ -244,6 +327,11 @@ struct Int8Shift {
     Int8::PrepareB(input, output, quant_mult, rows, cols);
   }
 
+  // Same as Int8::PrepareBQuantized.
+  static void PrepareBQuantized(const int8_t *input, int8_t *output, Index rows, Index cols) {
+    Int8::PrepareBQuantized(input, output, rows, cols);
+  }
+
   // Select columns from a prepared B matrix.  The number of selected columns must be a multiple of 8. 
   static void SelectColumnsB(const int8_t *input, int8_t *output, Index rows, const Index *cols_begin, const Index *cols_end) {
     Int8::SelectColumnsB(input, output, rows, cols_begin, cols_end);
@@ -253,9 +341,30 @@ struct Int8Shift {
   // Multiply C = A * B + Bias, presuming A, B and Bias have all been prepared (for A, PrepareAnew should be used
   template<class Callback>
   static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+    INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::Multiply, kUses, profile::MultiplyOperations(A_rows, width, B_cols), profile::MultiplyBytes<int8_t>(A_rows, width, B_cols));)
+    INTGEMM_TRACE_ONLY(TraceSpan span(Operation::Multiply, A_rows, width, B_cols);)
     MultiplyImpl<Callback>::run((const uint8_t *)A, B, A_rows, width, B_cols, callback);
   }
 
+  // Multiply by columns [B_colbegin, B_colend) of B given only those
+  // columns' prepared data.  See Int8::MultiplyPanel.
+  template <class Callback>
+  static void MultiplyPanel(const int8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) {
+    MultiplyPanelImpl<Callback>::run((const uint8_t *)A, B_panel, A_rows, width, B_cols, B_colbegin, B_colend, callback);
+  }
+
+  // Describe Multiply as independent tile tasks for the caller to schedule.  See tasks.h.
+  template <class Callback>
+  static MultiplyTasks<uint8_t, int8_t, Callback> PlanMultiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback, TileShape shape = TileShape()) {
+    return MultiplyTasks<uint8_t, int8_t, Callback>(MultiplyTileImpl<Callback>::run, (const uint8_t *)A, B, A_rows, width, B_cols, callback, shape);
+  }
+
+  // Multiply with the tiles run by executor instead of intgemm's threads.
+  template <class Callback>
+  static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback, Executor &executor, TileShape shape = TileShape()) {
+    PlanMultiply(A, B, A_rows, width, B_cols, callback, shape).Run(executor);
+  }
+
   // This function prepares the bias for the Multiply routine that does unsigned * signed multiplication.
   // The function takes:
   // a preparedB matrix, width, B_cols and
@@ -268,12 +377,25 @@ struct Int8Shift {
   
   static const char *const kName;
 
+  // Instruction set of the kernels chosen for this CPU.
+  static const CPUType kUses;
+
 private:
   template <typename Callback>
   struct MultiplyImpl {
     static void (*const run)(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback);
   };
 
+  template <typename Callback>
+  struct MultiplyTileImpl {
+    static void (*const run)(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback);
+  };
+
+  template <typename Callback>
+  struct MultiplyPanelImpl {
+    static void (*const run)(const uint8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback);
+  };
+
   template <typename Callback>
   struct PrepareBiasImpl {
     static void (*const run)(const int8_t *B, Index width, Index B_cols, Callback callback);
@@ -282,12 +404,28 @@ private:
 
 template <class Callback>
 void (*const Int8Shift::MultiplyImpl<Callback>::run)(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) = ChooseCPU(
-    OMPParallelWrap8Shift<Callback, AVX512VNNI::Kernels8>,
-    OMPParallelWrap8Shift<Callback, AVX512BW::Kernels8>,
-    OMPParallelWrap8Shift<Callback, AVX2::Kernels8>,
-    OMPParallelWrap8Shift<Callback, SSSE3::Kernels8>, 
+    ParallelWrap8Shift<Callback, AVX512VNNI::Kernels8>,
+    ParallelWrap8Shift<Callback, AVX512BW::Kernels8>,
+    ParallelWrap8Shift<Callback, AVX2::Kernels8>,
+    ParallelWrap8Shift<Callback, SSSE3::Kernels8>, 
     Unsupported_8bit::Multiply8Shift<Callback>, Unsupported_8bit::Multiply8Shift<Callback>);
 
+template <class Callback>
+void (*const Int8Shift::MultiplyTileImpl<Callback>::run)(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) = ChooseCPU(
+    TileWrap8Shift<Callback, AVX512VNNI::Kernels8>,
+    TileWrap8Shift<Callback, AVX512BW::Kernels8>,
+    TileWrap8Shift<Callback, AVX2::Kernels8>,
+    TileWrap8Shift<Callback, SSSE3::Kernels8>,
+    Unsupported_8bit::Multiply8ShiftTile<Callback>, Unsupported_8bit::Multiply8ShiftTile<Callback>);
+
+template <class Callback>
+void (*const Int8Shift::MultiplyPanelImpl<Callback>::run)(const uint8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) = ChooseCPU(
+    PanelWrap8Shift<Callback, AVX512VNNI::Kernels8>,
+    PanelWrap8Shift<Callback, AVX512BW::Kernels8>,
+    PanelWrap8Shift<Callback, AVX2::Kernels8>,
+    PanelWrap8Shift<Callback, SSSE3::Kernels8>,
+    Unsupported_8bit::Multiply8ShiftPanel<Callback>, Unsupported_8bit::Multiply8ShiftPanel<Callback>);
+
 template <class Callback>
 void (*const Int8Shift::PrepareBiasImpl<Callback>::run)(const int8_t *B, Index width, Index B_cols, Callback callback) = ChooseCPU(AVX512VNNI::Kernels8::PrepareBias<Callback>, AVX512BW::Kernels8::PrepareBias<Callback>, AVX2::Kernels8::PrepareBias<Callback>, SSSE3::Kernels8::PrepareBias<Callback>, SSSE3::Kernels8::PrepareBias<Callback>, Unsupported_8bit::PrepareBias);
 
@@ -304,6 +442,8 @@ struct Int16 {
   // A's columns must be a multiple of 8.
   // The number of rows is anything.
   static inline void PrepareA(const float *input, int16_t *output, float quant_mult, Index rows, Index cols) {
+    INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::PrepareA, kUses, static_cast<uint64_t>(rows) * cols, static_cast<uint64_t>(rows) * cols * (sizeof(float) + sizeof(int16_t)));)
+    INTGEMM_TRACE_ONLY(TraceSpan span(Operation::PrepareA, rows, 0, cols);)
     Quantize(input, output, quant_mult, rows * cols);
   }
 
@@ -315,6 +455,11 @@ struct Int16 {
   // It will match the Multiply function on the same CPU though.
   static void (*const PrepareB)(const float *input, int16_t *output, float quant_mult, Index rows, Index cols);
 
+  // Convert from a B that was already quantized (e.g. with Quantize) but is
+  // still row major to the CPU-dependent format used for Multiply.  This is
+  // PrepareB without the float conversion.
+  static void (*const PrepareBQuantized)(const int16_t *input, int16_t *output, Index rows, Index cols);
+
   // Convert from a B that was already transposed (routine not provided) and
   // quantized (e.g. with Quantize) to the CPU-dependent format used for
   // Multiply.  This is useful for storing a quantized model on disk then in a
@@ -332,20 +477,60 @@ struct Int16 {
   // Multiply C = A * B, presuming A and B have been prepared.
   template <typename Callback>
   static void Multiply(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+    INTGEMM_PROFILE_ONLY(ProfileScope scope(Operation::Multiply, kUses, profile::MultiplyOperations(A_rows, width, B_cols), profile::MultiplyBytes<int16_t>(A_rows, width, B_cols));)
+    INTGEMM_TRACE_ONLY(TraceSpan span(Operation::Multiply, A_rows, width, B_cols);)
     MultiplyImpl<Callback>::run(A, B, A_rows, width, B_cols, callback);
   }
 
+  // Multiply by columns [B_colbegin, B_colend) of B given only those
+  // columns' prepared data.  See Int8::MultiplyPanel.
+  template <typename Callback>
+  static void MultiplyPanel(const int16_t *A, const int16_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) {
+    MultiplyPanelImpl<Callback>::run(A, B_panel, A_rows, width, B_cols, B_colbegin, B_colend, callback);
+  }
+
+  // Describe Multiply as independent tile tasks for the caller to schedule.  See tasks.h.
+  template <typename Callback>
+  static MultiplyTasks<int16_t, int16_t, Callback> PlanMultiply(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback, TileShape shape = TileShape()) {
+    return MultiplyTasks<int16_t, int16_t, Callback>(MultiplyTileImpl<Callback>::run, A, B, A_rows, width, B_cols, callback, shape);
+  }
+
+  // Multiply with the tiles run by executor instead of intgemm's threads.
+  template <typename Callback>
+  static void Multiply(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback, Executor &executor, TileShape shape = TileShape()) {
+    PlanMultiply(A, B, A_rows, width, B_cols, callback, shape).Run(executor);
+  }
+
   static const char *const kName;
 
+  // Instruction set of the kernels chosen for this CPU.
+  static const CPUType kUses;
+
 private:
   template <typename Callback>
   struct MultiplyImpl {
     static void (*const run)(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback);
   };
+
+  template <typename Callback>
+  struct MultiplyTileImpl {
+    static void (*const run)(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback);
+  };
+
+  template <typename Callback>
+  struct MultiplyPanelImpl {
+    static void (*const run)(const int16_t *A, const int16_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback);
+  };
 };
 
 template <typename Callback>
-void (*const Int16::MultiplyImpl<Callback>::run)(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback) = ChooseCPU(OMPParallelWrap<Callback, AVX512BW::Kernels16> /*TODO VNNI 16-bit. */, OMPParallelWrap<Callback, AVX512BW::Kernels16>, OMPParallelWrap<Callback, AVX2::Kernels16>, OMPParallelWrap<Callback, SSE2::Kernels16>, OMPParallelWrap<Callback, SSE2::Kernels16>, Unsupported_16bit::Multiply<Callback>);
+void (*const Int16::MultiplyImpl<Callback>::run)(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback) = ChooseCPU(ParallelWrap<Callback, AVX512BW::Kernels16> /*TODO VNNI 16-bit. */, ParallelWrap<Callback, AVX512BW::Kernels16>, ParallelWrap<Callback, AVX2::Kernels16>, ParallelWrap<Callback, SSE2::Kernels16>, ParallelWrap<Callback, SSE2::Kernels16>, Unsupported_16bit::Multiply<Callback>);
+
+template <typename Callback>
+void (*const Int16::MultiplyTileImpl<Callback>::run)(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) = ChooseCPU(TileWrap<Callback, AVX512BW::Kernels16>, TileWrap<Callback, AVX512BW::Kernels16>, TileWrap<Callback, AVX2::Kernels16>, TileWrap<Callback, SSE2::Kernels16>, TileWrap<Callback, SSE2::Kernels16>, Unsupported_16bit::MultiplyTile<Callback>);
+
+template <typename Callback>
+void (*const Int16::MultiplyPanelImpl<Callback>::run)(const int16_t *A, const int16_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) = ChooseCPU(PanelWrap<Callback, AVX512BW::Kernels16>, PanelWrap<Callback, AVX512BW::Kernels16>, PanelWrap<Callback, AVX2::Kernels16>, PanelWrap<Callback, SSE2::Kernels16>, PanelWrap<Callback, SSE2::Kernels16>, Unsupported_16bit::MultiplyPanel<Callback>);
 
 extern const CPUType kCPU;
 
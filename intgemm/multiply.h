@@ -3,8 +3,12 @@
 #include "intgemm/intgemm_config.h"
 #include "interleave.h"
 #include "intrinsics.h"
+#include "parallel.h"
 #include "vec_traits.h"
 #include "callbacks.h"
+#include "cost_model.h"
+
+#include <cstddef>
 
 namespace intgemm {
 
@@ -37,24 +41,28 @@ INTGEMM_AVX512BW static inline __m256i PermuteSummer(__m512i pack0123, __m512i p
 }
 #endif
 
+/* Kernels' Multiply functions split their loop over B's columns with this so
+ * callers that are already in an OpenMP parallel region share the work.
+ * intgemm's own entry points use ParallelFor instead.
+ */
 #ifdef _MSC_VER
 #define INTGEMM_OMP_FOR __pragma(omp for)
-#define INTGEMM_OMP_PARALLEL __pragma(omp parallel)
 #else
 #define INTGEMM_OMP_FOR _Pragma("omp for")
-#define INTGEMM_OMP_PARALLEL _Pragma("omp parallel")
 #endif
 
 // Quantize function used for SSSE3 and AVX2.
-// Separate function for thread to work around gcc 7 bug that doesn't imbue
-// target attributes across #pragma omp parallel.
+// Separate function for each range of work to work around gcc 7 bug that
+// doesn't imbue target attributes on the lambda passed to ParallelFor.
 #define INTGEMM_QUANTIZE_THREAD(target) \
 target static void QuantizeThread(const float *input, int8_t *output, float quant_mult, std::size_t count) { \
   FRegister q = set1_ps<FRegister>(quant_mult); \
-  INTGEMM_OMP_FOR \
+  INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip8);) \
   for (std::size_t i = 0; i < count; i += sizeof(Register)) { \
     *reinterpret_cast<Register*>(output + i) = QuantizeTile8::Consecutive(q, input + i); \
+    INTGEMM_TELEMETRY_ONLY(for (std::size_t j = 0; j < sizeof(Register); j += sizeof(FRegister) / sizeof(float)) clipped.Add(input + i + j);) \
   } \
+  INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantize(clipped.Total());) \
 }
 
 #define INTGEMM_QUANTIZE(target) \
@@ -63,12 +71,16 @@ target static void Quantize(const float *const input, int8_t *const output, floa
   assert(reinterpret_cast<uintptr_t>(output) % sizeof(Register) == 0); \
   const std::size_t kBatch = sizeof(Register); \
   const std::size_t fast_end = size & ~(kBatch - 1); \
-  INTGEMM_OMP_PARALLEL \
-  { \
-    QuantizeThread(input, output, quant_mult, fast_end); \
-  } \
+  ParallelFor(0, fast_end, kBatch, QuantizeThreads(kUses, size), [=](std::size_t begin, std::size_t end) { \
+    QuantizeThread(input + begin, output + begin, quant_mult, end - begin); \
+  }); \
   std::size_t overhang = size & (kBatch - 1); \
   if (!overhang) return; \
+  INTGEMM_TELEMETRY_ONLY({ \
+    ClipCounter clipped(quant_mult, telemetry::kClip8); \
+    clipped.AddRange(input + fast_end, overhang); \
+    telemetry::AddQuantize(clipped.Total()); \
+  }) \
   FRegister q = set1_ps<FRegister>(quant_mult); \
   /* Each does size(Register) / 32 == kBatch / 4 floats at a time.
    * If we're allowed to read one of them, then we can read the whole register.  */ \
@@ -157,20 +169,25 @@ INTGEMM_AVX2 static inline void RunCallback(Callback& callback_impl, vector_t<CP
 // A_rows can be anything non-negative.
 // width must be a multiple of the register size.
 // B_cols must be a multiple of 8.
+//
+// MultiplyTile computes rows [A_rowbegin, A_rowend) and columns
+// [B_colbegin, B_colend) of C with no threading.  A is all of A but B points
+// at the prepared data for column B_colbegin.  The column bounds must be
+// multiples of 8.  Multiply computes all of C, splitting 8-column blocks with
+// omp for.
 // Multiply16
 #define INTGEMM_MULTIPLY16(Register, target, cpu_type) \
-template <typename Callback> target static void Multiply(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback) { \
+template <typename Callback> target static void MultiplyTile(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) { \
   assert(width % (sizeof(Register) / sizeof(int16_t)) == 0); \
-  assert(B_cols % 8 == 0); \
+  assert(B_colbegin % 8 == 0 && B_colend % 8 == 0); \
   assert(reinterpret_cast<uintptr_t>(A) % sizeof(Register) == 0); \
   assert(reinterpret_cast<uintptr_t>(B) % sizeof(Register) == 0); \
   const Index simd_width = width / (sizeof(Register) / sizeof(int16_t)); \
   auto callback_impl = callbacks::CallbackImpl<cpu_type, Callback>(callback); \
-  INTGEMM_OMP_FOR \
-  for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) { \
-    const Register *B0_col = reinterpret_cast<const Register *>(B) + simd_width * B0_colidx; \
+  for (Index B0_colidx = B_colbegin; B0_colidx < B_colend; B0_colidx += 8) { \
+    const Register *B0_col = reinterpret_cast<const Register *>(B) + simd_width * (B0_colidx - B_colbegin); \
     /* Process one row of A at a time.  Doesn't seem to be faster to do multiple rows of A at once.*/ \
-    for (Index A_rowidx = 0; A_rowidx < A_rows; ++A_rowidx) { \
+    for (Index A_rowidx = A_rowbegin; A_rowidx < A_rowend; ++A_rowidx) { \
       const Register *A_row = reinterpret_cast<const Register*>(A + A_rowidx * width); \
       /* These will be packed 32-bit integers containing sums for each row of B multiplied by the row of A. \
          Iterate over shared (inner) dimension.*/ \
@@ -214,6 +231,13 @@ template <typename Callback> target static void Multiply(const int16_t *A, const
     } \
   } \
 } \
+template <typename Callback> target static void Multiply(const int16_t *A, const int16_t *B, Index A_rows, Index width, Index B_cols, Callback callback) { \
+  assert(B_cols % 8 == 0); \
+  INTGEMM_OMP_FOR \
+  for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) { \
+    MultiplyTile(A, B + B0_colidx * width, A_rows, width, B_cols, 0, A_rows, B0_colidx, B0_colidx + 8, callback); \
+  } \
+} \
 
 //An int8_prepbias version of the above code, using the add 127 technique
 #define INTGEMM_PREPAREBIASFOR8(Register, target, cpu_type) \
@@ -291,18 +315,17 @@ template <typename Callback> target static void Multiply(const int16_t *A, const
 
 //An int8 version of the above code, using the add 127 technique
 #define INTGEMM_MULTIPLY8SHIFT(Register, target, cpu_type) \
-  template <class Callback> target static void Multiply8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) { \
+  template <class Callback> target static void Multiply8ShiftTile(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) { \
   assert(width % (sizeof(Register) / sizeof(int8_t)) == 0); \
-  assert(B_cols % 8 == 0); \
+  assert(B_colbegin % 8 == 0 && B_colend % 8 == 0); \
   assert(reinterpret_cast<uintptr_t>(A) % sizeof(Register) == 0); \
   assert(reinterpret_cast<uintptr_t>(B) % sizeof(Register) == 0); \
   const Index simd_width = width / (sizeof(Register) / sizeof(int8_t)); \
   auto callback_impl = callbacks::CallbackImpl<cpu_type, Callback>(callback); \
-  INTGEMM_OMP_FOR \
-  for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) { \
-    const Register *B0_col = reinterpret_cast<const Register *>(B) + simd_width * B0_colidx; \
+  for (Index B0_colidx = B_colbegin; B0_colidx < B_colend; B0_colidx += 8) { \
+    const Register *B0_col = reinterpret_cast<const Register *>(B) + simd_width * (B0_colidx - B_colbegin); \
     /* Process one row of A at a time.  Doesn't seem to be faster to do multiple rows of A at once.*/ \
-    for (Index A_rowidx = 0; A_rowidx < A_rows; ++A_rowidx) { \
+    for (Index A_rowidx = A_rowbegin; A_rowidx < A_rowend; ++A_rowidx) { \
       const Register *A_row = reinterpret_cast<const Register*>(A + A_rowidx * width); \
       /* These will be packed 16-bit integers containing sums for each row of B multiplied by the row of A. \
          Iterate over shared (inner) dimension.*/ \
@@ -366,6 +389,13 @@ template <typename Callback> target static void Multiply(const int16_t *A, const
     } \
   } \
 } \
+template <typename Callback> target static void Multiply8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) { \
+  assert(B_cols % 8 == 0); \
+  INTGEMM_OMP_FOR \
+  for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) { \
+    Multiply8ShiftTile(A, B + B0_colidx * width, A_rows, width, B_cols, 0, A_rows, B0_colidx, B0_colidx + 8, callback); \
+  } \
+} \
 
 /* 8-bit matrix multiply used by AVX and AVX2.
  * These have two peculiar properties:
@@ -538,18 +568,18 @@ INTGEMM_SSSE3 inline static void InnerINTGEMM_SSSE3(
 }
 //INTGEMM_AVX2 or INTGEMM_SSSE3 multiply
 #define INTGEMM_MULTIPLY8(Register, target, cpu_type) \
-  template <typename Callback> target static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) { \
+  template <typename Callback> target static void MultiplyTile(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) { \
   assert(width % sizeof(Register) == 0); \
-  assert(B_cols % 8 == 0); \
+  assert(B_colbegin % 8 == 0 && B_colend % 8 == 0); \
   assert(reinterpret_cast<uintptr_t>(A) % sizeof(Register) == 0); \
   assert(reinterpret_cast<uintptr_t>(B) % sizeof(Register) == 0); \
   const Index simd_width = width / sizeof(Register); \
   auto callback_impl = callbacks::CallbackImpl<cpu_type, Callback>(callback); \
-  INTGEMM_OMP_FOR \
-  for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) { \
-    const Register *B0_col = reinterpret_cast<const Register *>(B) + simd_width * B0_colidx; \
+  INTGEMM_TELEMETRY_ONLY(uint64_t saturated = 0;) \
+  for (Index B0_colidx = B_colbegin; B0_colidx < B_colend; B0_colidx += 8) { \
+    const Register *B0_col = reinterpret_cast<const Register *>(B) + simd_width * (B0_colidx - B_colbegin); \
     /*Process one row of A at a time.  Doesn't seem to be faster to do multiple rows of A at once.*/ \
-    for (Index A_rowidx = 0; A_rowidx < A_rows; ++A_rowidx) { \
+    for (Index A_rowidx = A_rowbegin; A_rowidx < A_rowend; ++A_rowidx) { \
       /*Iterate over shared (inner) dimension.*/ \
       const Register *A_live = reinterpret_cast<const Register *>(A + A_rowidx * width); \
       const Register *A_end = A_live + simd_width; \
@@ -571,6 +601,7 @@ INTGEMM_SSSE3 inline static void InnerINTGEMM_SSSE3(
       for (; A_live != A_end; ++A_live, B_live += 8) { \
         Inner##target(*A_live, B_live, sum0, sum1, sum2, sum3, sum4, sum5, sum6, sum7); \
       } \
+      INTGEMM_TELEMETRY_ONLY(saturated += CountRails16(sum0) + CountRails16(sum1) + CountRails16(sum2) + CountRails16(sum3) + CountRails16(sum4) + CountRails16(sum5) + CountRails16(sum6) + CountRails16(sum7);) \
       /* Convert 16-bit to 32-bit and add, not caring what parts are added.
        * Implementations:
        * 1. https://github.com/tesseract-ocr/tesseract/blob/master/src/arch/intsimdmatrixavx2.cpp#L67 under Apache license:
@@ -603,24 +634,56 @@ INTGEMM_SSSE3 inline static void InnerINTGEMM_SSSE3(
       RunCallback(callback_impl, total, A_rowidx, B0_colidx, A_rows, B_cols); \
     } \
   } \
+  INTGEMM_TELEMETRY_ONLY(telemetry::AddMultiply16(saturated);) \
+} \
+template <typename Callback> target static void Multiply(const int8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) { \
+  assert(B_cols % 8 == 0); \
+  INTGEMM_OMP_FOR \
+  for (Index B0_colidx = 0; B0_colidx < B_cols; B0_colidx += 8) { \
+    MultiplyTile(A, B + B0_colidx * width, A_rows, width, B_cols, 0, A_rows, B0_colidx, B0_colidx + 8, callback); \
+  } \
 }
 
-/* Wrap a multiply call in OMP parallelism.  Here it launches threads then
- * inside the implementation there is a pragma omp for.  In gcc >= 8 these
- * could have been the same but older compilers don't imbue target attributes
- * on the hidden function created by pragma omp parallel.
- * 
- * Also, gcc 7 is unable to deduce the function pointer type (for ChooseCPU) if
+/* Wrap a multiply call in ParallelFor.  Each piece of work is a range of
+ * 8-column blocks of B multiplied by all of A.  The cost model decides how
+ * many threads the shape is worth.
+ *
+ * The Panel versions multiply by columns [B_colbegin, B_colend) of B given
+ * only those columns' prepared data, B_panel, for callers that hold part of B
+ * at a time.  The callback still sees column indices within all of B.
+ *
+ * gcc 7 is unable to deduce the function pointer type (for ChooseCPU) if
  * I use typename Backend::Integer directly in the arguments.  As a workaround,
  * have a default template argument Integer then use that so it's resolved.
  */
-template <class Callback, class Backend, class Integer = typename Backend::Integer> static inline void OMPParallelWrap(const Integer *A, const Integer *B, Index A_rows, Index width, Index B_cols, Callback callback) {
-#pragma omp parallel
-  Backend::template Multiply<Callback>(A, B, A_rows, width, B_cols, callback);
+template <class Callback, class Backend, class Integer = typename Backend::Integer> static inline void PanelWrap(const Integer *A, const Integer *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) {
+  assert(B_colbegin % 8 == 0 && B_colend % 8 == 0);
+  ParallelFor(B_colbegin, B_colend, 8, MultiplyThreads(Backend::kUses, sizeof(Integer), A_rows, width, B_colend - B_colbegin), [=](std::size_t begin, std::size_t end) {
+    Backend::template MultiplyTile<Callback>(A, B_panel + (begin - B_colbegin) * width, A_rows, width, B_cols, 0, A_rows, static_cast<Index>(begin), static_cast<Index>(end), callback);
+  });
+}
+template <class Callback, class Backend> static inline void PanelWrap8Shift(const uint8_t *A, const int8_t *B_panel, Index A_rows, Index width, Index B_cols, Index B_colbegin, Index B_colend, Callback callback) {
+  assert(B_colbegin % 8 == 0 && B_colend % 8 == 0);
+  ParallelFor(B_colbegin, B_colend, 8, MultiplyThreads(Backend::kUses, 1, A_rows, width, B_colend - B_colbegin), [=](std::size_t begin, std::size_t end) {
+    Backend::template Multiply8ShiftTile<Callback>(A, B_panel + (begin - B_colbegin) * width, A_rows, width, B_cols, 0, A_rows, static_cast<Index>(begin), static_cast<Index>(end), callback);
+  });
+}
+
+template <class Callback, class Backend, class Integer = typename Backend::Integer> static inline void ParallelWrap(const Integer *A, const Integer *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+  PanelWrap<Callback, Backend, Integer>(A, B, A_rows, width, B_cols, 0, B_cols, callback);
+}
+template <class Callback, class Backend> static inline void ParallelWrap8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
+  PanelWrap8Shift<Callback, Backend>(A, B, A_rows, width, B_cols, 0, B_cols, callback);
+}
+
+/* A single tile of a multiply for MultiplyTasks, addressed by bounds within
+ * all of B rather than a pointer to the panel.
+ */
+template <class Callback, class Backend, class Integer = typename Backend::Integer> static inline void TileWrap(const Integer *A, const Integer *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) {
+  Backend::template MultiplyTile<Callback>(A, B + B_colbegin * width, A_rows, width, B_cols, A_rowbegin, A_rowend, B_colbegin, B_colend, callback);
 }
-template <class Callback, class Backend> static inline void OMPParallelWrap8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Callback callback) {
-#pragma omp parallel
-  Backend::template Multiply8Shift<Callback>(A, B, A_rows, width, B_cols, callback);
+template <class Callback, class Backend> static inline void TileWrap8Shift(const uint8_t *A, const int8_t *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback) {
+  Backend::template Multiply8ShiftTile<Callback>(A, B + B_colbegin * width, A_rows, width, B_cols, A_rowbegin, A_rowend, B_colbegin, B_colend, callback);
 }
 
 } // namespace intgemm
@@ -0,0 +1,344 @@
+#include "parallel.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <atomic>
+
+#ifdef INTGEMM_THREADPOOL
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <emmintrin.h>
+#endif
+
+namespace intgemm {
+
+#ifdef INTGEMM_THREADPOOL
+namespace {
+
+/* Persistent pool of worker threads.  The thread that calls Run is
+ * participant 0 and works alongside them.
+ *
+ * A call splits [begin, end) into one contiguous slice per participant, in
+ * multiples of grain, so each thread touches the same part of B on every call
+ * just as a static omp for would.  Slices are sized in proportion to the
+ * weight of the core each participant runs on, so on hybrid CPUs efficiency
+ * cores start with less of the matrix.  A participant claims its own slice a chunk
+ * at a time; when that runs out it steals chunks from the other slices, so a
+ * thread that was descheduled or is on a slower core does not hold up the
+ * call.  In sticky mode there is no stealing and each slice is one claim.
+ *
+ * Idle workers poll for the next job for options.spin iterations then sleep
+ * on a condition variable.  Run only takes the mutex if somebody is asleep.
+ */
+class ThreadPool {
+  public:
+    explicit ThreadPool(const ThreadPoolOptions &options)
+      : options_(options), job_(0), remaining_(0), sleepers_(0), stop_(false) {
+      busy_.clear();
+      const Topology &topology = GetTopology();
+      unsigned threads = options_.threads ? options_.threads : topology.Threads();
+      if (!threads) threads = 1;
+      // The job word holds the participant count in its low 16 bits.
+      if (threads > kMaxThreads) threads = kMaxThreads;
+      options_.threads = threads;
+      slices_.reset(new Slice[threads]);
+      // When pinned, worker i runs on cpus[i], leaving the fastest CPU to the
+      // caller.  Unpinned workers may run anywhere so they all weigh the same.
+      weights_.reset(new float[threads]);
+      for (unsigned i = 0; i < threads; ++i) {
+        weights_[i] = options_.pin ? topology.cpus[i % topology.cpus.size()].weight : 1.0f;
+      }
+      workers_.reserve(threads - 1);
+      for (unsigned i = 1; i < threads; ++i) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+      }
+    }
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_.store(true);
+      }
+      wake_.notify_all();
+      for (std::thread &worker : workers_) worker.join();
+    }
+
+    unsigned Threads() const { return options_.threads; }
+
+    const ThreadPoolOptions &Options() const { return options_; }
+
+    // Returns false without doing anything if the pool is already running a
+    // job, in which case the caller should do the work itself.
+    bool Run(std::size_t begin, std::size_t end, std::size_t grain, unsigned threads, ParallelBody body, void *closure) {
+      if (busy_.test_and_set(std::memory_order_acquire)) return false;
+      const std::size_t pieces = (end - begin + grain - 1) / grain;
+      // Reserve threads only now that the pool is ours, so a caller that ends
+      // up running alone never holds more than its own thread.  Sticky slices
+      // need the same participants every call: all of them or none.
+      if (options_.sticky) threads = Threads();
+      const ThreadBudget budget(static_cast<unsigned>(std::min<std::size_t>(pieces, std::min(threads, Threads()))), options_.sticky);
+      const unsigned participants = budget.Threads();
+      if (participants <= 1) {
+        busy_.clear(std::memory_order_release);
+        body(closure, begin, end);
+        return true;
+      }
+      // The caller isn't pinned so ask where it is now, unless the split has
+      // to be the same every time.
+      weights_[0] = options_.sticky ? GetTopology().cpus[0].weight : CurrentCPUWeight();
+      float total = 0.0f;
+      for (unsigned i = 0; i < participants; ++i) total += weights_[i];
+      float cumulative = 0.0f;
+      std::size_t piece_end = 0;
+      for (unsigned i = 0; i < participants; ++i) {
+        const std::size_t piece_begin = piece_end;
+        cumulative += weights_[i];
+        piece_end = (i + 1 == participants) ? pieces : std::min(pieces, static_cast<std::size_t>(static_cast<double>(pieces) * cumulative / total));
+        Slice &slice = slices_[i];
+        slice.next.store(begin + piece_begin * grain, std::memory_order_relaxed);
+        slice.end = std::min(end, begin + piece_end * grain);
+        if (options_.sticky) {
+          slice.claim = (piece_end - piece_begin) * grain;
+        } else {
+          // A few claims per slice so there is something left to steal.
+          slice.claim = std::max<std::size_t>(1, (piece_end - piece_begin) / kClaimsPerSlice) * grain;
+        }
+      }
+      body_ = body;
+      closure_ = closure;
+      participants_ = participants;
+      remaining_.store(participants - 1, std::memory_order_relaxed);
+      // Publish the job.  seq_cst pairs with the sleepers_ increment in WorkerLoop.
+      const uint64_t job = (((job_.load(std::memory_order_relaxed) >> 16) + 1) << 16) | participants;
+      job_.store(job, std::memory_order_seq_cst);
+      if (sleepers_.load(std::memory_order_seq_cst)) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        wake_.notify_all();
+      }
+      Work(0);
+      for (unsigned i = 0; remaining_.load(std::memory_order_acquire); ++i) {
+        if (i < options_.spin) {
+          _mm_pause();
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      busy_.clear(std::memory_order_release);
+      return true;
+    }
+
+  private:
+    static const unsigned kMaxThreads = 0xffff;
+    static const std::size_t kClaimsPerSlice = 8;
+
+    // Padded so different slices' cursors never share a cache line.
+    struct Slice {
+      std::atomic<std::size_t> next;
+      std::size_t end;
+      std::size_t claim;
+      char padding[128 - sizeof(std::atomic<std::size_t>) - 2 * sizeof(std::size_t)];
+    };
+
+    void Drain(Slice &slice) {
+      while (true) {
+        const std::size_t chunk = slice.next.fetch_add(slice.claim, std::memory_order_relaxed);
+        if (chunk >= slice.end) return;
+        body_(closure_, chunk, std::min(chunk + slice.claim, slice.end));
+      }
+    }
+
+    void Work(unsigned index) {
+      const unsigned slices = options_.sticky ? 1 : participants_;
+      for (unsigned i = 0; i < slices; ++i) {
+        Drain(slices_[(index + i) % participants_]);
+      }
+    }
+
+    void WorkerLoop(unsigned index) {
+      if (options_.pin) {
+        const Topology &topology = GetTopology();
+        PinCurrentThread(topology.cpus[index % topology.cpus.size()].id);
+      }
+      uint64_t seen = 0;
+      while (true) {
+        uint64_t job = job_.load(std::memory_order_acquire);
+        for (unsigned i = 0; job == seen && i < options_.spin; ++i) {
+          _mm_pause();
+          job = job_.load(std::memory_order_acquire);
+        }
+        if (job == seen) {
+          std::unique_lock<std::mutex> lock(mutex_);
+          sleepers_.fetch_add(1, std::memory_order_seq_cst);
+          while ((job = job_.load(std::memory_order_seq_cst)) == seen && !stop_.load()) {
+            wake_.wait(lock);
+          }
+          sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (stop_.load()) return;
+        seen = job;
+        // Only participants touch the job's fields; the caller waits for all
+        // of them before it writes the next job.
+        if (index < (job & 0xffff)) {
+          Work(index);
+          remaining_.fetch_sub(1, std::memory_order_release);
+        }
+      }
+    }
+
+    ThreadPoolOptions options_;
+    std::unique_ptr<Slice[]> slices_;
+    // Relative speed of each participant's core.  Entry 0, the caller, is
+    // refreshed by every Run.
+    std::unique_ptr<float[]> weights_;
+    std::vector<std::thread> workers_;
+
+    // Current job, valid while remaining_ > 0.
+    ParallelBody body_;
+    void *closure_;
+    unsigned participants_;
+
+    // Generation count << 16 | participants.
+    std::atomic<uint64_t> job_;
+    // Participants other than the caller that have not finished.
+    std::atomic<unsigned> remaining_;
+    std::atomic<unsigned> sleepers_;
+    std::atomic<bool> stop_;
+    std::atomic_flag busy_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+};
+
+std::mutex &PoolMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::atomic<ThreadPool*> &PoolPointer() {
+  static std::atomic<ThreadPool*> pool(nullptr);
+  return pool;
+}
+
+ThreadPoolOptions &PendingOptions() {
+  static ThreadPoolOptions options;
+  return options;
+}
+
+// Join the workers at exit.
+struct PoolReaper {
+  ~PoolReaper() {
+    delete PoolPointer().exchange(nullptr);
+  }
+};
+
+ThreadPool &Pool() {
+  ThreadPool *pool = PoolPointer().load(std::memory_order_acquire);
+  if (pool) return *pool;
+  std::lock_guard<std::mutex> lock(PoolMutex());
+  static PoolReaper reaper;
+  pool = PoolPointer().load(std::memory_order_relaxed);
+  if (!pool) {
+    pool = new ThreadPool(PendingOptions());
+    PoolPointer().store(pool, std::memory_order_release);
+  }
+  return *pool;
+}
+
+} // namespace
+
+void SetThreadPoolOptions(const ThreadPoolOptions &options) {
+  std::lock_guard<std::mutex> lock(PoolMutex());
+  PendingOptions() = options;
+  // The next call creates a pool with the new options.
+  delete PoolPointer().exchange(nullptr);
+}
+
+ThreadPoolOptions GetThreadPoolOptions() {
+  return Pool().Options();
+}
+
+void ThreadPoolFor(std::size_t begin, std::size_t end, std::size_t grain, unsigned threads, ParallelBody body, void *closure) {
+  if (!Pool().Run(begin, end, grain, threads, body, closure)) {
+    const ThreadBudget budget(1);
+    body(closure, begin, end);
+  }
+}
+
+unsigned MaxThreads() {
+  return Pool().Threads();
+}
+
+#elif defined(_OPENMP)
+
+// OMP_NUM_THREADS defaults to every CPU in the machine even when a cgroup
+// quota allows fewer.
+unsigned MaxThreads() {
+  return std::min(static_cast<unsigned>(omp_get_max_threads()), GetTopology().Threads());
+}
+
+#else
+
+unsigned MaxThreads() {
+  return 1;
+}
+
+#endif
+
+namespace {
+
+// 0 means MaxThreads().
+std::atomic<unsigned> &Limit() {
+  static std::atomic<unsigned> limit(0);
+  return limit;
+}
+
+// Threads currently reserved, including callers running alone.
+std::atomic<unsigned> &Active() {
+  static std::atomic<unsigned> active(0);
+  return active;
+}
+
+} // namespace
+
+void SetConcurrencyLimit(unsigned threads) {
+  Limit().store(threads, std::memory_order_relaxed);
+}
+
+unsigned GetConcurrencyLimit() {
+  const unsigned limit = Limit().load(std::memory_order_relaxed);
+  return limit ? limit : MaxThreads();
+}
+
+unsigned AcquireThreads(unsigned wanted) {
+  const unsigned limit = GetConcurrencyLimit();
+  std::atomic<unsigned> &active = Active();
+  unsigned current = active.load(std::memory_order_relaxed);
+  unsigned grant;
+  do {
+    const unsigned free = limit > current ? limit - current : 0;
+    grant = std::max(1u, std::min(wanted, free));
+  } while (!active.compare_exchange_weak(current, current + grant, std::memory_order_relaxed));
+  return grant;
+}
+
+unsigned AcquireAllThreads(unsigned wanted) {
+  const unsigned limit = GetConcurrencyLimit();
+  std::atomic<unsigned> &active = Active();
+  unsigned current = active.load(std::memory_order_relaxed);
+  unsigned grant;
+  do {
+    grant = (current < limit && limit - current >= wanted) ? std::max(1u, wanted) : 1;
+  } while (!active.compare_exchange_weak(current, current + grant, std::memory_order_relaxed));
+  return grant;
+}
+
+void ReleaseThreads(unsigned threads) {
+  Active().fetch_sub(threads, std::memory_order_relaxed);
+}
+
+} // namespace intgemm
@@ -0,0 +1,166 @@
+#pragma once
+/* Parallel loops over independent pieces of work.
+ *
+ * Every parallel region in intgemm goes through ParallelFor, which runs on
+ * one of:
+ *   - intgemm's own persistent thread pool when built with USE_THREADPOOL;
+ *   - OpenMP when built with USE_OPENMP;
+ *   - the calling thread otherwise.
+ *
+ * The body is called with half-open ranges [begin, end) whose boundaries are
+ * multiples of grain (relative to begin) except possibly the final end.  The
+ * body must not depend on how the range is split.
+ */
+
+#include "intgemm/intgemm_config.h"
+#include "profile.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace intgemm {
+
+#ifdef INTGEMM_THREADPOOL
+struct ThreadPoolOptions {
+  // Total number of threads, including the thread that calls intgemm.
+  // 0 means GetTopology().Threads(): the CPUs we may run on, capped by the
+  // cgroup CPU quota.
+  unsigned threads;
+  // Number of times an idle worker polls for work before it sleeps on a
+  // condition variable.  Polling makes back-to-back calls cheap at the cost
+  // of burning a core while idle.  0 sleeps immediately.
+  unsigned spin;
+  // Pin worker i to the i-th fastest CPU in GetTopology().  The calling
+  // thread is never pinned.  Off by default: every pool pins the same way,
+  // so two processes (or two libraries using intgemm) would stack their
+  // workers on the same cores.  Turn on when intgemm owns the machine.
+  bool pin;
+  // Weight-stationary scheduling for calls that reuse the same B.  Every
+  // call with the same range and thread count gives participant i the same
+  // contiguous slice and nobody steals, so each worker keeps reading the
+  // part of B already in its cache as long as it stays on one core; set pin
+  // as well.  The calling thread takes slice 0;
+  // pin it too (PinCurrentThread) for that slice to stay put.  Costs some
+  // balance if a core is busy with something else.  The split only repeats
+  // if the thread count does, so sticky calls ignore the count chosen by the
+  // cost model and take either all the pool's threads from the governor or
+  // run on the caller alone.
+  bool sticky;
+
+  ThreadPoolOptions() : threads(0), spin(1 << 16), pin(false), sticky(false) {}
+};
+
+// Replace the thread pool with one configured by options.  Do not call this
+// while other threads are inside intgemm.
+void SetThreadPoolOptions(const ThreadPoolOptions &options);
+ThreadPoolOptions GetThreadPoolOptions();
+
+typedef void (*ParallelBody)(void *closure, std::size_t begin, std::size_t end);
+
+// Type-erased entry to the pool, used by ParallelFor, on at most threads
+// threads.  If the pool is already busy (another thread is multiplying, or
+// this is a nested call) the whole range runs on the calling thread.  Either
+// way the threads used are reserved from the governor below.
+void ThreadPoolFor(std::size_t begin, std::size_t end, std::size_t grain, unsigned threads, ParallelBody body, void *closure);
+#endif
+
+// Maximum number of threads a parallel loop will use.
+unsigned MaxThreads();
+
+/* Process-wide governor.  When many threads call intgemm at once, each
+ * parallel region would otherwise start a full team and the machine ends up
+ * with callers * MaxThreads() threads.  Instead every parallel region
+ * reserves threads from a shared budget, counting the calling thread, and
+ * runs on the caller alone once the budget is exhausted.
+ *
+ * The limit defaults to MaxThreads().  0 restores the default.
+ */
+void SetConcurrencyLimit(unsigned threads);
+unsigned GetConcurrencyLimit();
+
+// Reserve up to wanted threads including the caller.  Always grants at least
+// 1 (the caller), even when that takes the total over the limit, so other
+// callers see the machine is busy.  Lock free.
+unsigned AcquireThreads(unsigned wanted);
+// Grants wanted if that many are free, otherwise just the caller.
+unsigned AcquireAllThreads(unsigned wanted);
+void ReleaseThreads(unsigned threads);
+
+// Holds threads from the budget for the lifetime of a parallel region.
+class ThreadBudget {
+  public:
+    // all: as AcquireAllThreads.
+    explicit ThreadBudget(unsigned wanted, bool all = false) : threads_(all ? AcquireAllThreads(wanted) : AcquireThreads(wanted)) {}
+    ~ThreadBudget() { ReleaseThreads(threads_); }
+    unsigned Threads() const { return threads_; }
+  private:
+    ThreadBudget(const ThreadBudget &) = delete;
+    ThreadBudget &operator=(const ThreadBudget &) = delete;
+    unsigned threads_;
+};
+
+// ParallelFor without the profiling and tracing hooks.
+template <class Function> inline void ParallelForRun(std::size_t begin, std::size_t end, std::size_t grain, unsigned max_threads, Function function) {
+#if defined(INTGEMM_THREADPOOL)
+  // The pool reserves threads from the budget once it knows it can use them.
+  struct Closure {
+    static void Call(void *closure, std::size_t piece_begin, std::size_t piece_end) {
+      (*static_cast<Function*>(closure))(piece_begin, piece_end);
+    }
+  };
+  ThreadPoolFor(begin, end, grain, max_threads, &Closure::Call, &function);
+#elif defined(_OPENMP)
+  const std::size_t pieces = (end - begin + grain - 1) / grain;
+  const unsigned wanted = static_cast<unsigned>(std::min<std::size_t>(pieces, std::min(max_threads, MaxThreads())));
+  // Taken even when wanted is 1 so the caller counts as busy.
+  const ThreadBudget budget(wanted);
+  if (budget.Threads() <= 1) {
+    function(begin, end);
+    return;
+  }
+  // Same split as a static omp for: one contiguous range per thread.
+#pragma omp parallel num_threads(budget.Threads())
+  {
+    const std::size_t thread = omp_get_thread_num(), team = omp_get_num_threads();
+    const std::size_t piece_begin = pieces * thread / team, piece_end = pieces * (thread + 1) / team;
+    if (piece_begin != piece_end) {
+      function(begin + piece_begin * grain, std::min(end, begin + piece_end * grain));
+    }
+  }
+#else
+  (void)grain;
+  (void)max_threads;
+  function(begin, end);
+#endif
+}
+
+template <class Function> inline void ParallelForProfiled(std::size_t begin, std::size_t end, std::size_t grain, unsigned max_threads, Function function) {
+#ifdef INTGEMM_PROFILE
+  if (ProfileScope *scope = profile::CurrentScope()) {
+    ParallelForRun(begin, end, grain, max_threads, profile::TimedBody<Function>(*scope, function));
+    return;
+  }
+#endif
+  ParallelForRun(begin, end, grain, max_threads, function);
+}
+
+// Use at most max_threads threads, for instance as chosen by cost_model.h.
+template <class Function> inline void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, unsigned max_threads, Function function) {
+  if (begin >= end) return;
+#ifdef INTGEMM_TRACE
+  ParallelForProfiled(begin, end, grain, max_threads, trace::TracedBody<Function>(function));
+#else
+  ParallelForProfiled(begin, end, grain, max_threads, function);
+#endif
+}
+
+template <class Function> inline void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, Function function) {
+  ParallelFor(begin, end, grain, MaxThreads(), function);
+}
+
+} // namespace intgemm
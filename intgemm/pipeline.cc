@@ -0,0 +1,93 @@
+#include "pipeline.h"
+
+namespace intgemm {
+
+Completion::Completion() : state_(std::make_shared<State>()) {
+  state_->done = true;
+}
+
+bool Completion::Done() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->done;
+}
+
+void Completion::Wait() const {
+  std::exception_ptr error = Finish();
+  if (error) std::rethrow_exception(error);
+}
+
+std::exception_ptr Completion::Finish() const {
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  state_->cond.wait(lock, [this] { return state_->done; });
+  return state_->error;
+}
+
+void Completion::Complete(std::exception_ptr error) const {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->done = true;
+    state_->error = error;
+  }
+  state_->cond.notify_all();
+}
+
+Pipeline::Pipeline() {
+  for (Queue &queue : queues_) {
+    queue.thread = std::thread(&Pipeline::StageLoop, this, std::ref(queue));
+  }
+}
+
+Pipeline::~Pipeline() {
+  // Queues drain before their threads exit.
+  for (Queue &queue : queues_) {
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.stop = true;
+    }
+    queue.cond.notify_all();
+  }
+  for (Queue &queue : queues_) queue.thread.join();
+}
+
+Completion Pipeline::Submit(Stage stage, std::function<void()> operation, const std::vector<Completion> &after) {
+  Operation op;
+  op.run = std::move(operation);
+  op.after = after;
+  op.completion.state_ = std::make_shared<Completion::State>();
+  const Completion ret = op.completion;
+  Queue &queue = queues_[static_cast<std::size_t>(stage)];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.operations.push_back(std::move(op));
+  }
+  queue.cond.notify_one();
+  return ret;
+}
+
+void Pipeline::StageLoop(Queue &queue) {
+  while (true) {
+    Operation op;
+    {
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      queue.cond.wait(lock, [&queue] { return queue.stop || !queue.operations.empty(); });
+      if (queue.operations.empty()) return;
+      op = std::move(queue.operations.front());
+      queue.operations.pop_front();
+    }
+    std::exception_ptr error;
+    for (const Completion &dependency : op.after) {
+      std::exception_ptr failed = dependency.Finish();
+      if (failed && !error) error = failed;
+    }
+    if (!error) {
+      try {
+        op.run();
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+    op.completion.Complete(error);
+  }
+}
+
+} // namespace intgemm
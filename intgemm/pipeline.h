@@ -0,0 +1,121 @@
+#pragma once
+/* Asynchronous submission so that preparing the next batch overlaps with
+ * multiplying the current one.
+ *
+ *   Pipeline pipeline;
+ *   Completion prepared[2], multiplied[2];
+ *   prepared[0] = pipeline.PrepareA<Int8>(input[0], A[0], quant_mult, rows, width);
+ *   for (std::size_t n = 0; n < batches; ++n) {
+ *     multiplied[n % 2] = pipeline.Multiply<Int8>(A[n % 2], B, rows, width, B_cols, callback[n], {prepared[n % 2]});
+ *     if (n + 1 < batches) {
+ *       // A[(n + 1) % 2] was last read by the multiply of batch n - 1.
+ *       prepared[(n + 1) % 2] = pipeline.PrepareA<Int8>(input[n + 1], A[(n + 1) % 2], quant_mult, rows, width, {multiplied[(n + 1) % 2]});
+ *     }
+ *     pipeline.Epilogue([n] { Emit(n); }, {multiplied[n % 2]});
+ *   }
+ *
+ * Each stage (prepare, multiply, epilogue) has its own thread that runs its
+ * operations in submission order, each once the completions it depends on
+ * are done.  Stages run concurrently, so PrepareA of batch n + 1 overlaps
+ * Multiply of batch n.  Their parallel regions share the concurrency limit
+ * in parallel.h and, with the thread pool, whichever stage gets there second
+ * runs on its own thread, so the stages never contend for the same threads.
+ *
+ * If an operation throws, its completion and every completion that depends
+ * on it hold the exception, which Wait rethrows.  Destroying the pipeline
+ * waits for everything submitted.
+ */
+
+#include "types.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace intgemm {
+
+// Handle to an operation submitted to a Pipeline.  Copies refer to the same
+// operation.  A default-constructed Completion is already done.
+class Completion {
+  public:
+    Completion();
+
+    bool Done() const;
+
+    // Block until the operation has run.  Rethrows its exception, if any.
+    void Wait() const;
+
+  private:
+    friend class Pipeline;
+
+    struct State {
+      std::mutex mutex;
+      std::condition_variable cond;
+      bool done;
+      std::exception_ptr error;
+      State() : done(false) {}
+    };
+
+    // Wait without rethrowing and return the exception, if any.
+    std::exception_ptr Finish() const;
+    void Complete(std::exception_ptr error) const;
+
+    std::shared_ptr<State> state_;
+};
+
+class Pipeline {
+  public:
+    enum class Stage { Prepare = 0, Multiply = 1, Epilogue = 2 };
+
+    Pipeline();
+    ~Pipeline();
+
+    // Run operation on stage's thread after every completion in after.
+    Completion Submit(Stage stage, std::function<void()> operation, const std::vector<Completion> &after = std::vector<Completion>());
+
+    template <class Routine> Completion PrepareA(const float *input, typename Routine::Integer *output, float quant_mult, Index rows, Index cols, const std::vector<Completion> &after = std::vector<Completion>()) {
+      return Submit(Stage::Prepare, [=] { Routine::PrepareA(input, output, quant_mult, rows, cols); }, after);
+    }
+
+    template <class Routine, class Callback> Completion Multiply(const typename Routine::Integer *A, const typename Routine::Integer *B, Index A_rows, Index width, Index B_cols, Callback callback, const std::vector<Completion> &after = std::vector<Completion>()) {
+      return Submit(Stage::Multiply, [=] { Routine::Multiply(A, B, A_rows, width, B_cols, callback); }, after);
+    }
+
+    // Anything that consumes the output, such as a softmax or writing it out.
+    Completion Epilogue(std::function<void()> operation, const std::vector<Completion> &after = std::vector<Completion>()) {
+      return Submit(Stage::Epilogue, std::move(operation), after);
+    }
+
+  private:
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    static const std::size_t kStages = 3;
+
+    struct Operation {
+      std::function<void()> run;
+      std::vector<Completion> after;
+      Completion completion;
+    };
+
+    struct Queue {
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::deque<Operation> operations;
+      bool stop;
+      std::thread thread;
+      Queue() : stop(false) {}
+    };
+
+    void StageLoop(Queue &queue);
+
+    Queue queues_[kStages];
+};
+
+} // namespace intgemm
@@ -0,0 +1,52 @@
+#include "plan.h"
+
+#include <fstream>
+
+namespace intgemm {
+
+bool PlanCache::Find(const std::string &key, PlanSettings &out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::string, PlanSettings>::const_iterator i = plans_.find(key);
+  if (i == plans_.end()) return false;
+  out = i->second;
+  return true;
+}
+
+void PlanCache::Insert(const std::string &key, const PlanSettings &settings) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  plans_[key] = settings;
+}
+
+std::size_t PlanCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return plans_.size();
+}
+
+// Each line is: key threads rows cols
+bool PlanCache::Load(const char *file) {
+  std::ifstream in(file);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty()) continue;
+    std::istringstream fields(line);
+    std::string key;
+    PlanSettings settings;
+    if (!(fields >> key >> settings.threads >> settings.shape.rows >> settings.shape.cols)) return false;
+    if (!settings.threads || settings.shape.cols % 8) return false;
+    Insert(key, settings);
+  }
+  return true;
+}
+
+bool PlanCache::Save(const char *file) const {
+  std::ofstream out(file);
+  if (!out) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::pair<const std::string, PlanSettings> &plan : plans_) {
+    out << plan.first << ' ' << plan.second.threads << ' ' << plan.second.shape.rows << ' ' << plan.second.shape.cols << '\n';
+  }
+  return static_cast<bool>(out.flush());
+}
+
+} // namespace intgemm
@@ -0,0 +1,203 @@
+#pragma once
+/* Tuned plans for repeated multiplies of one shape.
+ *
+ *   PlanCache cache;
+ *   cache.Load("intgemm.plans");
+ *   MultiplyPlan<Int8, callbacks::UnquantizeAndWrite> plan(A_rows, width, B_cols, callbacks::UnquantizeAndWrite(mult, C), &cache);
+ *   cache.Save("intgemm.plans");
+ *   ...
+ *   plan(A, B, callbacks::UnquantizeAndWrite(mult, C));
+ *   // Or, to warm the next layer's weights while this one runs:
+ *   plan(A, B, callbacks::UnquantizeAndWrite(mult, C), next_B, next_bytes);
+ *
+ * A plan fixes the thread count and the tile each task covers (TileShape).
+ * If the cache has no entry for the shape, the plan uses the thread count
+ * from the cost model and the default tile, like Multiply does.  With
+ * TuneOptions::tune it instead times candidates, see MultiplyPlan.  Running
+ * the plan makes no further decisions.
+ *
+ * Plans are keyed by routine and instruction set (Routine::kName), callback
+ * type, shape and MaxThreads(), so a cache file copied to different hardware
+ * or a build with a different compiler simply misses.
+ *
+ * The kernel itself is not a candidate: B is prepared in the layout of the
+ * dispatched instruction set so only that kernel can read it.  Nor is
+ * splitting the inner dimension across threads: callbacks see each output
+ * once with the complete sum.
+ */
+
+#include "aligned.h"
+#include "cost_model.h"
+#include "parallel.h"
+#include "prefetch.h"
+#include "tasks.h"
+#include "types.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace intgemm {
+
+struct PlanSettings {
+  unsigned threads;
+  TileShape shape;
+
+  PlanSettings() : threads(1) {}
+};
+
+// Thread-safe map from plan key to settings, saved as one line per plan.
+class PlanCache {
+  public:
+    bool Find(const std::string &key, PlanSettings &out) const;
+    void Insert(const std::string &key, const PlanSettings &settings);
+    std::size_t size() const;
+
+    // Merge plans from file.  Returns false if it could not be read or is
+    // malformed; plans read before the error are kept.
+    bool Load(const char *file);
+    // Returns false if file could not be written.
+    bool Save(const char *file) const;
+
+  private:
+    mutable std::mutex mutex_;
+    std::map<std::string, PlanSettings> plans_;
+};
+
+struct TuneOptions {
+  // Time candidates when the cache misses.  Otherwise use the default
+  // TileShape() on the cost model's thread count and leave the cache alone.
+  bool tune;
+  // Each candidate is run this many times and the fastest run counts.
+  unsigned tries;
+  // Stop starting candidates once tuning has taken this many seconds and keep
+  // the best so far.  At least the first candidate always runs.
+  double seconds;
+
+  TuneOptions() : tune(false), tries(3), seconds(0.5) {}
+};
+
+/* Tuning is opt-in because it is expensive: on a cache miss the constructor
+ * allocates scratch A and B of the full shape and runs real multiplies on
+ * them, each calling callback, which therefore writes to whatever output it
+ * points at.  The search is coarse: first thread counts around the cost
+ * model's choice with the default tile, then tile shapes at the fastest thread
+ * count, at most about 45 candidates times options.tries, and it stops early
+ * after options.seconds.  Tune once and keep the result in a PlanCache file.
+ */
+template <class Routine, class Callback> class MultiplyPlan {
+  public:
+    typedef typename Routine::Integer Integer;
+
+    // callback is only used when tuning, on outputs of shape A_rows x B_cols.
+    // cache may be nullptr.
+    MultiplyPlan(Index A_rows, Index width, Index B_cols, Callback callback, PlanCache *cache = nullptr, TuneOptions options = TuneOptions())
+      : A_rows_(A_rows), width_(width), B_cols_(B_cols) {
+      const std::string key = Key(A_rows, width, B_cols);
+      if (cache && cache->Find(key, settings_)) return;
+      settings_.threads = std::min(MultiplyThreads(Routine::kUses, sizeof(Integer), A_rows, width, B_cols), MaxThreads());
+      if (!options.tune) return;
+      Tune(callback, options);
+      if (cache) cache->Insert(key, settings_);
+    }
+
+    void operator()(const Integer *A, const Integer *B, Callback callback) const {
+      Run(A, B, callback, settings_, nullptr, 0);
+    }
+
+    // Also prefetch next_bytes of next (normally the next layer's prepared B)
+    // a share at a time after each tile.
+    void operator()(const Integer *A, const Integer *B, Callback callback, const void *next, std::size_t next_bytes) const {
+      Run(A, B, callback, settings_, next, next_bytes);
+    }
+
+    const PlanSettings &Settings() const { return settings_; }
+
+    static std::string Key(Index A_rows, Index width, Index B_cols) {
+      std::ostringstream key;
+      key << Routine::kName << '|' << typeid(Callback).name() << '|' << A_rows << 'x' << width << 'x' << B_cols << '|' << MaxThreads();
+      std::string ret = key.str();
+      // Keys are stored space-separated.
+      std::replace(ret.begin(), ret.end(), ' ', '_');
+      return ret;
+    }
+
+  private:
+    void Run(const Integer *A, const Integer *B, Callback callback, const PlanSettings &settings, const void *next, std::size_t next_bytes) const {
+      auto tasks = Routine::PlanMultiply(A, B, A_rows_, width_, B_cols_, callback, settings.shape);
+      const PrefetchStream prefetch(next, next_bytes, tasks.size());
+      // Tasks sharing columns of B are adjacent so contiguous ranges reuse B.
+      ParallelFor(0, tasks.size(), 1, settings.threads, [&tasks, &prefetch](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+          tasks(i);
+          if (!prefetch.empty()) prefetch.Step(i);
+        }
+      });
+    }
+
+    void Tune(Callback callback, const TuneOptions &options) {
+      // Contents don't affect speed, only the layout does.
+      AlignedVector<Integer> A(A_rows_ * width_), B(width_ * B_cols_);
+      for (std::size_t i = 0; i < A.size(); ++i) A[i] = static_cast<Integer>(i % 7) - 3;
+      for (std::size_t i = 0; i < B.size(); ++i) B[i] = static_cast<Integer>(i % 5) - 2;
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(options.seconds);
+      double best = -1.0;
+      bool started = false;
+      // Returns false once out of time.
+      auto consider = [&](const PlanSettings &candidate) {
+        if (started && std::chrono::steady_clock::now() > deadline) return false;
+        started = true;
+        double fastest = -1.0;
+        for (unsigned i = 0; i < std::max(1u, options.tries); ++i) {
+          const auto start = std::chrono::steady_clock::now();
+          Run(A.begin(), B.begin(), callback, candidate, nullptr, 0);
+          const double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          if (fastest < 0.0 || took < fastest) fastest = took;
+        }
+        if (best < 0.0 || fastest < best) {
+          best = fastest;
+          settings_ = candidate;
+        }
+        return true;
+      };
+
+      // Thread counts from the cost model's choice down by halves and up to
+      // twice it, with the default tile.
+      const unsigned model = settings_.threads;
+      std::vector<unsigned> threads(1, model);
+      for (unsigned t = model / 2; t >= 1; t /= 2) threads.push_back(t);
+      if (model < MaxThreads()) threads.push_back(std::min(2 * model, MaxThreads()));
+      for (unsigned t : threads) {
+        PlanSettings candidate;
+        candidate.threads = t;
+        if (!consider(candidate)) return;
+      }
+
+      // Tile shapes on the fastest thread count.
+      std::vector<Index> cols;
+      for (Index c = 8; c < B_cols_ && c <= 256; c *= 2) cols.push_back(c);
+      cols.push_back(B_cols_);
+      std::vector<Index> rows(1, 0);
+      for (Index r = 1; r < A_rows_ && r <= 64; r *= 4) rows.push_back(r);
+      const unsigned best_threads = settings_.threads;
+      for (Index c : cols) {
+        for (Index r : rows) {
+          PlanSettings candidate;
+          candidate.threads = best_threads;
+          candidate.shape = TileShape(r, c);
+          if (!consider(candidate)) return;
+        }
+      }
+    }
+
+    Index A_rows_, width_, B_cols_;
+    PlanSettings settings_;
+};
+
+} // namespace intgemm
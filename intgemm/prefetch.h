@@ -0,0 +1,59 @@
+#pragma once
+/* Warm the next matrix while this one is being multiplied.
+ *
+ * In a network, layer i + 1's prepared B is usually cold in the last level
+ * cache while layer i runs.  PrefetchB issues prefetcht2 for a range, which
+ * brings lines towards the outer caches without evicting the current
+ * kernel's working set from L1 and L2.  It is only a hint: nothing waits for
+ * the lines to arrive.
+ *
+ * Issuing the whole matrix at once would compete with the current multiply
+ * for memory bandwidth.  PrefetchStream spreads it over the steps of the
+ * current job instead, e.g. one share after each tile, so the prefetches
+ * trickle out at the pace of the compute.  MultiplyPlan does this when given
+ * the next B.  Usually only the first panels of the next B are worth
+ * prefetching: as much as fits in a share of the last level cache.
+ */
+
+#include <cstddef>
+
+#include <xmmintrin.h>
+
+namespace intgemm {
+
+const std::size_t kCacheLine = 64;
+
+inline void PrefetchB(const void *ptr, std::size_t bytes) {
+  const char *begin = static_cast<const char*>(ptr);
+  for (std::size_t offset = 0; offset < bytes; offset += kCacheLine) {
+    _mm_prefetch(begin + offset, _MM_HINT_T2);
+  }
+}
+
+// Divides [ptr, ptr + bytes) into steps shares of whole cache lines.
+class PrefetchStream {
+  public:
+    PrefetchStream() : begin_(nullptr), bytes_(0), steps_(1) {}
+
+    PrefetchStream(const void *ptr, std::size_t bytes, std::size_t steps)
+      : begin_(static_cast<const char*>(ptr)), bytes_(bytes), steps_(steps ? steps : 1) {}
+
+    bool empty() const { return !bytes_; }
+
+    // Prefetch share number step.  Distinct steps touch distinct lines so
+    // threads can call this for their own steps concurrently.
+    void Step(std::size_t step) const {
+      const std::size_t lines = (bytes_ + kCacheLine - 1) / kCacheLine;
+      const std::size_t first = lines * step / steps_, last = lines * (step + 1) / steps_;
+      for (std::size_t line = first; line < last; ++line) {
+        _mm_prefetch(begin_ + line * kCacheLine, _MM_HINT_T2);
+      }
+    }
+
+  private:
+    const char *begin_;
+    std::size_t bytes_;
+    std::size_t steps_;
+};
+
+} // namespace intgemm
@@ -0,0 +1,137 @@
+#include "profile.h"
+
+namespace intgemm {
+
+const char *OperationName(Operation operation) {
+  switch (operation) {
+    case Operation::Multiply: return "Multiply";
+    case Operation::PrepareA: return "PrepareA";
+    case Operation::PrepareB: return "PrepareB";
+    case Operation::Quantize: return "Quantize";
+    case Operation::MaxAbsolute: return "MaxAbsolute";
+    case Operation::SelectColumnsB: return "SelectColumnsB";
+  }
+  return "Unknown";
+}
+
+#ifdef INTGEMM_PROFILE
+
+namespace {
+
+const unsigned kOperations = static_cast<unsigned>(Operation::SelectColumnsB) + 1;
+const unsigned kBackends = static_cast<unsigned>(CPUType::AVX512VNNI) + 1;
+
+struct Cell {
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> nanoseconds;
+  std::atomic<uint64_t> operations;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> parallel_calls;
+  std::atomic<uint64_t> slowest_nanoseconds;
+  std::atomic<uint64_t> fastest_nanoseconds;
+};
+
+// Static storage is zero initialized.
+Cell gCells[kOperations][kBackends][profile::kBuckets];
+
+unsigned Bucket(uint64_t operations) {
+  unsigned bucket = 0;
+  while (operations >>= 1) ++bucket;
+  return bucket;
+}
+
+unsigned ThreadSlot() {
+  static std::atomic<unsigned> next(0);
+  thread_local const unsigned slot = next.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+} // namespace
+
+ProfileScope *&profile::CurrentScope() {
+  thread_local ProfileScope *current = nullptr;
+  return current;
+}
+
+ProfileScope::ProfileScope(Operation operation, CPUType backend, uint64_t operations, uint64_t bytes)
+  : active_(!profile::CurrentScope()), operation_(operation), backend_(backend), operations_(operations), bytes_(bytes),
+    begin_(active_ ? profile::Now() : 0) {
+  if (!active_) return;
+  for (std::atomic<uint64_t> &busy : busy_) busy.store(0, std::memory_order_relaxed);
+  profile::CurrentScope() = this;
+}
+
+ProfileScope::~ProfileScope() {
+  if (!active_) return;
+  const uint64_t elapsed = profile::Now() - begin_;
+  profile::CurrentScope() = nullptr;
+  Cell &cell = gCells[static_cast<unsigned>(operation_)][static_cast<unsigned>(backend_)][Bucket(operations_)];
+  cell.calls.fetch_add(1, std::memory_order_relaxed);
+  cell.nanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+  cell.operations.fetch_add(operations_, std::memory_order_relaxed);
+  cell.bytes.fetch_add(bytes_, std::memory_order_relaxed);
+
+  unsigned threads = 0;
+  uint64_t slowest = 0, fastest = UINT64_MAX;
+  for (const std::atomic<uint64_t> &slot : busy_) {
+    const uint64_t busy = slot.load(std::memory_order_relaxed);
+    if (!busy) continue;
+    ++threads;
+    if (busy > slowest) slowest = busy;
+    if (busy < fastest) fastest = busy;
+  }
+  if (threads < 2) return;
+  cell.parallel_calls.fetch_add(1, std::memory_order_relaxed);
+  cell.slowest_nanoseconds.fetch_add(slowest, std::memory_order_relaxed);
+  cell.fastest_nanoseconds.fetch_add(fastest, std::memory_order_relaxed);
+}
+
+void ProfileScope::AddBusy(uint64_t nanoseconds) {
+  // A range that took under a nanosecond still marks the thread as busy.
+  busy_[ThreadSlot() % kThreadSlots].fetch_add(nanoseconds ? nanoseconds : 1, std::memory_order_relaxed);
+}
+
+std::vector<ProfileRecord> GetProfile() {
+  std::vector<ProfileRecord> ret;
+  for (unsigned o = 0; o < kOperations; ++o) {
+    for (unsigned b = 0; b < kBackends; ++b) {
+      for (unsigned bucket = 0; bucket < profile::kBuckets; ++bucket) {
+        const Cell &cell = gCells[o][b][bucket];
+        ProfileRecord record;
+        record.calls = cell.calls.load(std::memory_order_relaxed);
+        if (!record.calls) continue;
+        record.operation = static_cast<Operation>(o);
+        record.backend = static_cast<CPUType>(b);
+        record.bucket = bucket;
+        record.nanoseconds = cell.nanoseconds.load(std::memory_order_relaxed);
+        record.operations = cell.operations.load(std::memory_order_relaxed);
+        record.bytes = cell.bytes.load(std::memory_order_relaxed);
+        record.parallel_calls = cell.parallel_calls.load(std::memory_order_relaxed);
+        record.slowest_nanoseconds = cell.slowest_nanoseconds.load(std::memory_order_relaxed);
+        record.fastest_nanoseconds = cell.fastest_nanoseconds.load(std::memory_order_relaxed);
+        ret.push_back(record);
+      }
+    }
+  }
+  return ret;
+}
+
+void ResetProfile() {
+  for (auto &by_backend : gCells) {
+    for (auto &by_bucket : by_backend) {
+      for (Cell &cell : by_bucket) {
+        cell.calls.store(0, std::memory_order_relaxed);
+        cell.nanoseconds.store(0, std::memory_order_relaxed);
+        cell.operations.store(0, std::memory_order_relaxed);
+        cell.bytes.store(0, std::memory_order_relaxed);
+        cell.parallel_calls.store(0, std::memory_order_relaxed);
+        cell.slowest_nanoseconds.store(0, std::memory_order_relaxed);
+        cell.fastest_nanoseconds.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+#endif
+
+} // namespace intgemm
@@ -0,0 +1,160 @@
+#pragma once
+/* Per-call profiling of the public entry points, to see where intgemm time
+ * goes in production.
+ *
+ * Build with -DUSE_PROFILE=ON.  Otherwise INTGEMM_PROFILE_ONLY expands to
+ * nothing and calls go straight to the kernels.
+ *
+ * When enabled, Multiply, PrepareA, PrepareB, Quantize, QuantizeU,
+ * SelectColumnsB and MaxAbsolute are timed with the steady clock.  Calls are
+ * aggregated by operation, backend (the CPUType of the kernels that ran) and
+ * shape bucket: floor(log2(operations)), where an operation is a multiply or
+ * an add for Multiply and one element otherwise.  Each cell counts calls,
+ * time, operations and bytes read plus written.  For calls whose parallel
+ * region ran on more than one thread it also sums the busy time of the
+ * slowest and of the fastest thread.
+ *
+ * Cells are relaxed atomics, so recording takes no lock.  A snapshot taken
+ * while other threads are calling intgemm may see a call's fields partially
+ * added.  Only the outermost entry point on a thread is recorded: PrepareA
+ * counts as PrepareA, not also as the Quantize it calls.
+ */
+
+#include "intgemm/intgemm_config.h"
+#include "types.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef INTGEMM_PROFILE
+#include <atomic>
+#include <vector>
+#endif
+
+namespace intgemm {
+
+enum class Operation : unsigned {
+  Multiply = 0,
+  PrepareA = 1,
+  PrepareB = 2,
+  Quantize = 3,
+  MaxAbsolute = 4,
+  SelectColumnsB = 5
+};
+
+const char *OperationName(Operation operation);
+
+namespace profile {
+// Nanoseconds on the steady clock, also used for trace.h timestamps.
+inline uint64_t Now() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+} // namespace profile
+
+#ifdef INTGEMM_PROFILE
+
+struct ProfileRecord {
+  Operation operation;
+  CPUType backend;
+  // Calls did between 2^bucket and 2^(bucket + 1) - 1 operations.
+  unsigned bucket;
+
+  uint64_t calls;
+  uint64_t nanoseconds;
+  uint64_t operations;
+  uint64_t bytes;
+
+  // Over the parallel_calls calls that ran on more than one thread, total
+  // busy time of each call's slowest and fastest thread.
+  uint64_t parallel_calls;
+  uint64_t slowest_nanoseconds;
+  uint64_t fastest_nanoseconds;
+
+  double GOPS() const { return nanoseconds ? static_cast<double>(operations) / nanoseconds : 0.0; }
+  double GBps() const { return nanoseconds ? static_cast<double>(bytes) / nanoseconds : 0.0; }
+  // Slowest thread's busy time over the fastest's, averaged over calls.
+  double Imbalance() const { return fastest_nanoseconds ? static_cast<double>(slowest_nanoseconds) / fastest_nanoseconds : 1.0; }
+};
+
+// Every cell with at least one call, ordered by operation, backend, bucket.
+std::vector<ProfileRecord> GetProfile();
+void ResetProfile();
+
+class ProfileScope;
+
+namespace profile {
+
+const unsigned kBuckets = 64;
+
+// The call being recorded on this thread, if any.  ParallelFor clears it
+// on the calling thread while running the body, so nested regions are not
+// timed twice.
+ProfileScope *&CurrentScope();
+
+// Operations and bytes of Multiply.
+inline uint64_t MultiplyOperations(Index A_rows, Index width, Index B_cols) {
+  return 2 * static_cast<uint64_t>(A_rows) * width * B_cols;
+}
+template <class Integer> inline uint64_t MultiplyBytes(Index A_rows, Index width, Index B_cols) {
+  return sizeof(Integer) * (static_cast<uint64_t>(A_rows) + B_cols) * width + sizeof(float) * static_cast<uint64_t>(A_rows) * B_cols;
+}
+
+// Wraps a ParallelFor body to add each range's time to the thread that ran it.
+template <class Function> class TimedBody {
+  public:
+    TimedBody(ProfileScope &scope, Function &function) : scope_(scope), function_(function) {}
+    void operator()(std::size_t begin, std::size_t end) const;
+  private:
+    ProfileScope &scope_;
+    Function &function_;
+};
+
+} // namespace profile
+
+// Records one call from construction to destruction.
+class ProfileScope {
+  public:
+    ProfileScope(Operation operation, CPUType backend, uint64_t operations, uint64_t bytes);
+    ~ProfileScope();
+
+    // Busy time of the calling thread on this call, from ParallelFor.
+    void AddBusy(uint64_t nanoseconds);
+
+  private:
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+    // Threads beyond this share slots, which blurs the imbalance figures.
+    static const unsigned kThreadSlots = 64;
+
+    const bool active_;
+    const Operation operation_;
+    const CPUType backend_;
+    const uint64_t operations_;
+    const uint64_t bytes_;
+    const uint64_t begin_;
+    std::atomic<uint64_t> busy_[kThreadSlots];
+};
+
+template <class Function> void profile::TimedBody<Function>::operator()(std::size_t begin, std::size_t end) const {
+  struct Suspend {
+    ProfileScope *&current;
+    ProfileScope *saved;
+    explicit Suspend(ProfileScope *&c) : current(c), saved(c) { current = nullptr; }
+    ~Suspend() { current = saved; }
+  } suspend(CurrentScope());
+  const uint64_t start = Now();
+  function_(begin, end);
+  scope_.AddBusy(Now() - start);
+}
+
+#define INTGEMM_PROFILE_ONLY(...) __VA_ARGS__
+
+#else
+
+#define INTGEMM_PROFILE_ONLY(...)
+
+#endif
+
+} // namespace intgemm
@@ -41,6 +41,14 @@ class QuantizeTile16 {
     }
 };
 
+// Same register layout as QuantizeTile16::ForReshape for already quantized input.
+class ReshapeTile16 {
+  public:
+    INTGEMM_SSE2 static inline Register ForReshape(const int16_t *input, Index) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+    }
+};
+
 // This should be pure SSE2 (and below).
 struct Kernels16 {
   typedef int16_t Integer;
@@ -55,10 +63,13 @@ struct Kernels16 {
     assert(reinterpret_cast<uintptr_t>(input) % 16 == 0);
     assert(reinterpret_cast<uintptr_t>(output) % 16 == 0);
     FRegister q = set1_ps<FRegister>(quant_mult);
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip16);)
     const float *end = input + size;
     for (; input != end; input += 8, output += 8) {
       *reinterpret_cast<__m128i*>(output) = QuantizeTile16::Consecutive(q, input);
+      INTGEMM_TELEMETRY_ONLY(clipped.Add8(input);)
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantize(clipped.Total());)
   }
 
   // Tile size for B; B must be a multiple of this block size.
@@ -66,6 +77,7 @@ struct Kernels16 {
   static const Index kBTileCol = 8;
 
   INTGEMM_PREPARE_B_16(INTGEMM_SSE2, QuantizeTile16)
+  INTGEMM_PREPARE_B_QUANTIZED_16(INTGEMM_SSE2, ReshapeTile16)
   INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(INTGEMM_SSE2, int16_t)
   INTGEMM_PREPARE_B_TRANSPOSED(INTGEMM_SSE2, QuantizeTile16, int16_t)
 
@@ -96,6 +96,17 @@ class QuantizeTile8 {
     }
 };
 
+// Same register layout as QuantizeTile8::ForReshape for already quantized input.
+class ReshapeTile8 {
+  public:
+    INTGEMM_SSSE3 static inline Register ForReshape(const int8_t *input, Index cols) {
+      // Skip a row.
+      return _mm_unpacklo_epi64(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input)),
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + 2 * cols)));
+    }
+};
+
 // pmaddubsw (the 8-bit multiply) is SSSE3, so pedantically that's the version we need.
 struct Kernels8 {
   typedef int8_t Integer;
@@ -121,10 +132,13 @@ struct Kernels8 {
     assert(reinterpret_cast<uintptr_t>(input) % 16 == 0);
     assert(reinterpret_cast<uintptr_t>(output) % 16 == 0);
     FRegister q = set1_ps<FRegister>(quant_mult);
+    INTGEMM_TELEMETRY_ONLY(ClipCounter clipped(quant_mult, telemetry::kClip8);)
     const float *end = input + size;
     for (; input != end; input += 16, output += 16) {
       *reinterpret_cast<__m128i*>(output) = QuantizeTile8::ConsecutiveU(q, input);
+      INTGEMM_TELEMETRY_ONLY(for (int j = 0; j < 16; j += 4) clipped.Add(input + j);)
     }
+    INTGEMM_TELEMETRY_ONLY(telemetry::AddQuantizeU(clipped.Total());)
   }
 
   // Tile size for B; B must be a multiple of this block size.
@@ -132,6 +146,7 @@ struct Kernels8 {
   static const Index kBTileCol = 8;
 
   INTGEMM_PREPARE_B_8(INTGEMM_SSSE3, SSSE3::QuantizeTile8)
+  INTGEMM_PREPARE_B_QUANTIZED_8(INTGEMM_SSSE3, SSSE3::ReshapeTile8)
   INTGEMM_PREPARE_B_QUANTIZED_TRANSPOSED(INTGEMM_SSSE3, int8_t)
   INTGEMM_PREPARE_B_TRANSPOSED(INTGEMM_SSSE3, QuantizeTile8, int8_t)
 
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <cstddef>
 #include "intrinsics.h"
-
-#ifdef _OPENMP
-#include <omp.h>
-#endif
+#include "parallel.h"
 
 namespace intgemm {
 
+/* Combine per-thread maxima of MaxAbsolute. */
+static inline void AtomicMax(std::atomic<float> &to, float value) {
+  float current = to.load(std::memory_order_relaxed);
+  while (current < value && !to.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
 /* Horizontal max and sums.  TODO make a template argument? */
 
 INTGEMM_SSE2 static inline float MaxFloat32(__m128 a) {
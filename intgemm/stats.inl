@@ -21,7 +21,6 @@ namespace INTGEMM_ARCH {
 INTGEMM_TARGET static inline float MaxAbsoluteThread(const FRegister *begin, const FRegister *end) {
   FRegister highest = setzero_ps<FRegister>();
   const FRegister abs_mask = cast_ps(set1_epi32<Register>(kFloatAbsoluteMask));
-#pragma omp for
   for (const FRegister *i = begin; i < end; ++i) {
     FRegister reg = and_ps(abs_mask, *i);
     highest = max_ps(highest, reg);
@@ -35,14 +34,14 @@ INTGEMM_TARGET static inline float MaxAbsoluteThread(const FRegister *begin, con
 INTGEMM_TARGET static inline float MaxAbsolute(const float *begin_float, const float *end_float) {
   assert(reinterpret_cast<uintptr_t>(begin_float) % sizeof(FRegister) == 0);
   const float *end_reg = end_float - (reinterpret_cast<uintptr_t>(end_float) % sizeof(FRegister)) / sizeof(float);
-  float ret = 0.0;
-#pragma omp parallel reduction(max:ret) num_threads(std::max<int>(1, std::min<int>(omp_get_max_threads(), (end_float - begin_float) / 16384)))
-  {
-    float shard_max = MaxAbsoluteThread(
-        reinterpret_cast<const FRegister*>(begin_float),
-        reinterpret_cast<const FRegister*>(end_reg));
-    ret = std::max(ret, shard_max);
-  }
+  const FRegister *begin_reg = reinterpret_cast<const FRegister*>(begin_float);
+  const std::size_t registers = reinterpret_cast<const FRegister*>(end_reg) - begin_reg;
+  std::atomic<float> shared_max(0.0f);
+  /* Give each thread at least 16384 floats. */
+  ParallelFor(0, registers, 16384 / (sizeof(FRegister) / sizeof(float)), [&](std::size_t begin, std::size_t end) {
+    AtomicMax(shared_max, MaxAbsoluteThread(begin_reg + begin, begin_reg + end));
+  });
+  float ret = shared_max.load();
   /* Overhang. The beginning was aligned so if there's any overhang we're
    * allowed to read the next full register.  Then mask that to 0. */
 #if defined(INTGEMM_THIS_IS_AVX512DQ)
@@ -0,0 +1,98 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace intgemm {
+
+PanelReader::PanelReader(const char *file, uint64_t offset, std::size_t bytes, std::size_t panel_bytes)
+  : offset_(offset), bytes_(bytes), panel_bytes_(panel_bytes),
+    panels_(panel_bytes ? (bytes + panel_bytes - 1) / panel_bytes : 0),
+    read_(0), released_(0), handed_(0), stop_(false) {
+  const std::size_t buffers = panels_ < 2 ? panels_ : 2;
+  for (std::size_t i = 0; i < buffers; ++i) buffers_[i] = AlignedVector<char>(panel_bytes);
+#ifdef _WIN32
+  fd_ = _open(file, _O_RDONLY | _O_BINARY);
+#else
+  fd_ = open(file, O_RDONLY);
+#endif
+  if (fd_ < 0) throw StreamError(std::string("Could not open ") + file + ": " + std::strerror(errno));
+#if defined(__linux__)
+  posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(bytes), POSIX_FADV_SEQUENTIAL);
+#endif
+  thread_ = std::thread(&PanelReader::ReadLoop, this);
+}
+
+PanelReader::~PanelReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+#ifdef _WIN32
+  _close(fd_);
+#else
+  close(fd_);
+#endif
+}
+
+const void *PanelReader::Next() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // The previous panel's buffer can be refilled.
+  released_ = handed_;
+  changed_.notify_all();
+  changed_.wait(lock, [this] { return read_ > handed_ || !error_.empty(); });
+  if (read_ <= handed_) throw StreamError(error_);
+  return buffers_[handed_++ % 2].begin();
+}
+
+bool PanelReader::ReadAt(char *to, std::size_t length, uint64_t from) {
+  while (length) {
+#ifdef _WIN32
+    if (_lseeki64(fd_, static_cast<__int64>(from), SEEK_SET) < 0) return false;
+    const int got = _read(fd_, to, static_cast<unsigned>(std::min<std::size_t>(length, 1 << 30)));
+#else
+    const ssize_t got = pread(fd_, to, length, static_cast<off_t>(from));
+#endif
+    if (got < 0 && errno == EINTR) continue;
+    if (got == 0) errno = 0;
+    if (got <= 0) return false;
+    to += got;
+    from += got;
+    length -= got;
+  }
+  return true;
+}
+
+void PanelReader::ReadLoop() {
+  for (std::size_t panel = 0; panel < panels_; ++panel) {
+    {
+      // Wait until the consumer is done with what was in this buffer.
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [this, panel] { return panel < released_ + 2 || stop_; });
+      if (stop_) return;
+    }
+    const std::size_t begin = panel * panel_bytes_;
+    const std::size_t length = std::min(panel_bytes_, bytes_ - begin);
+    const bool ok = ReadAt(buffers_[panel % 2].begin(), length, offset_ + begin);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ok) {
+      error_ = std::string("Reading B failed: ") + (errno ? std::strerror(errno) : "unexpected end of file");
+      changed_.notify_all();
+      return;
+    }
+    ++read_;
+    changed_.notify_all();
+  }
+}
+
+} // namespace intgemm
@@ -0,0 +1,101 @@
+#pragma once
+/* Multiply by a prepared B that lives in a file and need not fit in memory.
+ *
+ *   StreamMultiply<Int8>(A, "model.bin", offset, A_rows, width, B_cols, callback);
+ *
+ * The file holds B exactly as PrepareB wrote it, starting at byte offset.
+ * Prepared B is stored in blocks of 8 columns so any run of whole blocks is
+ * contiguous.  B is read a panel of columns at a time by a helper thread into
+ * one of two aligned buffers while the other is being multiplied, so reading
+ * overlaps with compute and memory use is two panels.  The callback sees the
+ * same column indices as Multiply over the whole of B.
+ */
+
+#include "aligned.h"
+#include "types.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace intgemm {
+
+// Reading the file failed.
+class StreamError : public std::exception {
+  public:
+    explicit StreamError(const std::string &message) : message_(message) {}
+    ~StreamError() throw() {}
+    const char *what() const throw() override { return message_.c_str(); }
+  private:
+    std::string message_;
+};
+
+/* Reads [offset, offset + bytes) of a file in consecutive panels of
+ * panel_bytes (the last may be shorter) on a helper thread, at most two ahead
+ * of the consumer.
+ */
+class PanelReader {
+  public:
+    // Throws StreamError if file can't be opened.
+    PanelReader(const char *file, uint64_t offset, std::size_t bytes, std::size_t panel_bytes);
+    ~PanelReader();
+
+    std::size_t Panels() const { return panels_; }
+
+    // Wait for the next panel and return it.  It remains valid until the
+    // following call.  Throws StreamError if reading failed.
+    const void *Next();
+
+  private:
+    PanelReader(const PanelReader &) = delete;
+    PanelReader &operator=(const PanelReader &) = delete;
+
+    void ReadLoop();
+    bool ReadAt(char *to, std::size_t length, uint64_t from);
+
+    int fd_;
+    const uint64_t offset_;
+    const std::size_t bytes_, panel_bytes_, panels_;
+    AlignedVector<char> buffers_[2];
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    // Panels fully read.
+    std::size_t read_;
+    // Panels the consumer has finished with.
+    std::size_t released_;
+    // Panels handed to the consumer.
+    std::size_t handed_;
+    bool stop_;
+    std::string error_;
+
+    std::thread thread_;
+};
+
+// Default panel: about this many bytes of B, rounded to 8-column blocks.
+const std::size_t kStreamPanelBytes = 16 << 20;
+
+/* Multiply A by the prepared B stored in file at offset, panel_cols columns
+ * at a time (a multiple of 8; 0 picks a panel of about kStreamPanelBytes).
+ * Routine is Int8, Int8Shift or Int16.  Throws StreamError on I/O failure.
+ */
+template <class Routine, class Callback> void StreamMultiply(const typename Routine::Integer *A, const char *file, uint64_t offset, Index A_rows, Index width, Index B_cols, Callback callback, Index panel_cols = 0) {
+  typedef typename Routine::Integer Integer;
+  const std::size_t column_bytes = static_cast<std::size_t>(width) * sizeof(Integer);
+  if (!panel_cols) {
+    panel_cols = static_cast<Index>(kStreamPanelBytes / column_bytes) / 8 * 8;
+    if (panel_cols < 8) panel_cols = 8;
+  }
+  if (panel_cols > B_cols) panel_cols = B_cols;
+  PanelReader reader(file, offset, column_bytes * B_cols, column_bytes * panel_cols);
+  for (Index begin = 0; begin < B_cols; begin += panel_cols) {
+    const Index end = (B_cols - begin < panel_cols) ? B_cols : begin + panel_cols;
+    const Integer *panel = static_cast<const Integer*>(reader.Next());
+    Routine::MultiplyPanel(A, panel, A_rows, width, B_cols, begin, end, callback);
+  }
+}
+
+} // namespace intgemm
@@ -0,0 +1,55 @@
+#include "tasks.h"
+#include "topology.h"
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+unsigned ResolveThreads(unsigned threads) {
+  if (threads) return threads;
+  return GetTopology().Threads();
+}
+
+void Drain(std::atomic<std::size_t> &next, std::size_t count, const std::function<void (std::size_t)> &task) {
+  for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+    task(i);
+  }
+}
+
+} // namespace
+
+Executor::~Executor() {}
+
+AsyncExecutor::AsyncExecutor(unsigned threads) : threads_(ResolveThreads(threads)) {}
+
+void AsyncExecutor::Run(std::size_t count, const std::function<void (std::size_t)> &task) {
+  std::atomic<std::size_t> next(0);
+  const std::size_t helpers = std::min<std::size_t>(threads_, count) - (count ? 1 : 0);
+  std::vector<std::future<void>> futures;
+  futures.reserve(helpers);
+  for (std::size_t i = 0; i < helpers; ++i) {
+    futures.push_back(std::async(std::launch::async, [&next, count, &task] { Drain(next, count, task); }));
+  }
+  Drain(next, count, task);
+  for (std::future<void> &f : futures) f.get();
+}
+
+ThreadExecutor::ThreadExecutor(unsigned threads) : threads_(ResolveThreads(threads)) {}
+
+void ThreadExecutor::Run(std::size_t count, const std::function<void (std::size_t)> &task) {
+  std::atomic<std::size_t> next(0);
+  const std::size_t helpers = std::min<std::size_t>(threads_, count) - (count ? 1 : 0);
+  std::vector<std::thread> threads;
+  threads.reserve(helpers);
+  for (std::size_t i = 0; i < helpers; ++i) {
+    threads.emplace_back([&next, count, &task] { Drain(next, count, task); });
+  }
+  Drain(next, count, task);
+  for (std::thread &t : threads) t.join();
+}
+
+} // namespace intgemm
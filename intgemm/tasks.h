@@ -0,0 +1,131 @@
+#pragma once
+/* Describe a Multiply as independent tile tasks so that a host with its own
+ * scheduler can run, interleave and prioritise them instead of blocking in
+ * intgemm's parallel regions.
+ *
+ *   auto tasks = Int8::PlanMultiply(A, B, A_rows, width, B_cols, callback);
+ *   for (std::size_t i = 0; i < tasks.size(); ++i) {
+ *     host_scheduler.Submit([&tasks, i] { tasks(i); });
+ *   }
+ *
+ * Tasks write disjoint parts of C so they may run in any order on any thread.
+ * The plan holds pointers to A and B (and whatever the callback points to),
+ * which must stay valid until every task has run.
+ *
+ * Alternatively pass an Executor to Multiply to run the tasks and wait.
+ * AsyncExecutor and ThreadExecutor are reference executors built on
+ * std::async and std::thread.
+ */
+
+#include "topology.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+
+namespace intgemm {
+
+// How big each task is.  0 picks automatically.
+struct TileShape {
+  // Rows of A per task.  0 means all rows.
+  Index rows;
+  // Columns of B per task, a multiple of 8.  0 makes about 4 tasks per
+  // hardware thread.
+  Index cols;
+
+  explicit TileShape(Index rows_in = 0, Index cols_in = 0) : rows(rows_in), cols(cols_in) {}
+};
+
+// The part of C a task computes: rows [A_rowbegin, A_rowend) and columns
+// [B_colbegin, B_colend).
+struct TileBounds {
+  Index A_rowbegin, A_rowend;
+  Index B_colbegin, B_colend;
+};
+
+// Runs tasks 0 through count - 1 and returns once all of them have finished.
+class Executor {
+  public:
+    virtual ~Executor();
+    virtual void Run(std::size_t count, const std::function<void (std::size_t)> &task) = 0;
+};
+
+// Launches threads - 1 std::async tasks and works on the calling thread too.
+// Each takes the next task index from a shared counter.  0 threads means
+// GetTopology().Threads().
+class AsyncExecutor : public Executor {
+  public:
+    explicit AsyncExecutor(unsigned threads = 0);
+    void Run(std::size_t count, const std::function<void (std::size_t)> &task) override;
+  private:
+    unsigned threads_;
+};
+
+// The same with plain std::threads that are joined at the end of each Run.
+class ThreadExecutor : public Executor {
+  public:
+    explicit ThreadExecutor(unsigned threads = 0);
+    void Run(std::size_t count, const std::function<void (std::size_t)> &task) override;
+  private:
+    unsigned threads_;
+};
+
+template <class AInteger, class BInteger, class Callback> class MultiplyTasks {
+  public:
+    typedef void (*TileFunction)(const AInteger *A, const BInteger *B, Index A_rows, Index width, Index B_cols, Index A_rowbegin, Index A_rowend, Index B_colbegin, Index B_colend, Callback callback);
+
+    MultiplyTasks(TileFunction tile, const AInteger *A, const BInteger *B, Index A_rows, Index width, Index B_cols, Callback callback, TileShape shape)
+      : tile_(tile), A_(A), B_(B), A_rows_(A_rows), width_(width), B_cols_(B_cols), callback_(callback) {
+      assert(B_cols % 8 == 0);
+      assert(shape.cols % 8 == 0);
+      rows_ = shape.rows ? shape.rows : std::max<Index>(A_rows, 1);
+      if (shape.cols) {
+        cols_ = shape.cols;
+      } else {
+        const Index target = static_cast<Index>(GetTopology().Threads()) * 4;
+        cols_ = std::max<Index>(8, B_cols / 8 / target * 8);
+      }
+      row_blocks_ = (A_rows + rows_ - 1) / rows_;
+      col_blocks_ = (B_cols + cols_ - 1) / cols_;
+    }
+
+    std::size_t size() const { return static_cast<std::size_t>(row_blocks_) * col_blocks_; }
+
+    // Tasks that share columns of B are adjacent.
+    TileBounds Bounds(std::size_t task) const {
+      const Index col_block = static_cast<Index>(task / row_blocks_);
+      const Index row_block = static_cast<Index>(task % row_blocks_);
+      TileBounds ret;
+      ret.A_rowbegin = row_block * rows_;
+      ret.A_rowend = std::min(A_rows_, ret.A_rowbegin + rows_);
+      ret.B_colbegin = col_block * cols_;
+      ret.B_colend = std::min(B_cols_, ret.B_colbegin + cols_);
+      return ret;
+    }
+
+    // Run one task.  Safe to call concurrently for different tasks.
+    void operator()(std::size_t task) const {
+      assert(task < size());
+      const TileBounds b = Bounds(task);
+      tile_(A_, B_, A_rows_, width_, B_cols_, b.A_rowbegin, b.A_rowend, b.B_colbegin, b.B_colend, callback_);
+    }
+
+    // Run all tasks on executor and wait for them.
+    void Run(Executor &executor) const {
+      const MultiplyTasks *self = this;
+      executor.Run(size(), [self](std::size_t task) { (*self)(task); });
+    }
+
+  private:
+    TileFunction tile_;
+    const AInteger *A_;
+    const BInteger *B_;
+    Index A_rows_, width_, B_cols_;
+    Callback callback_;
+    Index rows_, cols_;
+    Index row_blocks_, col_blocks_;
+};
+
+} // namespace intgemm
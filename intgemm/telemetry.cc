@@ -0,0 +1,57 @@
+#include "telemetry.h"
+
+#ifdef INTGEMM_TELEMETRY
+
+#include <atomic>
+
+namespace intgemm {
+namespace {
+
+struct Counters {
+  std::atomic<uint64_t> quantize;
+  std::atomic<uint64_t> quantize_u;
+  std::atomic<uint64_t> prepare_b;
+  std::atomic<uint64_t> multiply16;
+
+  Counters() : quantize(0), quantize_u(0), prepare_b(0), multiply16(0) {}
+};
+
+Counters &Global() {
+  static Counters counters;
+  return counters;
+}
+
+void Add(std::atomic<uint64_t> &counter, uint64_t count) {
+  if (count) counter.fetch_add(count, std::memory_order_relaxed);
+}
+
+} // namespace
+
+SaturationCounts GetSaturationCounts() {
+  const Counters &c = Global();
+  SaturationCounts ret;
+  ret.quantize = c.quantize.load(std::memory_order_relaxed);
+  ret.quantize_u = c.quantize_u.load(std::memory_order_relaxed);
+  ret.prepare_b = c.prepare_b.load(std::memory_order_relaxed);
+  ret.multiply16 = c.multiply16.load(std::memory_order_relaxed);
+  return ret;
+}
+
+void ResetSaturationCounts() {
+  Counters &c = Global();
+  c.quantize.store(0, std::memory_order_relaxed);
+  c.quantize_u.store(0, std::memory_order_relaxed);
+  c.prepare_b.store(0, std::memory_order_relaxed);
+  c.multiply16.store(0, std::memory_order_relaxed);
+}
+
+namespace telemetry {
+void AddQuantize(uint64_t count) { Add(Global().quantize, count); }
+void AddQuantizeU(uint64_t count) { Add(Global().quantize_u, count); }
+void AddPrepareB(uint64_t count) { Add(Global().prepare_b, count); }
+void AddMultiply16(uint64_t count) { Add(Global().multiply16, count); }
+} // namespace telemetry
+
+} // namespace intgemm
+
+#endif
@@ -0,0 +1,224 @@
+#pragma once
+/* Saturation counters, to see in production whether quant_mult clips.
+ *
+ * Build with -DUSE_TELEMETRY=ON.  Otherwise INTGEMM_TELEMETRY_ONLY expands to
+ * nothing and none of this is compiled into the kernels.
+ *
+ * When enabled:
+ *   - Quantize (8 and 16-bit), QuantizeU and PrepareB count input elements
+ *     whose scaled value rounds outside the integer range, i.e. that were
+ *     clipped.  The compares run inside the quantize loops on input they
+ *     just loaded and counts are flushed once per thread's range.
+ *   - The 8-bit Multiply kernels that sum in 16 bits with saturating adds
+ *     (SSSE3, AVX2 and AVX512BW; not VNNI, which sums in 32 bits) count
+ *     16-bit sums that finished at the int16 limit.  Counts are kept in a
+ *     register and flushed once per tile.
+ * Counts are process-wide and accumulate until reset.
+ */
+
+#include "intgemm/intgemm_config.h"
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef INTGEMM_TELEMETRY
+#include <bitset>
+#include <cstring>
+#include <immintrin.h>
+#endif
+
+namespace intgemm {
+
+struct SaturationCounts {
+  // Elements clipped by Quantize (either width) and QuantizeU.
+  uint64_t quantize;
+  uint64_t quantize_u;
+  // Elements clipped by PrepareB (either width).
+  uint64_t prepare_b;
+  // 16-bit sums in 8-bit Multiply that ended saturated.
+  uint64_t multiply16;
+};
+
+#ifdef INTGEMM_TELEMETRY
+
+SaturationCounts GetSaturationCounts();
+void ResetSaturationCounts();
+
+namespace telemetry {
+void AddQuantize(uint64_t count);
+void AddQuantizeU(uint64_t count);
+void AddPrepareB(uint64_t count);
+void AddMultiply16(uint64_t count);
+
+// Rounded values outside [lower, upper] were clipped.  8-bit quantizers clip
+// to [-127, 127]; 16-bit ones saturate to the int16 range, so -32768 is kept.
+struct ClipRange {
+  int32_t lower;
+  int32_t upper;
+};
+const ClipRange kClip8 = {-127, 127};
+const ClipRange kClip16 = {-32768, 32767};
+
+static inline unsigned PopCount(unsigned bits) {
+  return static_cast<unsigned>(std::bitset<32>(bits).count());
+}
+} // namespace telemetry
+
+#define INTGEMM_TELEMETRY_ONLY(...) __VA_ARGS__
+
+/* Per instruction set: ClipCounter is used inside the quantize loops.  Add
+ * takes the floats the quantizer just loaded, rounds them the same way
+ * (cvtps, which turns overflow into INT32_MIN) and counts lanes outside the
+ * range in a register; Total is read once per range of work.  CountRails16(sum)
+ * counts 16-bit lanes equal to INT16_MAX or INT16_MIN.
+ */
+namespace SSE2 {
+class ClipCounter {
+  public:
+    INTGEMM_SSE2 ClipCounter(float quant_mult, telemetry::ClipRange range)
+      : mult_(_mm_set1_ps(quant_mult)), lower_(_mm_set1_epi32(range.lower)), upper_(_mm_set1_epi32(range.upper)), count_(_mm_setzero_si128()) {}
+
+    // One register of floats.
+    INTGEMM_SSE2 void Add(const float *input) {
+      const __m128i rounded = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(input), mult_));
+      // Compares give -1 per clipped lane.
+      count_ = _mm_sub_epi32(count_, _mm_or_si128(_mm_cmplt_epi32(rounded, lower_), _mm_cmpgt_epi32(rounded, upper_)));
+    }
+
+    // 8 consecutive floats: one row of a PrepareB column block.
+    INTGEMM_SSE2 void Add8(const float *input) {
+      Add(input);
+      Add(input + 4);
+    }
+
+    // Any count, for overhangs.  Padding is 0, which is never clipped.
+    INTGEMM_SSE2 void AddRange(const float *input, std::size_t count) {
+      std::size_t i = 0;
+      for (; i + 4 <= count; i += 4) Add(input + i);
+      if (i == count) return;
+      float padded[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      std::memcpy(padded, input + i, (count - i) * sizeof(float));
+      Add(padded);
+    }
+
+    INTGEMM_SSE2 uint64_t Total() const {
+      uint32_t lanes[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), count_);
+      return static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+
+  private:
+    __m128 mult_;
+    __m128i lower_, upper_;
+    __m128i count_;
+};
+
+INTGEMM_SSE2 static inline unsigned CountRails16(__m128i sum) {
+  const __m128i rails = _mm_or_si128(_mm_cmpeq_epi16(sum, _mm_set1_epi16(32767)), _mm_cmpeq_epi16(sum, _mm_set1_epi16(-32768)));
+  return telemetry::PopCount(_mm_movemask_epi8(rails)) / 2;
+}
+} // namespace SSE2
+
+namespace SSSE3 {
+using SSE2::ClipCounter;
+using SSE2::CountRails16;
+} // namespace SSSE3
+
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+namespace AVX2 {
+class ClipCounter {
+  public:
+    INTGEMM_AVX2 ClipCounter(float quant_mult, telemetry::ClipRange range)
+      : mult_(_mm256_set1_ps(quant_mult)), lower_(_mm256_set1_epi32(range.lower)), upper_(_mm256_set1_epi32(range.upper)), count_(_mm256_setzero_si256()) {}
+
+    INTGEMM_AVX2 void Add(const float *input) {
+      const __m256i rounded = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(input), mult_));
+      // AVX2 has no cmplt_epi32, so swap the operands of cmpgt.
+      count_ = _mm256_sub_epi32(count_, _mm256_or_si256(_mm256_cmpgt_epi32(lower_, rounded), _mm256_cmpgt_epi32(rounded, upper_)));
+    }
+
+    INTGEMM_AVX2 void Add8(const float *input) {
+      Add(input);
+    }
+
+    INTGEMM_AVX2 void AddRange(const float *input, std::size_t count) {
+      std::size_t i = 0;
+      for (; i + 8 <= count; i += 8) Add(input + i);
+      if (i == count) return;
+      float padded[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+      std::memcpy(padded, input + i, (count - i) * sizeof(float));
+      Add(padded);
+    }
+
+    INTGEMM_AVX2 uint64_t Total() const {
+      uint32_t lanes[8];
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), count_);
+      uint64_t total = 0;
+      for (uint32_t lane : lanes) total += lane;
+      return total;
+    }
+
+  private:
+    __m256 mult_;
+    __m256i lower_, upper_;
+    __m256i count_;
+};
+
+INTGEMM_AVX2 static inline unsigned CountRails16(__m256i sum) {
+  const __m256i rails = _mm256_or_si256(_mm256_cmpeq_epi16(sum, _mm256_set1_epi16(32767)), _mm256_cmpeq_epi16(sum, _mm256_set1_epi16(-32768)));
+  return telemetry::PopCount(static_cast<unsigned>(_mm256_movemask_epi8(rails))) / 2;
+}
+} // namespace AVX2
+#endif
+
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+namespace AVX512BW {
+// Masks make the counts scalar already.
+class ClipCounter {
+  public:
+    INTGEMM_AVX512BW ClipCounter(float quant_mult, telemetry::ClipRange range)
+      : mult_(_mm512_set1_ps(quant_mult)), lower_(_mm512_set1_epi32(range.lower)), upper_(_mm512_set1_epi32(range.upper)), count_(0) {}
+
+    INTGEMM_AVX512BW void Add(const float *input) {
+      Count(_mm512_loadu_ps(input));
+    }
+
+    INTGEMM_AVX512BW void Add8(const float *input) {
+      Count(_mm512_maskz_loadu_ps(0xff, input));
+    }
+
+    INTGEMM_AVX512BW void AddRange(const float *input, std::size_t count) {
+      std::size_t i = 0;
+      for (; i + 16 <= count; i += 16) Add(input + i);
+      if (i == count) return;
+      Count(_mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << (count - i)) - 1), input + i));
+    }
+
+    INTGEMM_AVX512BW uint64_t Total() const { return count_; }
+
+  private:
+    INTGEMM_AVX512BW void Count(__m512 input) {
+      const __m512i rounded = _mm512_cvtps_epi32(_mm512_mul_ps(input, mult_));
+      count_ += telemetry::PopCount(_mm512_cmplt_epi32_mask(rounded, lower_) | _mm512_cmpgt_epi32_mask(rounded, upper_));
+    }
+
+    __m512 mult_;
+    __m512i lower_, upper_;
+    uint64_t count_;
+};
+
+INTGEMM_AVX512BW static inline unsigned CountRails16(__m512i sum) {
+  const __mmask32 rails = _mm512_cmpeq_epi16_mask(sum, _mm512_set1_epi16(32767)) | _mm512_cmpeq_epi16_mask(sum, _mm512_set1_epi16(-32768));
+  return telemetry::PopCount(rails);
+}
+} // namespace AVX512BW
+#endif
+
+#else
+
+#define INTGEMM_TELEMETRY_ONLY(...)
+
+#endif
+
+} // namespace intgemm
@@ -0,0 +1,317 @@
+#if defined(WASM)
+// No CPUID.
+#elif defined(__INTEL_COMPILER)
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "topology.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace intgemm {
+
+namespace topology {
+
+bool ParseCPUList(const std::string &list, std::vector<int> &out) {
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    // Trailing newline from sysfs.
+    range.erase(std::remove_if(range.begin(), range.end(), [](char c) { return c == '\n' || c == ' '; }), range.end());
+    if (range.empty()) continue;
+    char *end;
+    long first = std::strtol(range.c_str(), &end, 10);
+    if (end == range.c_str() || first < 0) return false;
+    long last = first;
+    if (*end == '-') {
+      const char *second = end + 1;
+      last = std::strtol(second, &end, 10);
+      if (end == second || last < first) return false;
+    }
+    if (*end) return false;
+    for (long i = first; i <= last; ++i) out.push_back(static_cast<int>(i));
+  }
+  return true;
+}
+
+std::size_t ParseCacheSize(const std::string &size) {
+  char *end;
+  unsigned long long value = std::strtoull(size.c_str(), &end, 10);
+  if (end == size.c_str()) return 0;
+  switch (*end) {
+    case 'K': return static_cast<std::size_t>(value) << 10;
+    case 'M': return static_cast<std::size_t>(value) << 20;
+    case 'G': return static_cast<std::size_t>(value) << 30;
+    default: return static_cast<std::size_t>(value);
+  }
+}
+
+unsigned QuotaCPUs(long long quota, long long period) {
+  if (quota <= 0 || period <= 0) return 0;
+  return static_cast<unsigned>((quota + period - 1) / period);
+}
+
+unsigned ParseCPUMax(const std::string &cpu_max) {
+  std::istringstream stream(cpu_max);
+  std::string quota;
+  long long period = 100000;
+  if (!(stream >> quota)) return 0;
+  stream >> period;
+  if (quota == "max") return 0;
+  return QuotaCPUs(std::strtoll(quota.c_str(), nullptr, 10), period);
+}
+
+} // namespace topology
+
+namespace {
+
+bool ReadFile(const std::string &name, std::string &out) {
+  std::ifstream in(name.c_str());
+  if (!in) return false;
+  std::stringstream buffer;
+  buffer << in.rdbuf();
+  out = buffer.str();
+  return true;
+}
+
+// CPUID leaf 7 EDX bit 15: the package mixes core types.
+bool CPUIDHybrid() {
+#if defined(WASM) || defined(__INTEL_COMPILER)
+  return false;
+#elif defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0);
+  if (regs[0] < 7) return false;
+  __cpuidex(regs, 7, 0);
+  return regs[3] & (1 << 15);
+#else
+  if (__get_cpuid_max(0, 0) < 7) return false;
+  unsigned int eax, ebx, ecx, edx;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return edx & (1 << 15);
+#endif
+}
+
+// CPUID leaf 0x1A EAX[31:24] for the core this runs on.
+CoreClass CPUIDCoreClass() {
+#if defined(WASM) || defined(__INTEL_COMPILER) || defined(_MSC_VER)
+  return CoreClass::Unknown;
+#else
+  if (__get_cpuid_max(0, 0) < 0x1A) return CoreClass::Unknown;
+  unsigned int eax, ebx, ecx, edx;
+  __cpuid_count(0x1A, 0, eax, ebx, ecx, edx);
+  switch (eax >> 24) {
+    case 0x40: return CoreClass::Performance;
+    case 0x20: return CoreClass::Efficiency;
+    default: return CoreClass::Unknown;
+  }
+#endif
+}
+
+#if defined(__linux__)
+std::vector<int> AffinityCPUs() {
+  std::vector<int> ret;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &set)) ret.push_back(i);
+    }
+  }
+  return ret;
+}
+
+// Mark cpus listed in file with core_class.
+void ClassFromSysfs(const char *file, CoreClass core_class, std::vector<LogicalCPU> &cpus) {
+  std::string contents;
+  std::vector<int> ids;
+  if (!ReadFile(file, contents) || !topology::ParseCPUList(contents, ids)) return;
+  for (LogicalCPU &cpu : cpus) {
+    if (std::find(ids.begin(), ids.end(), cpu.id) != ids.end()) cpu.core_class = core_class;
+  }
+}
+
+// Ask CPUID on each CPU in turn from a helper thread so the caller's own
+// affinity is left alone.
+void ClassFromCPUID(std::vector<LogicalCPU> &cpus) {
+  std::thread helper([&cpus] {
+    for (LogicalCPU &cpu : cpus) {
+      if (PinCurrentThread(cpu.id)) cpu.core_class = CPUIDCoreClass();
+    }
+  });
+  helper.join();
+}
+
+// Relative capacity from the scheduler, 0 if not reported.
+float Capacity(int cpu) {
+  std::string contents;
+  if (!ReadFile("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpu_capacity", contents)) return 0.0f;
+  return static_cast<float>(std::atof(contents.c_str()));
+}
+
+void ReadCaches(Topology &t) {
+  for (int index = 0; ; ++index) {
+    const std::string base = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+    std::string level, type, size;
+    if (!ReadFile(base + "level", level) || !ReadFile(base + "type", type) || !ReadFile(base + "size", size)) break;
+    const std::size_t bytes = topology::ParseCacheSize(size);
+    const int l = std::atoi(level.c_str());
+    if (l == 1 && type.compare(0, 4, "Data") == 0) t.l1d_bytes = bytes;
+    if (l == 2) t.l2_bytes = bytes;
+    if (l == 3) t.l3_bytes = bytes;
+  }
+}
+
+// Smallest quota over this process's cgroup and its ancestors.
+unsigned CgroupQuota() {
+  std::string self;
+  if (!ReadFile("/proc/self/cgroup", self)) return 0;
+  unsigned best = 0;
+  const auto consider = [&best](unsigned quota) {
+    if (quota && (!best || quota < best)) best = quota;
+  };
+  std::istringstream lines(self);
+  std::string line;
+  while (std::getline(lines, line)) {
+    // hierarchy-ID:controller-list:cgroup-path
+    const std::size_t first = line.find(':'), second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) continue;
+    const std::string controllers = line.substr(first + 1, second - first - 1);
+    std::string path = line.substr(second + 1);
+    if (controllers.empty()) {
+      // cgroup v2.  Inside a container the path may not be visible, in which
+      // case the namespace root is the container's cgroup.
+      for (std::string dir = path; ; dir = dir.substr(0, dir.rfind('/'))) {
+        std::string contents;
+        if (ReadFile("/sys/fs/cgroup" + dir + "/cpu.max", contents)) consider(topology::ParseCPUMax(contents));
+        if (dir.empty() || dir == "/") break;
+      }
+      std::string contents;
+      if (ReadFile("/sys/fs/cgroup/cpu.max", contents)) consider(topology::ParseCPUMax(contents));
+    } else {
+      std::stringstream list(controllers);
+      std::string controller;
+      bool cpu = false;
+      while (std::getline(list, controller, ',')) cpu |= (controller == "cpu");
+      if (!cpu) continue;
+      const char *mounts[] = {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"};
+      for (const char *mount : mounts) {
+        const std::string dirs[] = {mount + path, mount};
+        for (const std::string &dir : dirs) {
+          std::string quota, period;
+          if (ReadFile(dir + "/cpu.cfs_quota_us", quota) && ReadFile(dir + "/cpu.cfs_period_us", period)) {
+            consider(topology::QuotaCPUs(std::atoll(quota.c_str()), std::atoll(period.c_str())));
+          }
+        }
+      }
+    }
+  }
+  return best;
+}
+#endif
+
+Topology Detect() {
+  Topology t;
+  t.quota = 0;
+  t.l1d_bytes = t.l2_bytes = t.l3_bytes = 0;
+  t.hybrid = CPUIDHybrid();
+#if defined(__linux__)
+  for (int id : AffinityCPUs()) {
+    LogicalCPU cpu;
+    cpu.id = id;
+    cpu.core_class = CoreClass::Unknown;
+    cpu.weight = 1.0f;
+    t.cpus.push_back(cpu);
+  }
+  if (t.hybrid) {
+    ClassFromSysfs("/sys/devices/cpu_core/cpus", CoreClass::Performance, t.cpus);
+    ClassFromSysfs("/sys/devices/cpu_atom/cpus", CoreClass::Efficiency, t.cpus);
+    if (std::all_of(t.cpus.begin(), t.cpus.end(), [](const LogicalCPU &c) { return c.core_class == CoreClass::Unknown; })) {
+      ClassFromCPUID(t.cpus);
+    }
+  }
+  float max_capacity = 0.0f;
+  for (const LogicalCPU &cpu : t.cpus) max_capacity = std::max(max_capacity, Capacity(cpu.id));
+  for (LogicalCPU &cpu : t.cpus) {
+    const float capacity = max_capacity > 0.0f ? Capacity(cpu.id) : 0.0f;
+    if (capacity > 0.0f) {
+      cpu.weight = capacity / max_capacity;
+    } else if (cpu.core_class == CoreClass::Efficiency) {
+      cpu.weight = kEfficiencyCoreWeight;
+    }
+  }
+  std::stable_sort(t.cpus.begin(), t.cpus.end(), [](const LogicalCPU &a, const LogicalCPU &b) { return a.weight > b.weight; });
+  ReadCaches(t);
+  t.quota = CgroupQuota();
+#endif
+  if (t.cpus.empty()) {
+    const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < count; ++i) {
+      LogicalCPU cpu;
+      cpu.id = static_cast<int>(i);
+      cpu.core_class = CoreClass::Unknown;
+      cpu.weight = 1.0f;
+      t.cpus.push_back(cpu);
+    }
+  }
+  return t;
+}
+
+} // namespace
+
+unsigned Topology::Threads() const {
+  const unsigned usable = static_cast<unsigned>(cpus.size());
+  return quota ? std::min(usable, quota) : usable;
+}
+
+float Topology::Weight(int id) const {
+  for (const LogicalCPU &cpu : cpus) {
+    if (cpu.id == id) return cpu.weight;
+  }
+  return 1.0f;
+}
+
+const Topology &GetTopology() {
+  static const Topology topology = Detect();
+  return topology;
+}
+
+float CurrentCPUWeight() {
+#if defined(__linux__)
+  const Topology &t = GetTopology();
+  if (!t.hybrid) return 1.0f;
+  const int cpu = sched_getcpu();
+  return cpu < 0 ? 1.0f : t.Weight(cpu);
+#else
+  return 1.0f;
+#endif
+}
+
+bool PinCurrentThread(int cpu) {
+#if defined(__linux__)
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+} // namespace intgemm
@@ -0,0 +1,78 @@
+#pragma once
+/* What the machine looks like to this process: which CPUs we may run on,
+ * which of them are performance or efficiency cores, the cgroup CPU quota,
+ * and cache sizes.  Detected once on first use.
+ *
+ * On Linux this reads sched_getaffinity, /sys/devices/cpu_core/cpus and
+ * /sys/devices/cpu_atom/cpus (hybrid Intel), cpu_capacity, the cache
+ * description under /sys/devices/system/cpu/cpu0/cache, and the cgroup v2
+ * cpu.max or cgroup v1 cpu.cfs_quota_us of this process.  CPUID says whether
+ * the CPU is hybrid at all and, when sysfs doesn't say, which class each core
+ * is.  Elsewhere it falls back to std::thread::hardware_concurrency() uniform
+ * cores.
+ */
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace intgemm {
+
+enum class CoreClass { Unknown, Performance, Efficiency };
+
+struct LogicalCPU {
+  // Operating system's number for the CPU.
+  int id;
+  CoreClass core_class;
+  // Throughput relative to the fastest core, used to size each thread's
+  // share of work.
+  float weight;
+};
+
+struct Topology {
+  // CPUs this process may run on, fastest first.
+  std::vector<LogicalCPU> cpus;
+  // cgroup CPU quota rounded up to whole CPUs, 0 if unlimited.
+  unsigned quota;
+  // The CPU has more than one core class.
+  bool hybrid;
+  // Data cache sizes in bytes as seen by one core, 0 if unknown.
+  std::size_t l1d_bytes, l2_bytes, l3_bytes;
+
+  // Number of threads worth running: usable CPUs, capped by the quota.
+  unsigned Threads() const;
+
+  // Weight of the CPU with operating system number id, 1 if unknown.
+  float Weight(int id) const;
+};
+
+const Topology &GetTopology();
+
+// Weight of the CPU the calling thread is on right now.
+float CurrentCPUWeight();
+
+// Pin the calling thread to one CPU.  Returns false if unsupported or denied.
+bool PinCurrentThread(int cpu);
+
+// Weight given to efficiency cores when the kernel doesn't report capacity.
+const float kEfficiencyCoreWeight = 0.6f;
+
+// Parsers for the sysfs and cgroup formats, exposed for testing.
+namespace topology {
+
+// Linux cpulist format, e.g. "0-3,8,10-11".  Returns false on malformed input.
+bool ParseCPUList(const std::string &list, std::vector<int> &out);
+
+// Cache size such as "48K" or "2M" in bytes, 0 if malformed.
+std::size_t ParseCacheSize(const std::string &size);
+
+// cgroup v2 cpu.max contents ("max 100000" or "150000 100000") to whole
+// CPUs, rounded up.  0 means unlimited.
+unsigned ParseCPUMax(const std::string &cpu_max);
+
+// cgroup v1 quota and period in microseconds to whole CPUs.  quota < 0 means
+// unlimited and returns 0.
+unsigned QuotaCPUs(long long quota, long long period);
+
+} // namespace topology
+} // namespace intgemm
@@ -0,0 +1,141 @@
+#include "trace.h"
+
+#ifdef INTGEMM_TRACE
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+struct Buffer {
+  explicit Buffer(unsigned id) : thread(id), begun(0), written(0), events(trace::kEvents), in_use(true) {}
+  const unsigned thread;
+  // Total events whose recording started and finished; the latest kEvents
+  // finished are in events.  A dump reading an event checks begun afterwards
+  // to see whether the event was overwritten meanwhile.
+  std::atomic<uint64_t> begun;
+  std::atomic<uint64_t> written;
+  std::vector<trace::Event> events;
+  // Whether a live thread records into it.  Guarded by Registry::mutex.
+  bool in_use;
+};
+
+// Buffers outlive their threads so their spans can still be written out, and
+// a new thread takes over the buffer of one that exited, so there are only
+// as many buffers as threads ever alive at once.
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Buffer>> buffers;
+  std::atomic<uint64_t> cleared;
+  Registry() : cleared(0) {}
+};
+
+Registry &GetRegistry() {
+  // Never destroyed: threads may exit after static destructors have run.
+  static Registry *registry = new Registry;
+  return *registry;
+}
+
+// Hands the buffer back when its thread exits.
+struct Owner {
+  std::shared_ptr<Buffer> buffer;
+  ~Owner() {
+    if (!buffer) return;
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffer->in_use = false;
+  }
+};
+
+Buffer &ThisThread() {
+  thread_local Owner owner;
+  if (!owner.buffer) {
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const std::shared_ptr<Buffer> &buffer : registry.buffers) {
+      if (!buffer->in_use) {
+        buffer->in_use = true;
+        owner.buffer = buffer;
+        return *owner.buffer;
+      }
+    }
+    owner.buffer = std::make_shared<Buffer>(static_cast<unsigned>(registry.buffers.size()) + 1);
+    registry.buffers.push_back(owner.buffer);
+  }
+  return *owner.buffer;
+}
+
+// Trace Event Format timestamps are in microseconds.
+void WriteMicroseconds(std::ostream &out, uint64_t nanoseconds) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%llu.%03u", static_cast<unsigned long long>(nanoseconds / 1000), static_cast<unsigned>(nanoseconds % 1000));
+  out << buf;
+}
+
+void WriteEvent(std::ostream &out, unsigned thread, const trace::Event &event) {
+  out << "{\"name\":\"" << event.name << "\",\"cat\":\"intgemm\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread << ",\"ts\":";
+  WriteMicroseconds(out, event.begin);
+  out << ",\"dur\":";
+  WriteMicroseconds(out, event.end - event.begin);
+  if (event.range) {
+    out << ",\"args\":{\"begin\":" << event.args[0] << ",\"end\":" << event.args[1] << "}}";
+  } else {
+    out << ",\"args\":{\"rows\":" << event.args[0];
+    if (event.args[1]) out << ",\"width\":" << event.args[1];
+    out << ",\"cols\":" << event.args[2] << "}}";
+  }
+}
+
+} // namespace
+
+namespace trace {
+void Record(const Event &event) {
+  Buffer &buffer = ThisThread();
+  const uint64_t written = buffer.written.load(std::memory_order_relaxed);
+  buffer.begun.store(written + 1, std::memory_order_relaxed);
+  // Keep the slot's writes after begun for WriteChromeTrace.
+  std::atomic_thread_fence(std::memory_order_release);
+  buffer.events[written % kEvents] = event;
+  buffer.written.store(written + 1, std::memory_order_release);
+}
+} // namespace trace
+
+void ClearTrace() {
+  GetRegistry().cleared.store(profile::Now(), std::memory_order_relaxed);
+}
+
+void WriteChromeTrace(std::ostream &out) {
+  Registry &registry = GetRegistry();
+  const uint64_t cleared = registry.cleared.load(std::memory_order_relaxed);
+  std::vector<std::shared_ptr<Buffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffers = registry.buffers;
+  }
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  for (const std::shared_ptr<Buffer> &buffer : buffers) {
+    if (!first) out << ',';
+    first = false;
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread << ",\"args\":{\"name\":\"thread " << buffer->thread << "\"}}";
+    const uint64_t written = buffer->written.load(std::memory_order_acquire);
+    for (uint64_t i = written > trace::kEvents ? written - trace::kEvents : 0; i < written; ++i) {
+      const trace::Event event = buffer->events[i % trace::kEvents];
+      // Event i + kEvents goes in the same slot; drop the copy if it started.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (buffer->begun.load(std::memory_order_relaxed) > i + trace::kEvents) continue;
+      if (event.begin < cleared) continue;
+      out << ",\n";
+      WriteEvent(out, buffer->thread, event);
+    }
+  }
+  out << "]}\n";
+}
+
+} // namespace intgemm
+
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+/* Chrome trace of intgemm operations, to line intgemm work up with the rest
+ * of a request's timeline.
+ *
+ * Build with -DUSE_TRACE=ON.  Otherwise INTGEMM_TRACE_ONLY expands to nothing.
+ *
+ * When enabled, every thread records spans into its own ring buffer holding
+ * the last trace::kEvents spans.  A thread that starts after another exited
+ * takes over its buffer and track, so memory is bounded by the most threads
+ * alive at once.  The spans are:
+ *   - each public entry point listed in profile.h, named after the
+ *     operation, with its shape;
+ *   - each range a ParallelFor body runs, named "ParallelFor", with the
+ *     range.  Comparing when these start against the enclosing operation
+ *     shows thread wake latency, and their lengths show load imbalance.
+ *
+ * WriteChromeTrace writes the Trace Event Format JSON that chrome://tracing
+ * and ui.perfetto.dev load.  It can run while other threads record; spans a
+ * thread overwrites while the dump reads them are left out.
+ */
+
+#include "intgemm/intgemm_config.h"
+#include "profile.h"
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef INTGEMM_TRACE
+#include <ostream>
+#endif
+
+namespace intgemm {
+
+#ifdef INTGEMM_TRACE
+
+// Write every span still in a ring buffer and recorded since ClearTrace.
+void WriteChromeTrace(std::ostream &out);
+
+// Drop the spans recorded so far from later WriteChromeTrace output.
+void ClearTrace();
+
+namespace trace {
+
+const std::size_t kEvents = 1 << 12;
+
+struct Event {
+  const char *name;
+  uint64_t begin, end;
+  // rows, width, cols of an operation or begin, end of a range.
+  uint64_t args[3];
+  bool range;
+};
+
+void Record(const Event &event);
+
+} // namespace trace
+
+class TraceSpan {
+  public:
+    // Span of an operation.  Shapes without a width pass 0 for it.
+    TraceSpan(Operation operation, uint64_t rows, uint64_t width, uint64_t cols) {
+      event_.name = OperationName(operation);
+      event_.args[0] = rows;
+      event_.args[1] = width;
+      event_.args[2] = cols;
+      event_.range = false;
+      event_.begin = profile::Now();
+    }
+
+    // Span of a range [begin, end) of a parallel loop.
+    TraceSpan(const char *name, std::size_t begin, std::size_t end) {
+      event_.name = name;
+      event_.args[0] = begin;
+      event_.args[1] = end;
+      event_.args[2] = 0;
+      event_.range = true;
+      event_.begin = profile::Now();
+    }
+
+    ~TraceSpan() {
+      event_.end = profile::Now();
+      trace::Record(event_);
+    }
+
+  private:
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    trace::Event event_;
+};
+
+namespace trace {
+
+// Wraps a ParallelFor body to record a span per range.
+template <class Function> class TracedBody {
+  public:
+    explicit TracedBody(Function &function) : function_(function) {}
+    void operator()(std::size_t begin, std::size_t end) const {
+      TraceSpan span("ParallelFor", begin, end);
+      function_(begin, end);
+    }
+  private:
+    Function &function_;
+};
+
+} // namespace trace
+
+#define INTGEMM_TRACE_ONLY(...) __VA_ARGS__
+
+#else
+
+#define INTGEMM_TRACE_ONLY(...)
+
+#endif
+
+} // namespace intgemm
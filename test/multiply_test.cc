@@ -292,7 +292,7 @@ template <class Routine> void TestMultiply(Index A_rows, Index width, Index B_co
   Routine::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
 
   AlignedVector<float> test_C(A_rows * B_cols);
-  OMPParallelWrap<callbacks::UnquantizeAndWrite, Routine>(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test_C.begin()));
+  ParallelWrap<callbacks::UnquantizeAndWrite, Routine>(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test_C.begin()));
   // Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::Sequence(
   //   callbacks::Unquantize(unquant_mult),
   //   callbacks::Write<float>(test_C.begin())
@@ -342,7 +342,7 @@ template <class Routine> void TestMultiplyRelu(Index A_rows, Index width, Index
   Routine::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
 
   AlignedVector<float> test_C(A_rows * B_cols);
-  OMPParallelWrap<callbacks::UnquantizeAndWriteRelu, Routine>(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWriteRelu(unquant_mult, test_C.begin()));
+  ParallelWrap<callbacks::UnquantizeAndWriteRelu, Routine>(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWriteRelu(unquant_mult, test_C.begin()));
   // Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::Sequence(
   //   callbacks::Unquantize(unquant_mult),
   //   callbacks::Write<float>(test_C.begin())
@@ -758,4 +758,39 @@ TEST_CASE ("Multiply AVX2 16bit with bias and relu", "[biased_multiply_relu]") {
   }
 #endif
 
+// A Sequence of callbacks should give exactly what the fused callback does.
+template <class Routine> void TestMultiplySequence(Index A_rows, Index width, Index B_cols) {
+  using Integer = typename Routine::Integer;
+  std::mt19937 gen;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  AlignedVector<float> A(A_rows * width), B(width * B_cols);
+  for (auto& it : A) it = dist(gen);
+  for (auto& it : B) it = dist(gen);
+
+  float quant_mult = (sizeof(Integer) == 2) ? 1024 : 64;
+  float unquant_mult = 1.0f / (quant_mult*quant_mult);
+  AlignedVector<Integer> A_prep(A.size()), B_prep(B.size());
+  Routine::PrepareA(A.begin(), A_prep.begin(), quant_mult, A_rows, width);
+  Routine::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
+
+  AlignedVector<float> fused_C(A_rows * B_cols), sequence_C(A_rows * B_cols);
+  Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, fused_C.begin()));
+  Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::Sequence(
+    callbacks::Unquantize(unquant_mult),
+    callbacks::Write<float>(sequence_C.begin())
+  ));
+  Compare(fused_C.begin(), sequence_C.begin(), fused_C.size());
+}
+
+TEST_CASE ("Multiply with callback sequence", "[multiply]") {
+  if (kCPU >= CPUType::SSE2) TestMultiplySequence<SSE2::Kernels16>(8, 256, 256);
+  if (kCPU >= CPUType::SSSE3) TestMultiplySequence<SSSE3::Kernels8>(8, 256, 256);
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+  if (kCPU >= CPUType::AVX2) TestMultiplySequence<AVX2::Kernels8>(8, 256, 256);
+#endif
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+  if (kCPU >= CPUType::AVX512BW) TestMultiplySequence<AVX512BW::Kernels8>(8, 256, 256);
+#endif
+}
+
 } // namespace intgemm
@@ -0,0 +1,235 @@
+#include "test.h"
+#include "../intgemm/cost_model.h"
+#include "../intgemm/parallel.h"
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+// Every index is visited exactly once and ranges respect the grain.
+void CheckCoverage(std::size_t begin, std::size_t end, std::size_t grain) {
+  std::vector<std::atomic<int>> visits(end);
+  for (std::atomic<int> &v : visits) v.store(0);
+  std::atomic<bool> aligned(true);
+  ParallelFor(begin, end, grain, [&](std::size_t piece_begin, std::size_t piece_end) {
+    if ((piece_begin - begin) % grain || (piece_end != end && (piece_end - begin) % grain)) {
+      aligned.store(false);
+    }
+    for (std::size_t i = piece_begin; i < piece_end; ++i) visits[i].fetch_add(1);
+  });
+  CHECK(aligned.load());
+  for (std::size_t i = 0; i < end; ++i) {
+    INFO("index " << i);
+    CHECK(visits[i].load() == (i >= begin ? 1 : 0));
+  }
+}
+
+TEST_CASE("ParallelFor covers range", "[parallel]") {
+  CheckCoverage(0, 0, 8);
+  CheckCoverage(0, 1, 8);
+  CheckCoverage(0, 8, 8);
+  CheckCoverage(0, 1000, 8);
+  CheckCoverage(0, 1003, 8);
+  CheckCoverage(16, 4096, 1);
+  CheckCoverage(5, 100000, 64);
+}
+
+TEST_CASE("ParallelFor nested", "[parallel]") {
+  std::atomic<std::size_t> total(0);
+  ParallelFor(0, 64, 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      ParallelFor(0, 100, 10, [&](std::size_t inner_begin, std::size_t inner_end) {
+        total.fetch_add(inner_end - inner_begin);
+      });
+    }
+  });
+  CHECK(total.load() == 6400);
+}
+
+TEST_CASE("MaxThreads", "[parallel]") {
+  CHECK(MaxThreads() >= 1);
+}
+
+TEST_CASE("Concurrency governor", "[parallel]") {
+  SetConcurrencyLimit(4);
+  CHECK(GetConcurrencyLimit() == 4);
+  {
+    ThreadBudget first(3);
+    CHECK(first.Threads() == 3);
+    {
+      // Saturated: callers still get their own thread.
+      ThreadBudget second(3);
+      CHECK(second.Threads() == 1);
+      ThreadBudget third(2);
+      CHECK(third.Threads() == 1);
+    }
+    ThreadBudget fourth(8);
+    CHECK(fourth.Threads() == 1);
+  }
+  {
+    ThreadBudget first(3);
+    // All or just the caller.
+    ThreadBudget whole(2, true);
+    CHECK(whole.Threads() == 1);
+  }
+  {
+    ThreadBudget all(8);
+    CHECK(all.Threads() == 4);
+  }
+  ThreadBudget whole(3, true);
+  CHECK(whole.Threads() == 3);
+  ThreadBudget rest(8);
+  CHECK(rest.Threads() == 1);
+  SetConcurrencyLimit(0);
+  CHECK(GetConcurrencyLimit() == MaxThreads());
+}
+
+#if defined(INTGEMM_THREADPOOL) || defined(_OPENMP)
+TEST_CASE("Concurrency governor counts single-thread regions", "[parallel]") {
+  SetConcurrencyLimit(4);
+  ParallelFor(0, 1, 1, [&](std::size_t, std::size_t) {
+    ThreadBudget probe(8);
+    CHECK(probe.Threads() == 3);
+  });
+  SetConcurrencyLimit(0);
+}
+#endif
+
+TEST_CASE("ParallelFor thread cap", "[parallel]") {
+  std::atomic<int> calls(0);
+  ParallelFor(0, 1000, 8, 1, [&](std::size_t begin, std::size_t end) {
+    CHECK(begin == 0);
+    CHECK(end == 1000);
+    calls.fetch_add(1);
+  });
+  CHECK(calls.load() == 1);
+}
+
+TEST_CASE("Cost model", "[parallel]") {
+  // The default configuration keeps tiny calls on one thread.
+  const float original = GetThreadOverhead();
+  CHECK(original >= 0.5f);
+  CHECK(MultiplyThreads(CPUType::AVX512BW, 1, 1, 64, 8) == 1);
+  CHECK(QuantizeThreads(CPUType::AVX2, 64) == 1);
+
+  SetThreadOverhead(2.0f);
+  CHECK(ThreadsForWork(0.0f) == 1);
+  CHECK(ThreadsForWork(7.9f) == 1);
+  CHECK(ThreadsForWork(8.0f) == 2);
+  CHECK(ThreadsForWork(200.0f) == 10);
+  // Tiny multiplies stay on one thread; big ones get more.
+  CHECK(MultiplyThreads(CPUType::AVX512BW, 1, 1, 64, 8) == 1);
+  CHECK(MultiplyThreads(CPUType::AVX512BW, 1, 256, 4096, 4096) > 1);
+  CHECK(QuantizeThreads(CPUType::AVX2, 64) == 1);
+
+  const CostRates rates = GetCostRates(CPUType::SSSE3);
+  CostRates slow = rates;
+  slow.multiply8 = 1.0f;
+  SetCostRates(CPUType::SSSE3, slow);
+  CHECK(MultiplyThreads(CPUType::SSSE3, 1, 1, 64, 8) == 16);
+  SetCostRates(CPUType::SSSE3, rates);
+
+  SetThreadOverhead(0.0f);
+  CHECK(ThreadsForWork(0.0f) > 1000);
+  SetThreadOverhead(original);
+}
+
+#ifdef INTGEMM_THREADPOOL
+TEST_CASE("Thread pool options", "[parallel]") {
+  const ThreadPoolOptions original = GetThreadPoolOptions();
+  ThreadPoolOptions options;
+  options.threads = 3;
+  options.spin = 0;
+  SetThreadPoolOptions(options);
+  CHECK(MaxThreads() == 3);
+  CHECK(GetThreadPoolOptions().spin == 0);
+  // Workers sleep between calls with spin 0, so this exercises waking them.
+  for (int i = 0; i < 100; ++i) CheckCoverage(0, 1000, 8);
+  ThreadPoolOptions restore;
+  restore.spin = original.spin;
+  SetThreadPoolOptions(restore);
+}
+
+TEST_CASE("Concurrency governor with busy pool", "[parallel]") {
+  const ThreadPoolOptions original = GetThreadPoolOptions();
+  ThreadPoolOptions options;
+  options.threads = 3;
+  SetThreadPoolOptions(options);
+  SetConcurrencyLimit(8);
+  std::atomic<bool> once(false);
+  std::atomic<std::size_t> inner_total(0);
+  // The outer region holds the pool and 3 threads of the budget.
+  ParallelFor(0, 3, 1, [&](std::size_t, std::size_t) {
+    if (once.exchange(true)) return;
+    std::thread other([&] {
+      // The pool is busy so this runs inline and should hold 1 thread, not 3.
+      ParallelFor(0, 300, 1, [&](std::size_t begin, std::size_t end) {
+        ThreadBudget probe(8);
+        CHECK(probe.Threads() == 4);
+        inner_total.fetch_add(end - begin);
+      });
+    });
+    other.join();
+  });
+  CHECK(inner_total.load() == 300);
+  ThreadBudget all(8);
+  CHECK(all.Threads() == 8);
+  SetConcurrencyLimit(0);
+  ThreadPoolOptions restore;
+  restore.spin = original.spin;
+  SetThreadPoolOptions(restore);
+}
+
+TEST_CASE("Thread pool sticky slices", "[parallel]") {
+  const ThreadPoolOptions original = GetThreadPoolOptions();
+  ThreadPoolOptions options;
+  options.threads = 3;
+  options.sticky = true;
+  SetThreadPoolOptions(options);
+  std::mutex mutex;
+  std::map<std::size_t, std::pair<std::size_t, std::thread::id> > first;
+  for (int call = 0; call < 20; ++call) {
+    std::map<std::size_t, std::pair<std::size_t, std::thread::id> > seen;
+    ParallelFor(0, 96, 8, [&](std::size_t begin, std::size_t end) {
+      std::lock_guard<std::mutex> lock(mutex);
+      seen[begin] = std::make_pair(end, std::this_thread::get_id());
+    });
+    // One piece per participant, each always on the same thread.
+    CHECK(seen.size() == 3);
+    if (call == 0) {
+      first = seen;
+    } else {
+      CHECK(seen == first);
+    }
+  }
+  // A thread cap, for instance from the cost model, doesn't change the split.
+  std::map<std::size_t, std::pair<std::size_t, std::thread::id> > capped;
+  ParallelFor(0, 96, 8, 2, [&](std::size_t begin, std::size_t end) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capped[begin] = std::make_pair(end, std::this_thread::get_id());
+  });
+  CHECK(capped == first);
+  // If the governor can't grant every thread, the caller does it all.
+  SetConcurrencyLimit(2);
+  std::size_t pieces = 0;
+  ParallelFor(0, 96, 8, [&](std::size_t begin, std::size_t end) {
+    CHECK(begin == 0);
+    CHECK(end == 96);
+    ++pieces;
+  });
+  CHECK(pieces == 1);
+  SetConcurrencyLimit(0);
+  ThreadPoolOptions restore;
+  restore.spin = original.spin;
+  SetThreadPoolOptions(restore);
+}
+#endif
+
+} // namespace
+} // namespace intgemm
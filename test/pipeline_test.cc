@@ -0,0 +1,80 @@
+#include "test.h"
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/pipeline.h"
+
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+// Double-buffered A as in the example in pipeline.h.
+TEST_CASE("Pipeline batches", "[pipeline]") {
+  if (kCPU < CPUType::SSSE3) return;
+  const Index rows = 5, width = 128, B_cols = 24;
+  const std::size_t batches = 6;
+  const float quant_mult = 64.0f, unquant_mult = 1.0f / (quant_mult * quant_mult);
+  std::mt19937 gen;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<AlignedVector<float>> inputs;
+  for (std::size_t n = 0; n < batches; ++n) {
+    inputs.emplace_back(rows * width);
+    for (auto &it : inputs.back()) it = dist(gen);
+  }
+  AlignedVector<float> B(width * B_cols);
+  for (auto &it : B) it = dist(gen);
+  AlignedVector<int8_t> B_prep(B.size());
+  Int8::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
+
+  std::vector<AlignedVector<float>> reference, outputs;
+  for (std::size_t n = 0; n < batches; ++n) {
+    AlignedVector<int8_t> A(rows * width);
+    Int8::PrepareA(inputs[n].begin(), A.begin(), quant_mult, rows, width);
+    reference.emplace_back(rows * B_cols);
+    Int8::Multiply(A.begin(), B_prep.begin(), rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, reference.back().begin()));
+    outputs.emplace_back(rows * B_cols);
+  }
+
+  AlignedVector<int8_t> A[2] = {AlignedVector<int8_t>(rows * width), AlignedVector<int8_t>(rows * width)};
+  std::atomic<std::size_t> emitted(0);
+  std::vector<Completion> done;
+  {
+    Pipeline pipeline;
+    Completion prepared[2], multiplied[2];
+    prepared[0] = pipeline.PrepareA<Int8>(inputs[0].begin(), A[0].begin(), quant_mult, rows, width);
+    for (std::size_t n = 0; n < batches; ++n) {
+      multiplied[n % 2] = pipeline.Multiply<Int8>(A[n % 2].begin(), B_prep.begin(), rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, outputs[n].begin()), {prepared[n % 2]});
+      if (n + 1 < batches) {
+        prepared[(n + 1) % 2] = pipeline.PrepareA<Int8>(inputs[n + 1].begin(), A[(n + 1) % 2].begin(), quant_mult, rows, width, {multiplied[(n + 1) % 2]});
+      }
+      done.push_back(pipeline.Epilogue([&emitted] { emitted.fetch_add(1); }, {multiplied[n % 2]}));
+    }
+    done.back().Wait();
+  }
+  for (const Completion &c : done) CHECK(c.Done());
+  CHECK(emitted.load() == batches);
+  for (std::size_t n = 0; n < batches; ++n) {
+    for (std::size_t i = 0; i < reference[n].size(); ++i) CHECK(outputs[n][i] == reference[n][i]);
+  }
+}
+
+TEST_CASE("Pipeline errors propagate", "[pipeline]") {
+  Pipeline pipeline;
+  Completion failed = pipeline.Submit(Pipeline::Stage::Prepare, [] { throw std::runtime_error("prepare"); });
+  bool ran = false;
+  Completion dependent = pipeline.Epilogue([&ran] { ran = true; }, {failed});
+  CHECK_THROWS_AS(dependent.Wait(), std::runtime_error);
+  CHECK_THROWS_AS(failed.Wait(), std::runtime_error);
+  CHECK(!ran);
+  // The stage keeps going after a failure.
+  Completion fine = pipeline.Submit(Pipeline::Stage::Prepare, [] {});
+  fine.Wait();
+  CHECK(Completion().Done());
+}
+
+} // namespace
+} // namespace intgemm
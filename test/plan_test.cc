@@ -0,0 +1,86 @@
+#include "test.h"
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/plan.h"
+
+#include <cstdio>
+#include <random>
+
+namespace intgemm {
+namespace {
+
+template <class Routine> void TestPlan(Index A_rows, Index width, Index B_cols) {
+  using Integer = typename Routine::Integer;
+  AlignedVector<float> A(A_rows * width), B(width * B_cols);
+  std::mt19937 gen;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  for (auto &it : A) it = dist(gen);
+  for (auto &it : B) it = dist(gen);
+  const float quant_mult = (sizeof(Integer) == 2) ? 1024.0f : 64.0f;
+  const float unquant_mult = 1.0f / (quant_mult * quant_mult);
+  AlignedVector<Integer> A_prep(A.size()), B_prep(B.size());
+  Routine::PrepareA(A.begin(), A_prep.begin(), quant_mult, A_rows, width);
+  Routine::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
+
+  AlignedVector<float> reference(A_rows * B_cols), test(A_rows * B_cols);
+  Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, reference.begin()));
+
+  PlanCache cache;
+  typedef MultiplyPlan<Routine, callbacks::UnquantizeAndWrite> Plan;
+  // Without tuning the cache is left alone.
+  Plan untuned(A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), &cache);
+  CHECK(cache.size() == 0);
+  CHECK(untuned.Settings().threads >= 1);
+  TuneOptions options;
+  options.tune = true;
+  Plan plan(A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), &cache, options);
+  CHECK(cache.size() == 1);
+  CHECK(plan.Settings().threads >= 1);
+  std::fill(test.begin(), test.end(), 0.0f);
+  plan(A_prep.begin(), B_prep.begin(), callbacks::UnquantizeAndWrite(unquant_mult, test.begin()));
+  for (std::size_t i = 0; i < reference.size(); ++i) CHECK(test[i] == reference[i]);
+
+  // Prefetching the next matrix doesn't change the result.
+  std::fill(test.begin(), test.end(), 0.0f);
+  plan(A_prep.begin(), B_prep.begin(), callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), B_prep.begin(), B_prep.size() * sizeof(Integer));
+  for (std::size_t i = 0; i < reference.size(); ++i) CHECK(test[i] == reference[i]);
+}
+
+TEST_CASE("Plan Int8", "[plan]") {
+  if (kCPU < CPUType::SSSE3) return;
+  TestPlan<Int8>(7, 128, 40);
+}
+
+TEST_CASE("Plan Int16", "[plan]") {
+  if (kCPU < CPUType::SSE2) return;
+  TestPlan<Int16>(9, 64, 24);
+}
+
+TEST_CASE("Plan cache file", "[plan]") {
+  typedef MultiplyPlan<Int8, callbacks::Dummy> Plan;
+  PlanCache cache;
+  PlanSettings settings;
+  settings.threads = 3;
+  settings.shape = TileShape(4, 16);
+  cache.Insert(Plan::Key(10, 64, 48), settings);
+
+  const char *file = "plan_test.plans";
+  REQUIRE(cache.Save(file));
+  PlanCache loaded;
+  REQUIRE(loaded.Load(file));
+  std::remove(file);
+
+  // A hit skips tuning and uses the stored settings.
+  TuneOptions options;
+  Plan plan(10, 64, 48, callbacks::Dummy(), &loaded, options);
+  CHECK(plan.Settings().threads == 3);
+  CHECK(plan.Settings().shape.rows == 4);
+  CHECK(plan.Settings().shape.cols == 16);
+  CHECK(loaded.size() == 1);
+
+  CHECK(!loaded.Load("does_not_exist.plans"));
+}
+
+} // namespace
+} // namespace intgemm
@@ -0,0 +1,103 @@
+#include "test.h"
+#include "../intgemm/aligned.h"
+#include "../intgemm/avx2_gemm.h"
+#include "../intgemm/avx512_gemm.h"
+#include "../intgemm/sse2_gemm.h"
+#include "../intgemm/ssse3_gemm.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+namespace intgemm {
+namespace {
+
+// PrepareBQuantized of integers should match PrepareB of the same values as floats.
+template <typename Backend>
+bool Test(Index B_rows, Index B_cols) {
+  using Integer = typename Backend::Integer;
+  AlignedVector<Integer> input(B_rows * B_cols);
+  AlignedVector<float> input_float(input.size());
+
+  std::mt19937 gen;
+  std::uniform_int_distribution<int> dist(-127, 127);
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = static_cast<Integer>(dist(gen));
+    input_float[i] = static_cast<float>(input[i]);
+  }
+
+  AlignedVector<Integer> output(input.size());
+  Backend::PrepareBQuantized(input.begin(), output.begin(), B_rows, B_cols);
+
+  AlignedVector<Integer> reference(input.size());
+  Backend::PrepareB(input_float.begin(), reference.begin(), 1.0f, B_rows, B_cols);
+
+  for (std::size_t i = 0; i < output.size(); ++i) {
+    if (output[i] != reference[i]) {
+      UNSCOPED_INFO("Error at " << i << ", output = " << int(output[i]) << ", reference = " << int(reference[i]));
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_CASE("PrepareBQuantized SSE2", "") {
+  if (kCPU < CPUType::SSE2)
+    return;
+
+  CHECK(Test<SSE2::Kernels16>(32, 128));
+  CHECK(Test<SSE2::Kernels16>(256, 48));
+}
+
+TEST_CASE("PrepareBQuantized SSSE3", "") {
+  if (kCPU < CPUType::SSSE3)
+    return;
+
+  CHECK(Test<SSSE3::Kernels8>(32, 128));
+  CHECK(Test<SSSE3::Kernels8>(256, 48));
+}
+
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+TEST_CASE("PrepareBQuantized AVX2", "") {
+  if (kCPU < CPUType::AVX2)
+    return;
+
+  CHECK(Test<AVX2::Kernels8>(64, 128));
+  CHECK(Test<AVX2::Kernels8>(256, 48));
+  CHECK(Test<AVX2::Kernels16>(32, 128));
+  CHECK(Test<AVX2::Kernels16>(256, 48));
+}
+#endif
+
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+TEST_CASE("PrepareBQuantized AVX512", "") {
+  if (kCPU < CPUType::AVX512BW)
+    return;
+
+  CHECK(Test<AVX512BW::Kernels8>(64, 128));
+  CHECK(Test<AVX512BW::Kernels8>(256, 48));
+  CHECK(Test<AVX512BW::Kernels16>(64, 128));
+  CHECK(Test<AVX512BW::Kernels16>(256, 48));
+}
+#endif
+
+TEST_CASE("PrepareBQuantized dispatch", "") {
+  if (kCPU < CPUType::SSSE3)
+    return;
+
+  const Index B_rows = 256, B_cols = 64;
+  AlignedVector<int8_t> input(B_rows * B_cols);
+  AlignedVector<float> input_float(input.size());
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = static_cast<int8_t>(static_cast<int>(i % 255) - 127);
+    input_float[i] = static_cast<float>(input[i]);
+  }
+  AlignedVector<int8_t> output(input.size()), reference(input.size());
+  Int8::PrepareBQuantized(input.begin(), output.begin(), B_rows, B_cols);
+  Int8::PrepareB(input_float.begin(), reference.begin(), 1.0f, B_rows, B_cols);
+  CHECK(std::memcmp(output.begin(), reference.begin(), output.size()) == 0);
+}
+
+}
+}
@@ -0,0 +1,111 @@
+#include "test.h"
+#include "../intgemm/profile.h"
+
+#ifdef INTGEMM_PROFILE
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+// Sum of the records for operation.
+ProfileRecord Total(Operation operation, unsigned *records = nullptr) {
+  ProfileRecord total;
+  std::memset(&total, 0, sizeof(total));
+  unsigned count = 0;
+  for (const ProfileRecord &record : GetProfile()) {
+    if (record.operation != operation) continue;
+    ++count;
+    total.backend = record.backend;
+    total.bucket = record.bucket;
+    total.calls += record.calls;
+    total.operations += record.operations;
+    total.bytes += record.bytes;
+    total.nanoseconds += record.nanoseconds;
+    total.parallel_calls += record.parallel_calls;
+    total.slowest_nanoseconds += record.slowest_nanoseconds;
+    total.fastest_nanoseconds += record.fastest_nanoseconds;
+  }
+  if (records) *records = count;
+  return total;
+}
+
+TEST_CASE("Profile entry points", "[profile]") {
+  if (kCPU < CPUType::SSSE3) return;
+  const Index A_rows = 8, width = 64, B_cols = 64;
+  AlignedVector<float> A(A_rows * width), B(width * B_cols), C(A_rows * B_cols);
+  for (std::size_t i = 0; i < A.size(); ++i) A[i] = static_cast<float>(i % 7) - 3.f;
+  for (std::size_t i = 0; i < B.size(); ++i) B[i] = static_cast<float>(i % 5) - 2.f;
+  AlignedVector<int8_t> A_prepared(A.size()), B_prepared(B.size());
+
+  ResetProfile();
+  Int8::Quantize(A.begin(), A_prepared.begin(), 1.0f, A_rows * width);
+  Int8::Quantize(A.begin(), A_prepared.begin(), 1.0f, A_rows * width);
+  Int8::PrepareA(A.begin(), A_prepared.begin(), 1.0f, A_rows, width);
+  Int8::PrepareB(B.begin(), B_prepared.begin(), 1.0f, width, B_cols);
+  Int8::Multiply(A_prepared.begin(), B_prepared.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(1.0f, C.begin()));
+  MaxAbsolute(B.begin(), B.end());
+
+  unsigned records;
+  const ProfileRecord quantize = Total(Operation::Quantize, &records);
+  // PrepareA's own Quantize is not counted again.
+  CHECK(records == 1);
+  CHECK(quantize.calls == 2);
+  CHECK(quantize.backend == Int8::kUses);
+  CHECK(quantize.bucket == 9);
+  CHECK(quantize.operations == 2 * A_rows * width);
+  CHECK(quantize.bytes == 2 * A_rows * width * (sizeof(float) + sizeof(int8_t)));
+
+  const ProfileRecord prepare_a = Total(Operation::PrepareA);
+  CHECK(prepare_a.calls == 1);
+  CHECK(prepare_a.operations == A_rows * width);
+
+  const ProfileRecord prepare_b = Total(Operation::PrepareB);
+  CHECK(prepare_b.calls == 1);
+  CHECK(prepare_b.operations == width * B_cols);
+
+  const ProfileRecord multiply = Total(Operation::Multiply);
+  CHECK(multiply.calls == 1);
+  CHECK(multiply.operations == 2 * A_rows * width * B_cols);
+  CHECK(multiply.bucket == 16);
+  CHECK(multiply.bytes == (A_rows + B_cols) * width + sizeof(float) * A_rows * B_cols);
+  CHECK(multiply.GOPS() > 0.0);
+
+  CHECK(Total(Operation::MaxAbsolute).calls == 1);
+  CHECK(Total(Operation::SelectColumnsB).calls == 0);
+
+  ResetProfile();
+  CHECK(GetProfile().empty());
+}
+
+TEST_CASE("Profile thread imbalance", "[profile]") {
+  ResetProfile();
+  {
+    ProfileScope scope(Operation::SelectColumnsB, CPUType::SSE2, 100, 200);
+    // One thread only: not a parallel call.
+    scope.AddBusy(10);
+  }
+  {
+    ProfileScope scope(Operation::SelectColumnsB, CPUType::SSE2, 100, 200);
+    // Nested scopes on the same thread are not recorded.
+    ProfileScope nested(Operation::Quantize, CPUType::SSE2, 100, 200);
+    scope.AddBusy(10);
+    std::thread([&scope] { scope.AddBusy(30); }).join();
+  }
+  const ProfileRecord record = Total(Operation::SelectColumnsB);
+  CHECK(record.calls == 2);
+  CHECK(record.bucket == 6);
+  CHECK(record.parallel_calls == 1);
+  CHECK(record.slowest_nanoseconds == 30);
+  CHECK(record.fastest_nanoseconds == 10);
+  CHECK(record.Imbalance() == 3.0);
+  CHECK(Total(Operation::Quantize).calls == 0);
+  CHECK(std::string(OperationName(Operation::SelectColumnsB)) == "SelectColumnsB");
+}
+
+} // namespace
+} // namespace intgemm
+
+#endif
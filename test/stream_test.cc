@@ -0,0 +1,78 @@
+#include "test.h"
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/stream.h"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+const char *const kFile = "stream_test.bin";
+const std::size_t kOffset = 100;
+
+template <class Routine> void TestStream(Index A_rows, Index width, Index B_cols, Index panel_cols) {
+  using Integer = typename Routine::Integer;
+  AlignedVector<float> A(A_rows * width), B(width * B_cols);
+  std::mt19937 gen;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  for (auto &it : A) it = dist(gen);
+  for (auto &it : B) it = dist(gen);
+  const float quant_mult = (sizeof(Integer) == 2) ? 1024.0f : 64.0f;
+  const float unquant_mult = 1.0f / (quant_mult * quant_mult);
+  AlignedVector<Integer> A_prep(A.size()), B_prep(B.size());
+  Routine::PrepareA(A.begin(), A_prep.begin(), quant_mult, A_rows, width);
+  Routine::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
+
+  {
+    std::ofstream out(kFile, std::ios::binary);
+    const std::vector<char> header(kOffset, 'x');
+    out.write(header.data(), header.size());
+    out.write(reinterpret_cast<const char*>(B_prep.begin()), B_prep.size() * sizeof(Integer));
+  }
+
+  AlignedVector<float> reference(A_rows * B_cols), test(A_rows * B_cols);
+  Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, reference.begin()));
+  StreamMultiply<Routine>(A_prep.begin(), kFile, kOffset, A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), panel_cols);
+  std::remove(kFile);
+  for (std::size_t i = 0; i < reference.size(); ++i) CHECK(test[i] == reference[i]);
+}
+
+TEST_CASE("Stream Int8", "[stream]") {
+  if (kCPU < CPUType::SSSE3) return;
+  TestStream<Int8>(7, 128, 40, 16);
+  TestStream<Int8>(3, 256, 64, 0);
+  TestStream<Int8>(1, 64, 8, 8);
+}
+
+TEST_CASE("Stream Int8Shift", "[stream]") {
+  if (kCPU < CPUType::SSSE3) return;
+  TestStream<Int8Shift>(7, 128, 40, 24);
+}
+
+TEST_CASE("Stream Int16", "[stream]") {
+  if (kCPU < CPUType::SSE2) return;
+  TestStream<Int16>(5, 64, 48, 16);
+}
+
+TEST_CASE("Stream errors", "[stream]") {
+  if (kCPU < CPUType::SSSE3) return;
+  AlignedVector<int8_t> A(64);
+  std::fill(A.begin(), A.end(), 0);
+  CHECK_THROWS_AS(StreamMultiply<Int8>(A.begin(), "does_not_exist.bin", 0, 1, 64, 16, callbacks::Dummy()), StreamError);
+  {
+    // One panel's worth, but two are needed.
+    std::ofstream out(kFile, std::ios::binary);
+    const std::vector<char> half(64 * 8, 0);
+    out.write(half.data(), half.size());
+  }
+  CHECK_THROWS_AS(StreamMultiply<Int8>(A.begin(), kFile, 0, 1, 64, 16, callbacks::Dummy(), 8), StreamError);
+  std::remove(kFile);
+}
+
+} // namespace
+} // namespace intgemm
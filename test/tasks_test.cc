@@ -0,0 +1,84 @@
+#include "test.h"
+#include "../intgemm/aligned.h"
+#include "../intgemm/callbacks.h"
+#include "../intgemm/intgemm.h"
+#include "../intgemm/tasks.h"
+
+#include <cstddef>
+#include <random>
+
+namespace intgemm {
+namespace {
+
+// Running the tiles in any way should give exactly what Multiply does.
+template <class Routine> void TestTasks(Index A_rows, Index width, Index B_cols) {
+  using Integer = typename Routine::Integer;
+  AlignedVector<float> A(A_rows * width), B(width * B_cols);
+  std::mt19937 gen;
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  for (auto &it : A) it = dist(gen);
+  for (auto &it : B) it = dist(gen);
+
+  const float quant_mult = (sizeof(Integer) == 2) ? 1024.0f : 64.0f;
+  const float unquant_mult = 1.0f / (quant_mult * quant_mult);
+  AlignedVector<Integer> A_prep(A.size()), B_prep(B.size());
+  Routine::PrepareA(A.begin(), A_prep.begin(), quant_mult, A_rows, width);
+  Routine::PrepareB(B.begin(), B_prep.begin(), quant_mult, width, B_cols);
+
+  AlignedVector<float> reference(A_rows * B_cols);
+  Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, reference.begin()));
+
+  const TileShape shapes[] = {TileShape(), TileShape(1, 8), TileShape(3, 16), TileShape(A_rows, B_cols)};
+  for (const TileShape &shape : shapes) {
+    INFO("Tile " << shape.rows << "x" << shape.cols);
+    AlignedVector<float> test(reference.size());
+    auto tasks = Routine::PlanMultiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), shape);
+    // Run backwards to check tasks don't depend on order.
+    for (std::size_t i = tasks.size(); i > 0; --i) tasks(i - 1);
+    for (std::size_t i = 0; i < reference.size(); ++i) CHECK(test[i] == reference[i]);
+
+    AsyncExecutor async(3);
+    std::fill(test.begin(), test.end(), 0.0f);
+    Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), async, shape);
+    for (std::size_t i = 0; i < reference.size(); ++i) CHECK(test[i] == reference[i]);
+
+    ThreadExecutor threads(3);
+    std::fill(test.begin(), test.end(), 0.0f);
+    Routine::Multiply(A_prep.begin(), B_prep.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(unquant_mult, test.begin()), threads, shape);
+    for (std::size_t i = 0; i < reference.size(); ++i) CHECK(test[i] == reference[i]);
+  }
+}
+
+TEST_CASE("Tasks Int8", "[tasks]") {
+  if (kCPU < CPUType::SSSE3) return;
+  TestTasks<Int8>(1, 64, 8);
+  TestTasks<Int8>(7, 128, 40);
+  TestTasks<Int8>(32, 256, 256);
+}
+
+TEST_CASE("Tasks Int8Shift", "[tasks]") {
+  if (kCPU < CPUType::SSSE3) return;
+  TestTasks<Int8Shift>(7, 128, 40);
+}
+
+TEST_CASE("Tasks Int16", "[tasks]") {
+  if (kCPU < CPUType::SSE2) return;
+  TestTasks<Int16>(7, 128, 40);
+  TestTasks<Int16>(32, 256, 256);
+}
+
+TEST_CASE("Tile bounds", "[tasks]") {
+  auto tasks = MultiplyTasks<int8_t, int8_t, callbacks::Dummy>(nullptr, nullptr, nullptr, 10, 64, 48, callbacks::Dummy(), TileShape(4, 16));
+  REQUIRE(tasks.size() == 9);
+  TileBounds last = tasks.Bounds(8);
+  CHECK(last.A_rowbegin == 8);
+  CHECK(last.A_rowend == 10);
+  CHECK(last.B_colbegin == 32);
+  CHECK(last.B_colend == 48);
+  // Tasks sharing columns are adjacent.
+  CHECK(tasks.Bounds(1).B_colbegin == 0);
+  CHECK(tasks.Bounds(1).A_rowbegin == 4);
+}
+
+} // namespace
+} // namespace intgemm
@@ -0,0 +1,128 @@
+#include "test.h"
+#include "../intgemm/telemetry.h"
+
+#ifdef INTGEMM_TELEMETRY
+
+#include <cmath>
+
+namespace intgemm {
+namespace {
+
+AlignedVector<float> Ramp(Index size, float step) {
+  AlignedVector<float> input(size);
+  for (Index i = 0; i < size; ++i) input[i] = (static_cast<float>(i) - static_cast<float>(size / 2)) * step;
+  return input;
+}
+
+// Rounds to nearest even like the quantizers.
+uint64_t ExpectClipped(const AlignedVector<float> &input, std::size_t count, float quant_mult, telemetry::ClipRange range) {
+  uint64_t clipped = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    const double rounded = std::nearbyint(static_cast<double>(input[i] * quant_mult));
+    clipped += rounded < range.lower || rounded > range.upper;
+  }
+  return clipped;
+}
+
+template <class Routine> void TestCounts8() {
+  // Not a multiple of the register width, to cover the overhang.  The
+  // overhang reads a whole register.
+  AlignedVector<float> input = Ramp(144, 3.f);
+  AlignedVector<int8_t> quantized(144);
+  ResetSaturationCounts();
+  Routine::Quantize(input.begin(), quantized.begin(), 1.0f, 130);
+  const uint64_t expected = ExpectClipped(input, 130, 1.0f, telemetry::kClip8);
+  REQUIRE(expected > 0);
+  CHECK(GetSaturationCounts().quantize == expected);
+
+  AlignedVector<float> input_u = Ramp(128, 3.f);
+  AlignedVector<uint8_t> quantized_u(128);
+  Routine::QuantizeU(input_u.begin(), quantized_u.begin(), 1.0f, 128);
+  CHECK(GetSaturationCounts().quantize_u == ExpectClipped(input_u, 128, 1.0f, telemetry::kClip8));
+
+  const Index rows = Routine::kBTileRow, cols = 8;
+  AlignedVector<float> B = Ramp(rows * cols, 1.f);
+  AlignedVector<int8_t> B_prepared(rows * cols);
+  Routine::PrepareB(B.begin(), B_prepared.begin(), 2.0f, rows, cols);
+  CHECK(GetSaturationCounts().prepare_b == ExpectClipped(B, B.size(), 2.0f, telemetry::kClip8));
+
+  // 127 * 127 * 2 per pair, so every 16-bit lane saturates once width is
+  // four registers.
+  const Index width = 4 * Routine::kBTileRow, A_rows = 2, B_cols = 16;
+  AlignedVector<float> ones(width * (A_rows + B_cols));
+  for (float &value : ones) value = 127.f;
+  AlignedVector<int8_t> A(width * A_rows), B_big(width * B_cols);
+  AlignedVector<float> C(A_rows * B_cols);
+  Routine::PrepareA(ones.begin(), A.begin(), 1.0f, A_rows, width);
+  Routine::PrepareB(ones.begin(), B_big.begin(), 1.0f, width, B_cols);
+  Routine::Multiply(A.begin(), B_big.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(1.0f, C.begin()));
+  // 8 registers of sizeof(Register) / 2 lanes per row and block of 8 columns.
+  CHECK(GetSaturationCounts().multiply16 == 8 * (Routine::kBTileRow / 2) * A_rows * (B_cols / 8));
+
+  // Small values do not saturate.
+  for (float &value : ones) value = 1.f;
+  ResetSaturationCounts();
+  Routine::PrepareA(ones.begin(), A.begin(), 1.0f, A_rows, width);
+  Routine::PrepareB(ones.begin(), B_big.begin(), 1.0f, width, B_cols);
+  Routine::Multiply(A.begin(), B_big.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(1.0f, C.begin()));
+  const SaturationCounts counts = GetSaturationCounts();
+  CHECK(counts.quantize == 0);
+  CHECK(counts.prepare_b == 0);
+  CHECK(counts.multiply16 == 0);
+}
+
+template <class Routine> void TestCounts16() {
+  AlignedVector<float> input = Ramp(128, 600.f);
+  AlignedVector<int16_t> quantized(128);
+  ResetSaturationCounts();
+  Routine::Quantize(input.begin(), quantized.begin(), 1.0f, 128);
+  const uint64_t expected = ExpectClipped(input, 128, 1.0f, telemetry::kClip16);
+  REQUIRE(expected > 0);
+  CHECK(GetSaturationCounts().quantize == expected);
+
+  // -32768 fits in int16 so only the two values past it count.
+  AlignedVector<float> edges(32);
+  for (float &value : edges) value = 0.f;
+  edges[0] = -32768.f;
+  edges[1] = 32767.f;
+  edges[2] = -32769.f;
+  edges[3] = 32768.f;
+  edges[4] = -32768.5f;
+  ResetSaturationCounts();
+  Routine::Quantize(edges.begin(), quantized.begin(), 1.0f, 32);
+  CHECK(GetSaturationCounts().quantize == 2);
+
+  const Index rows = Routine::kBTileRow, cols = 8;
+  AlignedVector<float> B = Ramp(rows * cols, 300.f);
+  AlignedVector<int16_t> B_prepared(rows * cols);
+  Routine::PrepareB(B.begin(), B_prepared.begin(), 1.0f, rows, cols);
+  CHECK(GetSaturationCounts().prepare_b == ExpectClipped(B, B.size(), 1.0f, telemetry::kClip16));
+  CHECK(GetSaturationCounts().multiply16 == 0);
+}
+
+TEST_CASE("Saturation telemetry SSSE3", "[telemetry]") {
+  if (kCPU < CPUType::SSSE3) return;
+  TestCounts8<SSSE3::Kernels8>();
+  TestCounts16<SSE2::Kernels16>();
+}
+
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX2
+TEST_CASE("Saturation telemetry AVX2", "[telemetry]") {
+  if (kCPU < CPUType::AVX2) return;
+  TestCounts8<AVX2::Kernels8>();
+  TestCounts16<AVX2::Kernels16>();
+}
+#endif
+
+#ifdef INTGEMM_COMPILER_SUPPORTS_AVX512BW
+TEST_CASE("Saturation telemetry AVX512BW", "[telemetry]") {
+  if (kCPU < CPUType::AVX512BW) return;
+  TestCounts8<AVX512BW::Kernels8>();
+  TestCounts16<AVX512BW::Kernels16>();
+}
+#endif
+
+} // namespace
+} // namespace intgemm
+
+#endif
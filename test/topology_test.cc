@@ -0,0 +1,52 @@
+#include "test.h"
+#include "../intgemm/topology.h"
+
+#include <vector>
+
+namespace intgemm {
+namespace {
+
+TEST_CASE("Parse CPU list", "[topology]") {
+  std::vector<int> cpus;
+  REQUIRE(topology::ParseCPUList("0-3,8,10-11\n", cpus));
+  CHECK(cpus == std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  cpus.clear();
+  REQUIRE(topology::ParseCPUList("", cpus));
+  CHECK(cpus.empty());
+  CHECK(!topology::ParseCPUList("3-1", cpus));
+  CHECK(!topology::ParseCPUList("a", cpus));
+  CHECK(!topology::ParseCPUList("1-", cpus));
+}
+
+TEST_CASE("Parse cache size", "[topology]") {
+  CHECK(topology::ParseCacheSize("48K\n") == 48 * 1024);
+  CHECK(topology::ParseCacheSize("2M") == 2 * 1024 * 1024);
+  CHECK(topology::ParseCacheSize("512") == 512);
+  CHECK(topology::ParseCacheSize("") == 0);
+}
+
+TEST_CASE("Parse cgroup quota", "[topology]") {
+  CHECK(topology::ParseCPUMax("max 100000\n") == 0);
+  CHECK(topology::ParseCPUMax("150000 100000\n") == 2);
+  CHECK(topology::ParseCPUMax("400000 100000") == 4);
+  CHECK(topology::ParseCPUMax("50000") == 1);
+  CHECK(topology::QuotaCPUs(-1, 100000) == 0);
+  CHECK(topology::QuotaCPUs(300000, 100000) == 3);
+  CHECK(topology::QuotaCPUs(10000, 100000) == 1);
+}
+
+TEST_CASE("Detected topology", "[topology]") {
+  const Topology &t = GetTopology();
+  REQUIRE(!t.cpus.empty());
+  CHECK(t.Threads() >= 1);
+  CHECK(t.Threads() <= t.cpus.size());
+  for (std::size_t i = 0; i < t.cpus.size(); ++i) {
+    CHECK(t.cpus[i].weight > 0.0f);
+    CHECK(t.cpus[i].weight <= 1.0f);
+    if (i) CHECK(t.cpus[i].weight <= t.cpus[i - 1].weight);
+  }
+  CHECK(CurrentCPUWeight() > 0.0f);
+}
+
+} // namespace
+} // namespace intgemm
@@ -0,0 +1,111 @@
+#include "test.h"
+#include "../intgemm/trace.h"
+
+#ifdef INTGEMM_TRACE
+
+#include <atomic>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace intgemm {
+namespace {
+
+std::size_t Count(const std::string &haystack, const std::string &needle) {
+  std::size_t count = 0;
+  for (std::size_t at = haystack.find(needle); at != std::string::npos; at = haystack.find(needle, at + 1)) ++count;
+  return count;
+}
+
+std::string Dump() {
+  std::ostringstream out;
+  WriteChromeTrace(out);
+  return out.str();
+}
+
+TEST_CASE("Chrome trace", "[trace]") {
+  if (kCPU < CPUType::SSSE3) return;
+  const Index A_rows = 8, width = 64, B_cols = 64;
+  AlignedVector<float> A(A_rows * width), B(width * B_cols), C(A_rows * B_cols);
+  for (std::size_t i = 0; i < A.size(); ++i) A[i] = static_cast<float>(i % 7) - 3.f;
+  for (std::size_t i = 0; i < B.size(); ++i) B[i] = static_cast<float>(i % 5) - 2.f;
+  AlignedVector<int8_t> A_prepared(A.size()), B_prepared(B.size());
+
+  // Before the clear, so not in the output.
+  Int8::Quantize(A.begin(), A_prepared.begin(), 1.0f, A_rows * width);
+  ClearTrace();
+  CHECK(Count(Dump(), "\"ph\":\"X\"") == 0);
+
+  Int8::PrepareB(B.begin(), B_prepared.begin(), 1.0f, width, B_cols);
+  std::thread([&] {
+    Int8::PrepareA(A.begin(), A_prepared.begin(), 1.0f, A_rows, width);
+  }).join();
+  Int8::Multiply(A_prepared.begin(), B_prepared.begin(), A_rows, width, B_cols, callbacks::UnquantizeAndWrite(1.0f, C.begin()));
+
+  const std::string trace = Dump();
+  CHECK(trace.find("{\"displayTimeUnit\"") == 0);
+  CHECK(trace.substr(trace.size() - 3) == "]}\n");
+  CHECK(Count(trace, "\"name\":\"Multiply\"") == 1);
+  CHECK(Count(trace, "\"args\":{\"rows\":8,\"width\":64,\"cols\":64}") == 1);
+  CHECK(Count(trace, "\"name\":\"PrepareB\"") == 1);
+  CHECK(Count(trace, "\"args\":{\"rows\":64,\"cols\":64}") == 1);
+  // PrepareA and the Quantize it calls.
+  CHECK(Count(trace, "\"name\":\"PrepareA\"") == 1);
+  CHECK(Count(trace, "\"name\":\"Quantize\"") == 1);
+  // PrepareB, Multiply and the 8-bit Quantize run their work in ParallelFor.
+  CHECK(Count(trace, "\"name\":\"ParallelFor\"") >= 3);
+  // The helper thread has its own track.
+  CHECK(Count(trace, "\"name\":\"thread_name\"") >= 2);
+}
+
+TEST_CASE("Chrome trace ring buffer", "[trace]") {
+  ClearTrace();
+  for (std::size_t i = 0; i < trace::kEvents + 10; ++i) {
+    TraceSpan span(Operation::MaxAbsolute, 1, 0, i);
+  }
+  const std::string trace = Dump();
+  CHECK(Count(trace, "\"name\":\"MaxAbsolute\"") == trace::kEvents);
+  // The oldest spans were overwritten.
+  CHECK(Count(trace, "\"cols\":9}") == 0);
+  CHECK(Count(trace, "\"cols\":10}") == 1);
+}
+
+TEST_CASE("Chrome trace reuses buffers of exited threads", "[trace]") {
+  const std::size_t tracks = Count(Dump(), "\"name\":\"thread_name\"");
+  ClearTrace();
+  for (int i = 0; i < 20; ++i) {
+    std::thread([] {
+      TraceSpan span(Operation::MaxAbsolute, 1, 0, 1);
+    }).join();
+  }
+  const std::string trace = Dump();
+  CHECK(Count(trace, "\"name\":\"thread_name\"") <= tracks + 1);
+  CHECK(Count(trace, "\"name\":\"MaxAbsolute\"") == 20);
+}
+
+TEST_CASE("Chrome trace while recording", "[trace]") {
+  ClearTrace();
+  std::atomic<bool> done(false);
+  // Rows and cols match in every span, so a torn one shows.
+  std::thread recorder([&done] {
+    for (uint64_t i = 0; !done.load(std::memory_order_relaxed); ++i) {
+      TraceSpan span(Operation::MaxAbsolute, i, 0, i);
+    }
+  });
+  for (int dump = 0; dump < 20; ++dump) {
+    const std::string trace = Dump();
+    for (std::size_t at = trace.find("\"rows\":"); at != std::string::npos; at = trace.find("\"rows\":", at + 1)) {
+      const std::size_t cols = trace.find("\"cols\":", at);
+      REQUIRE(cols != std::string::npos);
+      CHECK(std::strtoull(trace.c_str() + at + 7, nullptr, 10) == std::strtoull(trace.c_str() + cols + 7, nullptr, 10));
+    }
+  }
+  done.store(true, std::memory_order_relaxed);
+  recorder.join();
+}
+
+} // namespace
+} // namespace intgemm
+
+#endif